@@ -0,0 +1,66 @@
+#include "histogram.h"
+#include <stddef.h>
+#include <time.h>
+
+static size_t hist_bucket(uint64_t ns) {
+    if (ns < (1 << HIST_SUB_BITS)) {
+        return (size_t)ns;
+    }
+    unsigned int msb = 63 - (unsigned int)__builtin_clzll(ns);
+    unsigned int shift = msb - HIST_SUB_BITS;
+    return ((size_t)(shift + 1) << HIST_SUB_BITS) +
+           (size_t)((ns >> shift) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+/**
+ * Smallest value in a bucket.
+ */
+static uint64_t hist_value(size_t bucket) {
+    if (bucket < (1 << HIST_SUB_BITS)) {
+        return bucket;
+    }
+    size_t shift = (bucket >> HIST_SUB_BITS) - 1;
+    uint64_t mantissa =
+        (1 << HIST_SUB_BITS) + (bucket & ((1 << HIST_SUB_BITS) - 1));
+    return mantissa << shift;
+}
+
+void hist_merge(histogram_t *into, histogram_t const *from) {
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+    into->errors += from->errors;
+    into->sum_ns += from->sum_ns;
+}
+
+uint64_t hist_percentile(histogram_t const *hist, double q) {
+    uint64_t target = (uint64_t)(q * (double)hist->total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > target) {
+            return hist_value(i);
+        }
+    }
+    return 0;
+}
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void hist_record(histogram_t *hist, uint64_t start, bool ok) {
+    hist_add(hist, now_ns() - start, ok);
+}
+
+void hist_add(histogram_t *hist, uint64_t ns, bool ok) {
+    hist->counts[hist_bucket(ns)]++;
+    hist->total++;
+    hist->sum_ns += ns;
+    if (!ok) {
+        hist->errors++;
+    }
+}
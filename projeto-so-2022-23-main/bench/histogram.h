@@ -0,0 +1,44 @@
+#ifndef BENCH_HISTOGRAM_H
+#define BENCH_HISTOGRAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Latency histogram with log-linear buckets: values below 2^HIST_SUB_BITS
+ * have their own bucket, larger ones share it with those with the same
+ * HIST_SUB_BITS + 1 leading bits (within 12.5% of each other).
+ */
+#define HIST_SUB_BITS (3)
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t errors;
+    uint64_t sum_ns;
+} histogram_t;
+
+/**
+ * Monotonic clock, in nanoseconds.
+ */
+uint64_t now_ns(void);
+
+/**
+ * Add the latency of a call (successful or not).
+ */
+void hist_add(histogram_t *hist, uint64_t ns, bool ok);
+
+/**
+ * Add the latency of a call that started at now_ns() time start.
+ */
+void hist_record(histogram_t *hist, uint64_t start, bool ok);
+
+void hist_merge(histogram_t *into, histogram_t const *from);
+
+/**
+ * Value below which a fraction q of the samples are.
+ */
+uint64_t hist_percentile(histogram_t const *hist, double q);
+
+#endif // BENCH_HISTOGRAM_H
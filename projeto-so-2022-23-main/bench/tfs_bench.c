@@ -0,0 +1,314 @@
+#include "bench/histogram.h"
+#include "fs/operations.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * TécnicoFS microbenchmarks.
+ *
+ * For every combination of parameter preset, thread count and file size, each
+ * thread repeatedly creates, writes, reads, links, unlinks and copies (from the
+ * host file system) its own files, timing every call. Results go to stdout as
+ * CSV, one line per operation, with the throughput of the operation across
+ * threads and its latency percentiles.
+ *
+ * Usage: tfs_bench [-t threads,...] [-s file_sizes,...] [-p presets,...]
+ *                  [-n iterations]
+ *
+ * Build with `make SANITIZE=no` for meaningful numbers.
+ */
+
+typedef enum {
+    OP_OPEN,
+    OP_WRITE,
+    OP_READ,
+    OP_LINK,
+    OP_UNLINK,
+    OP_COPY,
+    OP_COUNT,
+} bench_op_t;
+
+static char const *const op_names[OP_COUNT] = {
+    "open", "write", "read", "link", "unlink", "copy_from_external_fs",
+};
+
+typedef struct {
+    int id;
+    size_t file_size;
+    size_t iterations;
+    char const *source_path;
+    pthread_barrier_t *start;
+    histogram_t hist[OP_COUNT];
+} worker_t;
+
+static void *worker_loop(void *arg) {
+    worker_t *worker = arg;
+    char path[16];
+    char link_path[16];
+    char copy_path[16];
+    snprintf(path, sizeof(path), "/b%d", worker->id);
+    snprintf(link_path, sizeof(link_path), "/l%d", worker->id);
+    snprintf(copy_path, sizeof(copy_path), "/c%d", worker->id);
+
+    char *buffer = malloc(worker->file_size);
+    if (buffer == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(buffer, 'a' + worker->id % 26, worker->file_size);
+
+    pthread_barrier_wait(worker->start);
+
+    for (size_t i = 0; i < worker->iterations; i++) {
+        uint64_t start = now_ns();
+        int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+        hist_record(&worker->hist[OP_OPEN], start, f != -1);
+        if (f != -1) {
+            start = now_ns();
+            ssize_t written = tfs_write(f, buffer, worker->file_size);
+            hist_record(&worker->hist[OP_WRITE], start,
+                        written == (ssize_t)worker->file_size);
+            tfs_close(f);
+        }
+
+        start = now_ns();
+        f = tfs_open(path, 0);
+        hist_record(&worker->hist[OP_OPEN], start, f != -1);
+        if (f != -1) {
+            start = now_ns();
+            ssize_t read = tfs_read(f, buffer, worker->file_size);
+            hist_record(&worker->hist[OP_READ], start,
+                        read == (ssize_t)worker->file_size);
+            tfs_close(f);
+        }
+
+        start = now_ns();
+        int res = tfs_link(path, link_path);
+        hist_record(&worker->hist[OP_LINK], start, res == 0);
+        start = now_ns();
+        res = tfs_unlink(link_path);
+        hist_record(&worker->hist[OP_UNLINK], start, res != -1);
+
+        start = now_ns();
+        res = tfs_copy_from_external_fs(worker->source_path, copy_path);
+        hist_record(&worker->hist[OP_COPY], start, res != -1);
+        start = now_ns();
+        res = tfs_unlink(copy_path);
+        hist_record(&worker->hist[OP_UNLINK], start, res != -1);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Parameters of a named preset.
+ *
+ * Returns 0 if the preset exists, -1 otherwise.
+ */
+static int preset_params(char const *name, tfs_params *params) {
+    *params = tfs_default_params();
+    // Room for the files of many threads
+    params->max_inode_count = 1024;
+    params->max_block_count = 4096;
+    params->max_open_files_count = 256;
+
+    if (strcmp(name, "default") == 0) {
+        return 0;
+    } else if (strcmp(name, "inline") == 0) {
+        params->inline_small_files = true;
+    } else if (strcmp(name, "dedup") == 0) {
+        params->dedup_blocks = true;
+    } else if (strcmp(name, "compressed") == 0) {
+        params->compressed_pool_size = params->max_block_count * 256;
+        params->block_cache_count = 256;
+    } else if (strcmp(name, "shards4") == 0) {
+        params->shard_count = 4;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Write a file of a given size in the host file system.
+ */
+static int make_source(char const *path, size_t size) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        fputc('x', f);
+    }
+    return fclose(f);
+}
+
+static int run(char const *preset, size_t threads, size_t file_size,
+               size_t iterations) {
+    tfs_params params;
+    if (preset_params(preset, &params) != 0) {
+        fprintf(stderr, "unknown preset: %s\n", preset);
+        return -1;
+    }
+
+    char source_path[64];
+    snprintf(source_path, sizeof(source_path), "/tmp/tfs_bench_%d.src",
+             (int)getpid());
+    if (make_source(source_path, file_size) != 0) {
+        perror(source_path);
+        return -1;
+    }
+
+    if (tfs_init(&params) != 0) {
+        fprintf(stderr, "tfs_init failed for preset %s\n", preset);
+        unlink(source_path);
+        return -1;
+    }
+
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    pthread_barrier_t start;
+    if (workers == NULL || tids == NULL ||
+        pthread_barrier_init(&start, NULL, (unsigned int)threads) != 0) {
+        perror("bench setup");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        workers[i].id = (int)i;
+        workers[i].file_size = file_size;
+        workers[i].iterations = iterations;
+        workers[i].source_path = source_path;
+        workers[i].start = &start;
+        if (pthread_create(&tids[i], NULL, worker_loop, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    for (size_t op = 0; op < OP_COUNT; op++) {
+        histogram_t *total = calloc(1, sizeof(histogram_t));
+        if (total == NULL) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < threads; i++) {
+            hist_merge(total, &workers[i].hist[op]);
+        }
+
+        // Operations per second of time spent in the operation, across threads
+        double throughput =
+            total->sum_ns == 0 ? 0
+                               : (double)total->total * (double)threads * 1e9 /
+                                     (double)total->sum_ns;
+        printf("%s,%zu,%zu,%s,%llu,%llu,%.0f,%llu,%llu,%llu\n", preset,
+               threads, file_size, op_names[op],
+               (unsigned long long)total->total,
+               (unsigned long long)total->errors, throughput,
+               (unsigned long long)hist_percentile(total, 0.5),
+               (unsigned long long)hist_percentile(total, 0.99),
+               (unsigned long long)hist_percentile(total, 0.999));
+        free(total);
+    }
+    fflush(stdout);
+
+    pthread_barrier_destroy(&start);
+    free(tids);
+    free(workers);
+    tfs_destroy();
+    unlink(source_path);
+    return 0;
+}
+
+/**
+ * Parse a comma-separated list of positive numbers.
+ *
+ * Returns the number of values stored, 0 if the list is invalid.
+ */
+static size_t parse_sizes(char *list, size_t *values, size_t max) {
+    size_t count = 0;
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char *end;
+        unsigned long value = strtoul(tok, &end, 10);
+        if (*end != '\0' || value == 0 || count == max) {
+            return 0;
+        }
+        values[count++] = value;
+    }
+    return count;
+}
+
+#define MAX_SWEEP (16)
+
+int main(int argc, char **argv) {
+    size_t threads[MAX_SWEEP] = {1, 2, 4, 8};
+    size_t thread_count = 4;
+    size_t sizes[MAX_SWEEP] = {64, 256, 1024};
+    size_t size_count = 3;
+    char *presets[MAX_SWEEP] = {"default", "inline", "dedup", "compressed",
+                                "shards4"};
+    size_t preset_count = 5;
+    size_t iterations = 200;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:p:n:")) != -1) {
+        switch (opt) {
+        case 't':
+            thread_count = parse_sizes(optarg, threads, MAX_SWEEP);
+            break;
+        case 's':
+            size_count = parse_sizes(optarg, sizes, MAX_SWEEP);
+            break;
+        case 'p':
+            preset_count = 0;
+            for (char *tok = strtok(optarg, ","); tok != NULL;
+                 tok = strtok(NULL, ",")) {
+                if (preset_count < MAX_SWEEP) {
+                    presets[preset_count++] = tok;
+                }
+            }
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            thread_count = 0;
+            break;
+        }
+    }
+
+    if (thread_count == 0 || size_count == 0 || preset_count == 0 ||
+        iterations == 0) {
+        fprintf(stderr,
+                "usage: %s [-t threads,...] [-s file_sizes,...] "
+                "[-p presets,...] [-n iterations]\n"
+                "presets: default, inline, dedup, compressed, shards4\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("preset,threads,file_size,op,count,errors,throughput_ops_s,p50_ns,"
+           "p99_ns,p999_ns\n");
+
+    int res = EXIT_SUCCESS;
+    for (size_t p = 0; p < preset_count; p++) {
+        for (size_t t = 0; t < thread_count; t++) {
+            for (size_t s = 0; s < size_count; s++) {
+                if (run(presets[p], threads[t], sizes[s], iterations) != 0) {
+                    res = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    return res;
+}
@@ -0,0 +1,90 @@
+#include "fs/events.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Conversion of an events file (see fs/events.h) into Chrome trace JSON, to
+ * load into chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Each event becomes a complete event ("ph": "X") of its thread, with its
+ * start and duration in microseconds since the first event was recorded, and
+ * its argument. Events of a thread that ran inside one another (e.g. the
+ * insert_delay calls of a lookup) show nested.
+ *
+ * Usage: tfs_events events_file > trace.json
+ */
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s events_file\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    tfs_events_header_t header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TFS_EVENTS_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s: not an events file\n", argv[1]);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+
+    // Timestamp counter ticks per microsecond, from the two calibrations
+    double ticks_per_us = 1000.0;
+    if (header.tsc_end > header.tsc_begin && header.ns_end > header.ns_begin) {
+        ticks_per_us = (double)(header.tsc_end - header.tsc_begin) * 1000.0 /
+                       (double)(header.ns_end - header.ns_begin);
+    }
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    unsigned last_thread = 0;
+    bool first = true;
+    tfs_event_t event;
+    uint64_t count = 0;
+    while (fread(&event, sizeof(event), 1, f) == 1) {
+        char const *name = event_type_name((event_type_t)event.type);
+        if (name == NULL) {
+            fprintf(stderr, "%s: unknown event type %u\n", argv[1],
+                    (unsigned)event.type);
+            fclose(f);
+            return EXIT_FAILURE;
+        }
+
+        if (event.thread != last_thread) {
+            // Events are grouped by thread: name each thread once
+            last_thread = event.thread;
+            printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                   first ? "" : ",\n", last_thread, last_thread);
+            first = false;
+        }
+
+        // Signed: the first event starts before the calibration
+        double ts = ((double)event.tsc - (double)header.tsc_begin) /
+                    ticks_per_us;
+        printf(",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+               "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%" PRId64 "}}",
+               name, (unsigned)event.thread, ts,
+               (double)event.duration / ticks_per_us, event.arg);
+        count++;
+    }
+    printf("\n]}\n");
+
+    bool failed = ferror(f) != 0;
+    fclose(f);
+    if (failed || count != header.event_count) {
+        fprintf(stderr, "%s: truncated (%" PRIu64 " of %" PRIu64 " events)\n",
+                argv[1], count, header.event_count);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
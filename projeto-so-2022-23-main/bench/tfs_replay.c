@@ -0,0 +1,437 @@
+#include "bench/histogram.h"
+#include "fs/operations.h"
+#include "fs/trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Replay of a trace taken with tfs_trace_start.
+ *
+ * The trace's calls are issued again on a fresh instance (tfs_init with the
+ * traced parameters, in memory), one thread per traced thread, each issuing
+ * its calls in their original order. By default each call waits until it is
+ * as far into the replay as it was into the trace, reproducing the original
+ * timing; with -f, calls are issued as fast as possible. The data written is
+ * not in the trace, so writes use filler bytes of the traced sizes, and
+ * neither are all the path names of a tfs_stat_many call, so it looks up its
+ * first two over and over, as many times as it had path names.
+ *
+ * Results go to stdout as CSV, one line per operation plus a total, with the
+ * throughput over the whole replay, the latency percentiles of the replay and
+ * of the trace, and how many calls failed (or succeeded) unlike in the trace.
+ *
+ * Usage: tfs_replay [-f] trace_file
+ */
+
+static char const *const op_names[TFS_OP_COUNT] = {
+    "open",    "sym_link", "link",   "close",
+    "flush",   "write",    "read",   "unlink",
+    "copy_from_external_fs",
+    "opendir", "readdir",  "stat",   "stat_many",
+    "rename",
+};
+
+typedef struct {
+    tfs_trace_record_t record;
+    char *name;
+    char *name2;
+} call_t;
+
+typedef struct {
+    uint32_t thread;
+    call_t *calls;
+    size_t count;
+    size_t capacity;
+    size_t max_len;
+    size_t max_entries;
+    size_t max_paths;
+    histogram_t hist[TFS_OP_COUNT];
+    uint64_t diverged[TFS_OP_COUNT];
+    pthread_t tid;
+} replayer_t;
+
+static bool as_fast = false;
+static uint64_t replay_epoch;
+
+// Replay file handle of each traced file handle (-1 if none)
+static atomic_int *handles = NULL;
+static size_t handle_count = 0;
+
+static int map_handle(int traced) {
+    if (traced < 0 || (size_t)traced >= handle_count) {
+        return -1;
+    }
+    return atomic_load(&handles[traced]);
+}
+
+/**
+ * Write a file of a given size in the host file system.
+ */
+static int make_source(char const *path, uint64_t size) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < size; i++) {
+        fputc('x', f);
+    }
+    return fclose(f);
+}
+
+static void wait_until(uint64_t start_ns) {
+    uint64_t target = replay_epoch + start_ns;
+    if (target <= now_ns()) {
+        return; // running late
+    }
+    struct timespec ts = {(time_t)(target / 1000000000),
+                          (long)(target % 1000000000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static void *replay_loop(void *arg) {
+    replayer_t *replayer = arg;
+
+    char *buffer = malloc(replayer->max_len > 0 ? replayer->max_len : 1);
+    if (buffer == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(buffer, 'r', replayer->max_len);
+    tfs_dirent_t *entries = malloc(
+        (replayer->max_entries > 0 ? replayer->max_entries : 1) *
+        sizeof(tfs_dirent_t));
+    if (entries == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    // Listings continue on the thread's last tfs_opendir
+    tfs_dir_t dir = {0};
+    size_t max_paths = replayer->max_paths > 0 ? replayer->max_paths : 1;
+    char const **paths = malloc(max_paths * sizeof(char const *));
+    tfs_stat_t *stats = malloc(max_paths * sizeof(tfs_stat_t));
+    if (paths == NULL || stats == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    char source_path[64];
+    snprintf(source_path, sizeof(source_path), "/tmp/tfs_replay_%d_%u.src",
+             (int)getpid(), replayer->thread);
+    uint64_t source_len = UINT64_MAX;
+
+    for (size_t i = 0; i < replayer->count; i++) {
+        call_t const *call = &replayer->calls[i];
+        tfs_trace_record_t const *record = &call->record;
+
+        if (record->op == TFS_OP_COPY_FROM_EXTERNAL &&
+            record->len != source_len) {
+            if (make_source(source_path, record->len) != 0) {
+                perror(source_path);
+                exit(EXIT_FAILURE);
+            }
+            source_len = record->len;
+        }
+        if (!as_fast) {
+            wait_until(record->start_ns);
+        }
+
+        int64_t res = -1;
+        uint64_t start = now_ns();
+        switch ((tfs_op_t)record->op) {
+        case TFS_OP_OPEN:
+            res = tfs_open(call->name, (tfs_file_mode_t)record->arg);
+            break;
+        case TFS_OP_SYM_LINK:
+            res = tfs_sym_link(call->name, call->name2);
+            break;
+        case TFS_OP_LINK:
+            res = tfs_link(call->name, call->name2);
+            break;
+        case TFS_OP_CLOSE:
+            res = tfs_close(map_handle(record->arg));
+            break;
+        case TFS_OP_FLUSH:
+            res = tfs_flush(map_handle(record->arg));
+            break;
+        case TFS_OP_WRITE:
+            res = tfs_write(map_handle(record->arg), buffer, record->len);
+            break;
+        case TFS_OP_READ:
+            res = tfs_read(map_handle(record->arg), buffer, record->len);
+            break;
+        case TFS_OP_UNLINK:
+            res = tfs_unlink(call->name);
+            break;
+        case TFS_OP_COPY_FROM_EXTERNAL:
+            res = tfs_copy_from_external_fs(source_path, call->name2);
+            break;
+        case TFS_OP_OPENDIR:
+            res = tfs_opendir(call->name, &dir);
+            break;
+        case TFS_OP_READDIR:
+            res = tfs_readdir_batch(&dir, entries, record->len);
+            break;
+        case TFS_OP_STAT:
+            res = tfs_stat(call->name, &stats[0]);
+            break;
+        case TFS_OP_STAT_MANY:
+            for (size_t j = 0; j < record->len; j++) {
+                paths[j] = j % 2 == 1 && call->name2[0] != '\0' ? call->name2
+                                                                : call->name;
+            }
+            res = tfs_stat_many(paths, record->len, stats);
+            break;
+        case TFS_OP_RENAME:
+            res = tfs_rename(call->name, call->name2);
+            break;
+        case TFS_OP_COUNT:
+        default:
+            break;
+        }
+        hist_record(&replayer->hist[record->op], start, res >= 0);
+
+        if (record->op == TFS_OP_OPEN && record->result >= 0 &&
+            (size_t)record->result < handle_count) {
+            atomic_store(&handles[record->result], (int)res);
+        }
+        if ((res < 0) != (record->result < 0)) {
+            replayer->diverged[record->op]++;
+        }
+    }
+
+    if (source_len != UINT64_MAX) {
+        unlink(source_path);
+    }
+    free(stats);
+    free(paths);
+    free(entries);
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Replayer of a traced thread, added to the array if new.
+ */
+static replayer_t *replayer_of(replayer_t **replayers, size_t *count,
+                               uint32_t thread) {
+    for (size_t i = 0; i < *count; i++) {
+        if ((*replayers)[i].thread == thread) {
+            return &(*replayers)[i];
+        }
+    }
+
+    replayer_t *grown = realloc(*replayers, (*count + 1) * sizeof(replayer_t));
+    if (grown == NULL) {
+        return NULL;
+    }
+    *replayers = grown;
+    replayer_t *replayer = &grown[(*count)++];
+    memset(replayer, 0, sizeof(*replayer));
+    replayer->thread = thread;
+    return replayer;
+}
+
+/**
+ * Load the calls of a trace, by thread (in each thread, calls complete in the
+ * order they start, so the trace has them in order).
+ *
+ * Returns the number of threads, 0 if the trace could not be read.
+ */
+static size_t load_trace(FILE *f, replayer_t **replayers) {
+    size_t count = 0;
+    tfs_trace_record_t record;
+    char name[256];
+    char name2[256];
+    int res;
+
+    while ((res = trace_read_record(f, &record, name, name2)) == 1) {
+        replayer_t *replayer = replayer_of(replayers, &count, record.thread);
+        if (replayer == NULL) {
+            return 0;
+        }
+        if (replayer->count == replayer->capacity) {
+            size_t capacity =
+                replayer->capacity == 0 ? 64 : replayer->capacity * 2;
+            call_t *calls =
+                realloc(replayer->calls, capacity * sizeof(call_t));
+            if (calls == NULL) {
+                return 0;
+            }
+            replayer->calls = calls;
+            replayer->capacity = capacity;
+        }
+
+        call_t *call = &replayer->calls[replayer->count++];
+        call->record = record;
+        call->name = strdup(name);
+        call->name2 = strdup(name2);
+        if (call->name == NULL || call->name2 == NULL) {
+            return 0;
+        }
+
+        if ((record.op == TFS_OP_WRITE || record.op == TFS_OP_READ) &&
+            record.len > replayer->max_len) {
+            replayer->max_len = record.len;
+        }
+        if (record.op == TFS_OP_READDIR && record.len > replayer->max_entries) {
+            replayer->max_entries = record.len;
+        }
+        if (record.op == TFS_OP_STAT_MANY && record.len > replayer->max_paths) {
+            replayer->max_paths = record.len;
+        }
+        if (record.op == TFS_OP_OPEN && record.result >= 0 &&
+            (size_t)record.result >= handle_count) {
+            handle_count = (size_t)record.result + 1;
+        }
+    }
+
+    return res == 0 ? count : 0;
+}
+
+static void print_line(char const *op, histogram_t const *hist,
+                       histogram_t const *traced, uint64_t diverged,
+                       double seconds) {
+    printf("%s,%llu,%llu,%llu,%.0f,%llu,%llu,%llu,%llu,%llu,%llu\n", op,
+           (unsigned long long)hist->total, (unsigned long long)hist->errors,
+           (unsigned long long)diverged, (double)hist->total / seconds,
+           (unsigned long long)hist_percentile(hist, 0.5),
+           (unsigned long long)hist_percentile(hist, 0.99),
+           (unsigned long long)hist_percentile(hist, 0.999),
+           (unsigned long long)hist_percentile(traced, 0.5),
+           (unsigned long long)hist_percentile(traced, 0.99),
+           (unsigned long long)hist_percentile(traced, 0.999));
+}
+
+static void report(replayer_t const *replayers, size_t count,
+                   double seconds) {
+    histogram_t *hists = calloc(2 * (TFS_OP_COUNT + 1),
+                                sizeof(histogram_t));
+    if (hists == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    // Replay histograms, then those of the trace, the totals last
+    histogram_t *traced = &hists[TFS_OP_COUNT + 1];
+    uint64_t diverged[TFS_OP_COUNT + 1] = {0};
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t op = 0; op < TFS_OP_COUNT; op++) {
+            hist_merge(&hists[op], &replayers[i].hist[op]);
+            hist_merge(&hists[TFS_OP_COUNT], &replayers[i].hist[op]);
+            diverged[op] += replayers[i].diverged[op];
+            diverged[TFS_OP_COUNT] += replayers[i].diverged[op];
+        }
+        for (size_t j = 0; j < replayers[i].count; j++) {
+            tfs_trace_record_t const *record = &replayers[i].calls[j].record;
+            hist_add(&traced[record->op], record->duration_ns,
+                     record->result >= 0);
+            hist_add(&traced[TFS_OP_COUNT], record->duration_ns,
+                     record->result >= 0);
+        }
+    }
+
+    printf("op,count,errors,diverged,throughput_ops_s,p50_ns,p99_ns,p999_ns,"
+           "traced_p50_ns,traced_p99_ns,traced_p999_ns\n");
+    for (size_t op = 0; op < TFS_OP_COUNT; op++) {
+        if (hists[op].total > 0) {
+            print_line(op_names[op], &hists[op], &traced[op], diverged[op],
+                       seconds);
+        }
+    }
+    print_line("all", &hists[TFS_OP_COUNT], &traced[TFS_OP_COUNT],
+               diverged[TFS_OP_COUNT], seconds);
+    free(hists);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        if (opt == 'f') {
+            as_fast = true;
+        } else {
+            optind = argc + 1; // usage
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-f] trace_file\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    tfs_trace_header_t header;
+    replayer_t *replayers = NULL;
+    size_t count = 0;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TFS_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        (count = load_trace(f, &replayers)) == 0) {
+        fprintf(stderr, "%s: not a trace, or an empty one\n", argv[optind]);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+    fclose(f);
+
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = header.max_inode_count;
+    params.max_block_count = header.max_block_count;
+    params.max_open_files_count = header.max_open_files_count;
+    params.block_size = header.block_size;
+    params.block_cache_count = header.block_cache_count;
+    params.compressed_pool_size = header.compressed_pool_size;
+    params.shard_count = header.shard_count;
+    params.dedup_blocks = header.dedup_blocks;
+    params.inline_small_files = header.inline_small_files;
+    params.huge_pages = header.huge_pages;
+    if (tfs_init(&params) != 0) {
+        fprintf(stderr, "tfs_init failed\n");
+        return EXIT_FAILURE;
+    }
+
+    handles = malloc(handle_count * sizeof(atomic_int) + 1);
+    if (handles == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < handle_count; i++) {
+        atomic_init(&handles[i], -1);
+    }
+
+    replay_epoch = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        if (pthread_create(&replayers[i].tid, NULL, replay_loop,
+                           &replayers[i]) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(replayers[i].tid, NULL);
+    }
+    double seconds = (double)(now_ns() - replay_epoch) / 1e9;
+
+    report(replayers, count, seconds);
+
+    tfs_destroy();
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < replayers[i].count; j++) {
+            free(replayers[i].calls[j].name);
+            free(replayers[i].calls[j].name2);
+        }
+        free(replayers[i].calls);
+    }
+    free(replayers);
+    free(handles);
+    return EXIT_SUCCESS;
+}
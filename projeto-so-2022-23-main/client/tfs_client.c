@@ -0,0 +1,410 @@
+#include "tfs_client.h"
+#include "server/protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read and write requests sent before waiting for the first reply (replies
+// are buffered in the reply pipe or ring, which must not fill up)
+#define PIPELINE_DEPTH (8)
+
+static_assert(PIPELINE_DEPTH <= TFS_SHM_RING_SIZE,
+              "requests in flight must fit in the rings");
+
+static bool mounted = false;
+static char server_path[TFS_PATH_SIZE];
+
+// Pipe session
+static int request_fd = -1;
+static int reply_fd = -1;
+static char request_path[TFS_PATH_SIZE + 8];
+static char reply_path[TFS_PATH_SIZE + 8];
+static tfs_request_t pipe_request;
+static tfs_reply_t pipe_reply;
+
+// Shared memory session (NULL for a pipe session)
+static tfs_shm_region_t *region = NULL;
+static char region_path[TFS_PATH_SIZE + 8];
+
+static int make_fifo(char const *path) {
+    if (unlink(path) != 0 && errno != ENOENT) {
+        return -1;
+    }
+    return mkfifo(path, 0640);
+}
+
+/**
+ * Ask the server for a session, on its pipe.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int send_mount(tfs_op_code_t op_code, char const *client_path,
+                      char const *server_pipe_path) {
+    tfs_request_t request = {.op_code = (uint8_t)op_code};
+    strcpy(request.name, client_path);
+
+    int server_fd = open(server_pipe_path, O_WRONLY);
+    if (server_fd == -1) {
+        return -1;
+    }
+    int res = pipe_write_all(server_fd, &request, sizeof(request));
+    close(server_fd);
+    return res;
+}
+
+int tfs_mount(char const *client_pipe_path, char const *server_pipe_path) {
+    if (mounted || strlen(client_pipe_path) >= TFS_PATH_SIZE ||
+        strlen(server_pipe_path) >= TFS_PATH_SIZE) {
+        return -1;
+    }
+
+    snprintf(request_path, sizeof(request_path), "%s.req", client_pipe_path);
+    snprintf(reply_path, sizeof(reply_path), "%s.rep", client_pipe_path);
+    if (make_fifo(request_path) != 0 || make_fifo(reply_path) != 0) {
+        unlink(request_path);
+        return -1;
+    }
+
+    if (send_mount(TFS_OP_CODE_MOUNT, client_pipe_path, server_pipe_path) !=
+        0) {
+        unlink(request_path);
+        unlink(reply_path);
+        return -1;
+    }
+
+    // Both block until a server worker opens the other end, in this order
+    request_fd = open(request_path, O_WRONLY);
+    reply_fd = request_fd == -1 ? -1 : open(reply_path, O_RDONLY);
+    if (reply_fd == -1) {
+        if (request_fd != -1) {
+            close(request_fd);
+            request_fd = -1;
+        }
+        unlink(request_path);
+        unlink(reply_path);
+        return -1;
+    }
+
+    strcpy(server_path, server_pipe_path);
+    mounted = true;
+    return 0;
+}
+
+/**
+ * Like tfs_mount, wait for a server worker to take the shared memory session.
+ *
+ * Returns true once one does, false if the server exits first.
+ */
+static bool wait_attached(char const *server_pipe_path) {
+    while (atomic_load(&region->attached) == 0) {
+        // Opening a FIFO for writing without blocking fails with ENXIO once
+        // no process (the server) has it open for reading
+        int fd = open(server_pipe_path, O_WRONLY | O_NONBLOCK);
+        if (fd == -1 && (errno == ENXIO || errno == ENOENT)) {
+            return false;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+        // Sleeps a short while at most
+        shm_futex_wait(&region->attached, 0);
+    }
+    return true;
+}
+
+int tfs_mount_shm(char const *client_path, char const *server_pipe_path) {
+    if (mounted || strlen(client_path) >= TFS_PATH_SIZE ||
+        strlen(server_pipe_path) >= TFS_PATH_SIZE) {
+        return -1;
+    }
+
+    snprintf(region_path, sizeof(region_path), "%s.shm", client_path);
+    int fd = open(region_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    // The file starts zeroed, as are the ring counters
+    if (ftruncate(fd, sizeof(tfs_shm_region_t)) != 0) {
+        close(fd);
+        unlink(region_path);
+        return -1;
+    }
+    region = mmap(NULL, sizeof(tfs_shm_region_t), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        region = NULL;
+        unlink(region_path);
+        return -1;
+    }
+
+    region->client_pid = getpid();
+
+    int res = send_mount(TFS_OP_CODE_MOUNT_SHM, client_path, server_pipe_path);
+    if (res != 0 || !wait_attached(server_pipe_path)) {
+        munmap(region, sizeof(tfs_shm_region_t));
+        region = NULL;
+        unlink(region_path);
+        return -1;
+    }
+
+    strcpy(server_path, server_pipe_path);
+    mounted = true;
+    return 0;
+}
+
+/**
+ * Request to fill in before send_request(): the next ring slot, in a shared
+ * memory session.
+ */
+static tfs_request_t *next_request(void) {
+    if (region != NULL) {
+        unsigned int head = atomic_load(&region->requests_ring.head);
+        return &region->requests[head % TFS_SHM_RING_SIZE];
+    }
+    return &pipe_request;
+}
+
+/**
+ * Send the request filled in at next_request().
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int send_request(void) {
+    if (region != NULL) {
+        shm_ring_publish(&region->requests_ring);
+        return 0;
+    }
+    return pipe_write_all(request_fd, &pipe_request, sizeof(pipe_request));
+}
+
+/**
+ * Wait for the reply to the oldest request in flight, which stays valid until
+ * release_reply().
+ *
+ * Returns the reply, or NULL if the server went away.
+ */
+static tfs_reply_t const *receive_reply(void) {
+    if (region != NULL) {
+        if (shm_ring_wait(&region->replies_ring, region->server_pid) != 0) {
+            return NULL;
+        }
+        unsigned int tail = atomic_load(&region->replies_ring.tail);
+        return &region->replies[tail % TFS_SHM_RING_SIZE];
+    }
+    if (pipe_read_all(reply_fd, &pipe_reply, sizeof(pipe_reply)) != 1) {
+        return NULL;
+    }
+    return &pipe_reply;
+}
+
+static void release_reply(void) {
+    if (region != NULL) {
+        shm_ring_release(&region->replies_ring);
+    }
+}
+
+/**
+ * Send a request (filled in at next_request()) and wait for its reply.
+ *
+ * Returns the result in the reply, or -1 if the server could not be reached.
+ */
+static int64_t call(void) {
+    if (send_request() != 0) {
+        return -1;
+    }
+    tfs_reply_t const *reply = receive_reply();
+    if (reply == NULL) {
+        return -1;
+    }
+    int64_t result = reply->result;
+    release_reply();
+    return result;
+}
+
+int tfs_unmount() {
+    if (!mounted) {
+        return -1;
+    }
+
+    next_request()->op_code = TFS_OP_CODE_UNMOUNT;
+    if (call() != 0) {
+        return -1;
+    }
+
+    if (region != NULL) {
+        munmap(region, sizeof(tfs_shm_region_t));
+        region = NULL;
+        unlink(region_path);
+    } else {
+        close(request_fd);
+        close(reply_fd);
+        request_fd = -1;
+        reply_fd = -1;
+        unlink(request_path);
+        unlink(reply_path);
+    }
+    mounted = false;
+    return 0;
+}
+
+/**
+ * Send a request naming up to two paths, and wait for its reply.
+ */
+static int call_names(tfs_op_code_t op_code, char const *name,
+                      char const *name2, int mode) {
+    if (!mounted || strlen(name) >= TFS_PATH_SIZE ||
+        (name2 != NULL && strlen(name2) >= TFS_PATH_SIZE)) {
+        return -1;
+    }
+
+    tfs_request_t *request = next_request();
+    request->op_code = (uint8_t)op_code;
+    request->mode = mode;
+    strcpy(request->name, name);
+    strcpy(request->name2, name2 != NULL ? name2 : "");
+    return (int)call();
+}
+
+/**
+ * Send a request on a file handle, and wait for its reply.
+ */
+static int call_handle(tfs_op_code_t op_code, int fhandle) {
+    if (!mounted) {
+        return -1;
+    }
+
+    tfs_request_t *request = next_request();
+    request->op_code = (uint8_t)op_code;
+    request->fhandle = fhandle;
+    return (int)call();
+}
+
+int tfs_remote_open(char const *name, tfs_file_mode_t mode) {
+    return call_names(TFS_OP_CODE_OPEN, name, NULL, (int)mode);
+}
+
+int tfs_remote_sym_link(char const *target, char const *link_name) {
+    return call_names(TFS_OP_CODE_SYM_LINK, target, link_name, 0);
+}
+
+int tfs_remote_link(char const *target, char const *link_name) {
+    return call_names(TFS_OP_CODE_LINK, target, link_name, 0);
+}
+
+int tfs_remote_unlink(char const *target) {
+    return call_names(TFS_OP_CODE_UNLINK, target, NULL, 0);
+}
+
+int tfs_remote_close(int fhandle) {
+    return call_handle(TFS_OP_CODE_CLOSE, fhandle);
+}
+
+int tfs_remote_flush(int fhandle) {
+    return call_handle(TFS_OP_CODE_FLUSH, fhandle);
+}
+
+/**
+ * Read or write len bytes in chunks of up to TFS_IO_SIZE, keeping up to
+ * PIPELINE_DEPTH requests in flight. Stops sending requests after the first
+ * short or failed one. The payload is copied straight between the buffer and
+ * the request or reply.
+ *
+ * Returns the number of bytes transferred, -1 if the first request failed.
+ */
+static ssize_t transfer(tfs_op_code_t op_code, int fhandle, char *read_buffer,
+                        char const *write_buffer, size_t len) {
+    if (!mounted) {
+        return -1;
+    }
+
+    size_t chunks = len == 0 ? 1 : (len + TFS_IO_SIZE - 1) / TFS_IO_SIZE;
+    size_t sent = 0;
+    size_t received = 0;
+    size_t done = 0;
+    bool stop = false;
+    ssize_t res = 0;
+
+    while (received < sent || (!stop && sent < chunks)) {
+        while (!stop && sent < chunks && sent - received < PIPELINE_DEPTH) {
+            size_t offset = sent * TFS_IO_SIZE;
+            size_t to_send =
+                len - offset < TFS_IO_SIZE ? len - offset : TFS_IO_SIZE;
+
+            tfs_request_t *request = next_request();
+            request->op_code = (uint8_t)op_code;
+            request->fhandle = fhandle;
+            request->len = (uint32_t)to_send;
+            if (write_buffer != NULL) {
+                memcpy(request->data, write_buffer + offset, to_send);
+            }
+            if (send_request() != 0) {
+                return -1; // the session is broken
+            }
+            sent++;
+        }
+
+        tfs_reply_t const *reply = receive_reply();
+        if (reply == NULL) {
+            return -1;
+        }
+
+        size_t offset = received * TFS_IO_SIZE;
+        size_t expected =
+            len - offset < TFS_IO_SIZE ? len - offset : TFS_IO_SIZE;
+        received++;
+
+        if (res == -1 || done < offset) {
+            // A previous chunk stopped short
+        } else if (reply->result < 0) {
+            res = done == 0 ? -1 : res;
+            stop = true;
+        } else {
+            size_t result = (size_t)reply->result;
+            if (result > expected) {
+                result = expected; // never trust the other process
+            }
+            if (read_buffer != NULL) {
+                memcpy(read_buffer + offset, reply->data, result);
+            }
+            done += result;
+            res = (ssize_t)done;
+            if (result < expected) {
+                stop = true;
+            }
+        }
+
+        release_reply();
+    }
+
+    return res;
+}
+
+ssize_t tfs_remote_write(int fhandle, void const *buffer, size_t len) {
+    return transfer(TFS_OP_CODE_WRITE, fhandle, NULL, buffer, len);
+}
+
+ssize_t tfs_remote_read(int fhandle, void *buffer, size_t len) {
+    return transfer(TFS_OP_CODE_READ, fhandle, buffer, NULL, len);
+}
+
+int tfs_remote_shutdown() {
+    if (!mounted) {
+        return -1;
+    }
+
+    tfs_request_t request = {.op_code = TFS_OP_CODE_SHUTDOWN};
+    int server_fd = open(server_path, O_WRONLY);
+    if (server_fd == -1) {
+        return -1;
+    }
+    int res = pipe_write_all(server_fd, &request, sizeof(request));
+    close(server_fd);
+    return res;
+}
@@ -0,0 +1,82 @@
+#ifndef CLIENT_TFS_CLIENT_H
+#define CLIENT_TFS_CLIENT_H
+
+#include "fs/operations.h"
+
+#include <sys/types.h>
+
+/*
+ * Client of a TécnicoFS server (see server/tfs_server.c). Each process has at
+ * most one session, through either pipes or shared memory; the tfs_remote_*
+ * functions behave like their operations.h counterparts, on the server's file
+ * system.
+ */
+
+/**
+ * Start a session with a TécnicoFS server.
+ *
+ * Input:
+ *   - client_pipe_path: path of the session pipes to create, with ".req" and
+ *     ".rep" appended (shorter than TFS_PATH_SIZE)
+ *   - server_pipe_path: path of the server's pipe
+ *
+ * Waits until the server has a worker for the session, or exits.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_mount(char const *client_pipe_path, char const *server_pipe_path);
+
+/**
+ * Start a session with a TécnicoFS server through shared memory, which
+ * avoids copying requests and replies through the kernel (the server must
+ * run on the same machine).
+ *
+ * Input:
+ *   - client_path: path of the file to create and map, with ".shm" appended
+ *     (shorter than TFS_PATH_SIZE); a tmpfs (e.g. /dev/shm) avoids any disk
+ *     writes
+ *   - server_pipe_path: path of the server's pipe
+ *
+ * Waits until the server has a worker for the session.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_mount_shm(char const *client_path, char const *server_pipe_path);
+
+/**
+ * End the session, removing its pipes (or shared memory).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_unmount();
+
+int tfs_remote_open(char const *name, tfs_file_mode_t mode);
+int tfs_remote_sym_link(char const *target, char const *link_name);
+int tfs_remote_link(char const *target, char const *link_name);
+int tfs_remote_close(int fhandle);
+int tfs_remote_flush(int fhandle);
+int tfs_remote_unlink(char const *target);
+
+/**
+ * Write to a file on the server. Writes larger than TFS_IO_SIZE are split in
+ * several requests, sent without waiting for each other's replies.
+ *
+ * Returns the number of bytes written, or -1 if the first request failed.
+ */
+ssize_t tfs_remote_write(int fhandle, void const *buffer, size_t len);
+
+/**
+ * Read from a file on the server, splitting large reads like tfs_remote_write.
+ *
+ * Returns the number of bytes read, or -1 if the first request failed.
+ */
+ssize_t tfs_remote_read(int fhandle, void *buffer, size_t len);
+
+/**
+ * Ask the server to shut down once all sessions, this one included, end.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_remote_shutdown();
+
+#endif // CLIENT_TFS_CLIENT_H
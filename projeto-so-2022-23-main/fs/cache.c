@@ -0,0 +1,674 @@
+#include "cache.h"
+#include "betterassert.h"
+#include "config.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Block cache between the data block API and a backing store (an image file or
+ * the compressed block pool).
+ *
+ * Only a fixed number of blocks (frames) is kept in memory. Frames are
+ * replaced with ARC (Adaptive Replacement Cache, Megiddo & Modha): blocks used
+ * once live in T1, blocks used again in T2, and the ghost lists B1/B2 remember
+ * recently evicted blocks so that the target size of T1 adapts to the
+ * workload. A scan only churns T1, so it cannot flush the reused blocks in T2.
+ *
+ * The blocks are split into stripes (by block number), each an ARC of its own
+ * with its own frames and lock, so that threads using different blocks rarely
+ * take the same lock (directory lookups and file reads would otherwise all
+ * serialize on the cache).
+ *
+ * Blocks are pinned between cache_block_get() and cache_block_put() and are
+ * never evicted while pinned. With write-back stores, dirty blocks are written
+ * when evicted, and periodically by a background write-back thread; with
+ * write-through stores, they are written as soon as they are unpinned. A block
+ * that fails to be written stays dirty (and in memory), to be retried.
+ */
+
+// Write-back thread period
+#define WRITEBACK_INTERVAL_MS (100)
+
+typedef enum { L_NONE = 0, L_T1, L_T2, L_B1, L_B2, L_COUNT } cache_list_id;
+
+/**
+ * Doubly linked list of block numbers, most recently used first.
+ */
+typedef struct {
+    int head;
+    int tail;
+    size_t size;
+} cache_list_t;
+
+/**
+ * Cache state of a block (one per block of the backing store).
+ */
+typedef struct {
+    cache_list_id list;
+    int prev;
+    int next;
+    int frame; // -1 if the block is not in memory
+} cache_block_t;
+
+/**
+ * In-memory frame holding a block.
+ */
+typedef struct {
+    int block_number; // -1 if the frame is free
+    int pins;
+    bool dirty;
+} cache_frame_t;
+
+typedef struct cache_stripe cache_stripe_t;
+
+struct cache {
+    cache_backend_t const *backend;
+    void *store;
+    size_t block_size;
+
+    // Each block belongs to stripe block_number % nstripes
+    cache_stripe_t *stripes;
+    size_t nstripes;
+
+    // Only accessed under the lock of the block's stripe
+    cache_block_t *blocks;
+
+    pthread_mutex_t writeback_lock;
+    pthread_cond_t writeback_wakeup;
+    pthread_t writeback_thread;
+    bool writeback_stop;
+};
+
+/**
+ * An independent ARC over the blocks of one stripe, with frames and a lock of
+ * its own, so that accesses to blocks of different stripes never contend.
+ */
+struct cache_stripe {
+    alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+    cache_t *cache;
+    size_t nframes;
+
+    char *frame_data; // # frames * block size
+    cache_frame_t *frames;
+    int *free_frames;
+    size_t free_frame_count;
+
+    cache_list_t lists[L_COUNT];
+    size_t t1_target; // ARC's p
+
+    tfs_cache_stats_t stats;
+
+    pthread_cond_t frame_unpinned;
+};
+
+static void mutex_lock_or_exit(pthread_mutex_t *lock) {
+    if (pthread_mutex_lock(lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void mutex_unlock_or_exit(pthread_mutex_t *lock) {
+    if (pthread_mutex_unlock(lock) != 0) {
+        perror("pthread_mutex_unlock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static cache_stripe_t *stripe_of(cache_t *cache, int block_number) {
+    return &cache->stripes[(size_t)block_number % cache->nstripes];
+}
+
+static inline void *frame_ptr(cache_stripe_t *stripe, int frame) {
+    return &stripe->frame_data[(size_t)frame * stripe->cache->block_size];
+}
+
+static void list_remove(cache_stripe_t *stripe, int block_number) {
+    cache_block_t *blocks = stripe->cache->blocks;
+    cache_block_t *block = &blocks[block_number];
+    cache_list_t *list = &stripe->lists[block->list];
+
+    if (block->prev != -1) {
+        blocks[block->prev].next = block->next;
+    } else {
+        list->head = block->next;
+    }
+    if (block->next != -1) {
+        blocks[block->next].prev = block->prev;
+    } else {
+        list->tail = block->prev;
+    }
+
+    list->size--;
+    block->list = L_NONE;
+    block->prev = -1;
+    block->next = -1;
+}
+
+static void list_push_mru(cache_stripe_t *stripe, cache_list_id id,
+                          int block_number) {
+    cache_block_t *blocks = stripe->cache->blocks;
+    cache_block_t *block = &blocks[block_number];
+    cache_list_t *list = &stripe->lists[id];
+
+    block->list = id;
+    block->prev = -1;
+    block->next = list->head;
+    if (list->head != -1) {
+        blocks[list->head].prev = block_number;
+    } else {
+        list->tail = block_number;
+    }
+    list->head = block_number;
+    list->size++;
+}
+
+/**
+ * Write a frame's block to the backing store, keeping it dirty on failure.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int frame_write_back(cache_stripe_t *stripe, int frame) {
+    cache_t *cache = stripe->cache;
+    if (cache->backend->write(cache->store, stripe->frames[frame].block_number,
+                              frame_ptr(stripe, frame)) != 0) {
+        return -1;
+    }
+
+    stripe->frames[frame].dirty = false;
+    stripe->stats.writebacks++;
+    return 0;
+}
+
+static int frame_read(cache_stripe_t *stripe, int frame) {
+    cache_t *cache = stripe->cache;
+    return cache->backend->read(cache->store,
+                                stripe->frames[frame].block_number,
+                                frame_ptr(stripe, frame));
+}
+
+/**
+ * Find the least recently used block of a resident list that is not pinned.
+ *
+ * Returns its block number, or -1 if every block in the list is pinned.
+ */
+static int list_lru_unpinned(cache_stripe_t *stripe, cache_list_id id) {
+    cache_block_t *blocks = stripe->cache->blocks;
+    for (int b = stripe->lists[id].tail; b != -1; b = blocks[b].prev) {
+        if (stripe->frames[blocks[b].frame].pins == 0) {
+            return b;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Evict a resident block, moving it to the matching ghost list.
+ *
+ * Returns the frame it occupied, which is now free, or -1 if the block was
+ * dirty and could not be written back (it then stays resident).
+ */
+static int evict(cache_stripe_t *stripe, int block_number) {
+    cache_block_t *block = &stripe->cache->blocks[block_number];
+    int frame = block->frame;
+
+    if (stripe->frames[frame].dirty && frame_write_back(stripe, frame) != 0) {
+        return -1;
+    }
+
+    cache_list_id ghost = block->list == L_T1 ? L_B1 : L_B2;
+    list_remove(stripe, block_number);
+    list_push_mru(stripe, ghost, block_number);
+
+    block->frame = -1;
+    stripe->frames[frame].block_number = -1;
+    stripe->stats.evictions++;
+
+    return frame;
+}
+
+/**
+ * Obtain a free frame, evicting a block if needed (ARC's REPLACE).
+ *
+ * Waits (releasing the stripe lock) while every frame is pinned.
+ *
+ * Input:
+ *   - in_b2: whether the block being loaded was found in ghost list B2
+ *
+ * Returns the frame number, or -1 if the block to evict could not be written
+ * back.
+ */
+static int take_frame(cache_stripe_t *stripe, bool in_b2) {
+    for (;;) {
+        if (stripe->free_frame_count > 0) {
+            return stripe->free_frames[--stripe->free_frame_count];
+        }
+
+        size_t t1_size = stripe->lists[L_T1].size;
+        bool from_t1 = t1_size > 0 && (t1_size > stripe->t1_target ||
+                                       (in_b2 && t1_size == stripe->t1_target));
+
+        int victim = list_lru_unpinned(stripe, from_t1 ? L_T1 : L_T2);
+        if (victim == -1) {
+            victim = list_lru_unpinned(stripe, from_t1 ? L_T2 : L_T1);
+        }
+        if (victim != -1) {
+            return evict(stripe, victim);
+        }
+
+        if (pthread_cond_wait(&stripe->frame_unpinned, &stripe->lock) != 0) {
+            perror("pthread_cond_wait");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Keep the ghost lists bounded before a block that is in no list is loaded.
+ */
+static void trim_ghosts(cache_stripe_t *stripe) {
+    size_t t1_b1 = stripe->lists[L_T1].size + stripe->lists[L_B1].size;
+    size_t total = t1_b1 + stripe->lists[L_T2].size + stripe->lists[L_B2].size;
+
+    if (t1_b1 >= stripe->nframes && stripe->lists[L_B1].size > 0) {
+        list_remove(stripe, stripe->lists[L_B1].tail);
+    } else if (total >= 2 * stripe->nframes && stripe->lists[L_B2].size > 0) {
+        list_remove(stripe, stripe->lists[L_B2].tail);
+    }
+}
+
+/**
+ * Write the dirty blocks of a stripe that are not pinned (those that fail are
+ * retried on the next period).
+ */
+static void stripe_write_back(cache_stripe_t *stripe) {
+    mutex_lock_or_exit(&stripe->lock);
+    for (size_t i = 0; i < stripe->nframes; i++) {
+        if (stripe->frames[i].block_number != -1 && stripe->frames[i].dirty &&
+            stripe->frames[i].pins == 0) {
+            frame_write_back(stripe, (int)i);
+        }
+    }
+    mutex_unlock_or_exit(&stripe->lock);
+}
+
+static void *writeback_loop(void *arg) {
+    cache_t *cache = arg;
+
+    mutex_lock_or_exit(&cache->writeback_lock);
+    while (!cache->writeback_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WRITEBACK_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        // Wakes up either on the timeout or when asked to stop
+        pthread_cond_timedwait(&cache->writeback_wakeup,
+                               &cache->writeback_lock, &deadline);
+
+        // The stripes are visited one at a time, never holding two locks
+        mutex_unlock_or_exit(&cache->writeback_lock);
+        for (size_t i = 0; i < cache->nstripes; i++) {
+            stripe_write_back(&cache->stripes[i]);
+        }
+        mutex_lock_or_exit(&cache->writeback_lock);
+    }
+    mutex_unlock_or_exit(&cache->writeback_lock);
+
+    return NULL;
+}
+
+static void cache_free(cache_t *cache) {
+    if (cache->stripes != NULL) {
+        for (size_t i = 0; i < cache->nstripes; i++) {
+            free(cache->stripes[i].frame_data);
+            free(cache->stripes[i].frames);
+            free(cache->stripes[i].free_frames);
+        }
+    }
+    free(cache->stripes);
+    free(cache->blocks);
+    free(cache);
+}
+
+/**
+ * Initialize a stripe with a given number of frames.
+ *
+ * Returns 0 if successful, -1 if allocation failed.
+ */
+static int stripe_init(cache_t *cache, cache_stripe_t *stripe,
+                       size_t frame_count) {
+    stripe->cache = cache;
+    stripe->nframes = frame_count;
+
+    stripe->frame_data = malloc(frame_count * cache->block_size);
+    stripe->frames = malloc(frame_count * sizeof(cache_frame_t));
+    stripe->free_frames = malloc(frame_count * sizeof(int));
+    if (!stripe->frame_data || !stripe->frames || !stripe->free_frames) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < frame_count; i++) {
+        stripe->frames[i].block_number = -1;
+        stripe->frames[i].pins = 0;
+        stripe->frames[i].dirty = false;
+        stripe->free_frames[i] = (int)(frame_count - 1 - i);
+    }
+    stripe->free_frame_count = frame_count;
+
+    for (size_t i = 0; i < L_COUNT; i++) {
+        stripe->lists[i].head = -1;
+        stripe->lists[i].tail = -1;
+        stripe->lists[i].size = 0;
+    }
+    stripe->t1_target = 0;
+    memset(&stripe->stats, 0, sizeof(stripe->stats));
+
+    if (pthread_mutex_init(&stripe->lock, NULL) != 0) {
+        perror("pthread_mutex_init");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_cond_init(&stripe->frame_unpinned, NULL) != 0) {
+        perror("pthread_cond_init");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+/**
+ * Initialize the block cache.
+ *
+ * The frames are split into up to CACHE_STRIPES stripes of at least
+ * CACHE_STRIPE_MIN_FRAMES frames each (a smaller cache is a single ARC).
+ *
+ * Input:
+ *   - backend: operations of the backing store holding the blocks
+ *   - store: the backing store (already initialized), passed to 'backend'
+ *   - block_count: number of blocks in the store
+ *   - block_size: size of each block
+ *   - frame_count: number of blocks kept in memory
+ *
+ * Returns the cache if successful, NULL otherwise.
+ */
+cache_t *cache_init(cache_backend_t const *backend, void *store,
+                    size_t block_count, size_t block_size,
+                    size_t frame_count) {
+    if (frame_count == 0) {
+        return NULL;
+    }
+    if (frame_count > block_count) {
+        frame_count = block_count;
+    }
+
+    cache_t *cache = calloc(1, sizeof(cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->backend = backend;
+    cache->store = store;
+    cache->block_size = block_size;
+
+    cache->nstripes = frame_count / CACHE_STRIPE_MIN_FRAMES;
+    if (cache->nstripes > CACHE_STRIPES) {
+        cache->nstripes = CACHE_STRIPES;
+    } else if (cache->nstripes == 0) {
+        cache->nstripes = 1;
+    }
+
+    size_t stripes_size = cache->nstripes * sizeof(cache_stripe_t);
+    cache->stripes = aligned_alloc(CACHE_LINE_SIZE, stripes_size);
+    cache->blocks = malloc(block_count * sizeof(cache_block_t));
+    if (!cache->stripes || !cache->blocks) {
+        cache_free(cache);
+        return NULL; // allocation failed
+    }
+    memset(cache->stripes, 0, stripes_size);
+
+    for (size_t i = 0; i < cache->nstripes; i++) {
+        // The first stripes get the frames that don't divide evenly
+        size_t frames = frame_count / cache->nstripes +
+                        (i < frame_count % cache->nstripes ? 1 : 0);
+        if (stripe_init(cache, &cache->stripes[i], frames) == -1) {
+            cache_free(cache);
+            return NULL; // allocation failed
+        }
+    }
+
+    for (size_t i = 0; i < block_count; i++) {
+        cache->blocks[i].list = L_NONE;
+        cache->blocks[i].prev = -1;
+        cache->blocks[i].next = -1;
+        cache->blocks[i].frame = -1;
+    }
+
+    if (pthread_mutex_init(&cache->writeback_lock, NULL) != 0) {
+        perror("pthread_mutex_init");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_cond_init(&cache->writeback_wakeup, NULL) != 0) {
+        perror("pthread_cond_init");
+        exit(EXIT_FAILURE);
+    }
+
+    cache->writeback_stop = false;
+    if (!cache->backend->write_through &&
+        pthread_create(&cache->writeback_thread, NULL, writeback_loop,
+                       cache) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+
+    return cache;
+}
+
+/**
+ * Destroy the block cache, writing every dirty block to the backing store.
+ * The store itself is left open.
+ *
+ * Returns 0 if successful, -1 if some block could not be written (the cache
+ * is destroyed all the same).
+ */
+int cache_destroy(cache_t *cache) {
+    int res = 0;
+
+    if (!cache->backend->write_through) {
+        mutex_lock_or_exit(&cache->writeback_lock);
+        cache->writeback_stop = true;
+        pthread_cond_signal(&cache->writeback_wakeup);
+        mutex_unlock_or_exit(&cache->writeback_lock);
+
+        if (pthread_join(cache->writeback_thread, NULL) != 0) {
+            perror("pthread_join");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (size_t i = 0; i < cache->nstripes; i++) {
+        cache_stripe_t *stripe = &cache->stripes[i];
+        for (size_t f = 0; f < stripe->nframes; f++) {
+            if (stripe->frames[f].block_number != -1 &&
+                stripe->frames[f].dirty &&
+                frame_write_back(stripe, (int)f) != 0) {
+                res = -1;
+            }
+        }
+        pthread_cond_destroy(&stripe->frame_unpinned);
+        pthread_mutex_destroy(&stripe->lock);
+    }
+
+    pthread_cond_destroy(&cache->writeback_wakeup);
+    pthread_mutex_destroy(&cache->writeback_lock);
+
+    cache_free(cache);
+
+    return res;
+}
+
+/**
+ * Obtain a pointer to a block's contents, loading it from the backing store if
+ * needed.
+ * The block stays pinned in memory until the matching cache_block_put().
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns a pointer to the first byte of the block, or NULL if it could not be
+ * read, or room made for it (a dirty block failed to be written back).
+ */
+void *cache_block_get(cache_t *cache, int block_number) {
+    cache_stripe_t *stripe = stripe_of(cache, block_number);
+    mutex_lock_or_exit(&stripe->lock);
+
+    cache_block_t *block = &cache->blocks[block_number];
+
+    if (block->list == L_T1 || block->list == L_T2) {
+        // Referenced again: moves to the most recently used end of T2
+        stripe->stats.hits++;
+        list_remove(stripe, block_number);
+        list_push_mru(stripe, L_T2, block_number);
+    } else {
+        stripe->stats.misses++;
+
+        // A ghost hit means the list it was evicted from was too small
+        if (block->list == L_B1) {
+            size_t delta = stripe->lists[L_B2].size / stripe->lists[L_B1].size;
+            stripe->t1_target += delta > 1 ? delta : 1;
+            if (stripe->t1_target > stripe->nframes) {
+                stripe->t1_target = stripe->nframes;
+            }
+        } else if (block->list == L_B2) {
+            size_t delta = stripe->lists[L_B1].size / stripe->lists[L_B2].size;
+            delta = delta > 1 ? delta : 1;
+            stripe->t1_target =
+                stripe->t1_target > delta ? stripe->t1_target - delta : 0;
+        } else {
+            trim_ghosts(stripe);
+        }
+
+        int frame = take_frame(stripe, block->list == L_B2);
+        if (frame == -1) {
+            mutex_unlock_or_exit(&stripe->lock);
+            return NULL;
+        }
+
+        if (block->list == L_T1 || block->list == L_T2) {
+            // Loaded by another thread while we waited for a frame
+            stripe->free_frames[stripe->free_frame_count++] = frame;
+            list_remove(stripe, block_number);
+            list_push_mru(stripe, L_T2, block_number);
+        } else {
+            stripe->frames[frame].block_number = block_number;
+            stripe->frames[frame].dirty = false;
+            if (frame_read(stripe, frame) != 0) {
+                // Nothing was loaded: the frame is free again
+                stripe->frames[frame].block_number = -1;
+                stripe->free_frames[stripe->free_frame_count++] = frame;
+                pthread_cond_broadcast(&stripe->frame_unpinned);
+                mutex_unlock_or_exit(&stripe->lock);
+                return NULL;
+            }
+
+            // Blocks seen before (ghosts) go to T2, new blocks to T1
+            cache_list_id dest = block->list == L_NONE ? L_T1 : L_T2;
+            if (block->list != L_NONE) {
+                list_remove(stripe, block_number);
+            }
+            block->frame = frame;
+            list_push_mru(stripe, dest, block_number);
+        }
+    }
+
+    stripe->frames[block->frame].pins++;
+    void *ptr = frame_ptr(stripe, block->frame);
+
+    mutex_unlock_or_exit(&stripe->lock);
+    return ptr;
+}
+
+/**
+ * Unpin a block obtained with cache_block_get().
+ *
+ * With a write-through backing store, a modified block is written immediately;
+ * if that fails, the block is reloaded, undoing the caller's changes (and if
+ * that fails too, it is kept dirty, to be written back when evicted).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *   - dirty: whether the block was modified
+ *
+ * Returns 0 if successful, -1 if the block could not be written.
+ */
+int cache_block_put(cache_t *cache, int block_number, bool dirty) {
+    int res = 0;
+
+    cache_stripe_t *stripe = stripe_of(cache, block_number);
+    mutex_lock_or_exit(&stripe->lock);
+
+    int frame = cache->blocks[block_number].frame;
+    ALWAYS_ASSERT(frame != -1 && stripe->frames[frame].pins > 0,
+                  "cache_block_put: block is not pinned");
+
+    if (dirty && cache->backend->write_through) {
+        if (cache->backend->write(cache->store, block_number,
+                                  frame_ptr(stripe, frame)) == 0) {
+            stripe->stats.writebacks++;
+        } else {
+            if (frame_read(stripe, frame) != 0) {
+                stripe->frames[frame].dirty = true;
+            }
+            res = -1;
+        }
+    } else if (dirty) {
+        stripe->frames[frame].dirty = true;
+    }
+
+    if (--stripe->frames[frame].pins == 0) {
+        pthread_cond_broadcast(&stripe->frame_unpinned);
+    }
+
+    mutex_unlock_or_exit(&stripe->lock);
+    return res;
+}
+
+/**
+ * Forget the contents of a freed block, so that they are not written back.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void cache_block_discard(cache_t *cache, int block_number) {
+    cache_stripe_t *stripe = stripe_of(cache, block_number);
+    mutex_lock_or_exit(&stripe->lock);
+
+    int frame = cache->blocks[block_number].frame;
+    if (frame != -1) {
+        stripe->frames[frame].dirty = false;
+    }
+    if (cache->backend->discard != NULL) {
+        cache->backend->discard(cache->store, block_number);
+    }
+
+    mutex_unlock_or_exit(&stripe->lock);
+}
+
+/**
+ * Obtain the counters of every stripe, added up.
+ */
+void cache_get_stats(cache_t *cache, tfs_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < cache->nstripes; i++) {
+        cache_stripe_t *stripe = &cache->stripes[i];
+        mutex_lock_or_exit(&stripe->lock);
+        stats->hits += stripe->stats.hits;
+        stats->misses += stripe->stats.misses;
+        stats->evictions += stripe->stats.evictions;
+        stats->writebacks += stripe->stats.writebacks;
+        mutex_unlock_or_exit(&stripe->lock);
+    }
+}
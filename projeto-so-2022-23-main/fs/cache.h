@@ -0,0 +1,37 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Backing store of the block cache (every operation gets the store's state).
+ */
+typedef struct {
+    // Load a block into buffer (block size bytes); returns 0 if successful,
+    // -1 otherwise
+    int (*read)(void *store, int block_number, void *buffer);
+    // Store a block from buffer; returns 0 if successful, -1 otherwise
+    int (*write)(void *store, int block_number, void const *buffer);
+    // Forget the contents of a freed block (may be NULL)
+    void (*discard)(void *store, int block_number);
+    // Write modified blocks when unpinned rather than when evicted
+    bool write_through;
+} cache_backend_t;
+
+typedef struct cache cache_t;
+
+cache_t *cache_init(cache_backend_t const *backend, void *store,
+                    size_t block_count, size_t block_size,
+                    size_t frame_count);
+int cache_destroy(cache_t *cache);
+
+void *cache_block_get(cache_t *cache, int block_number);
+int cache_block_put(cache_t *cache, int block_number, bool dirty);
+void cache_block_discard(cache_t *cache, int block_number);
+
+void cache_get_stats(cache_t *cache, tfs_cache_stats_t *stats);
+
+#endif // CACHE_H
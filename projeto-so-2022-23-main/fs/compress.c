@@ -0,0 +1,432 @@
+#include "compress.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compressed block pool, used as a write-through backing store for the block
+ * cache: hot blocks stay uncompressed in the cache, every other block only
+ * exists here, compressed.
+ *
+ * The pool is split into small chunks; a block's compressed bytes are kept in
+ * a chain of chunks, so blocks of any compressed size can be stored without
+ * fragmenting the pool. Blocks that don't compress are stored as is.
+ *
+ * Compression uses an LZ77 scheme in the style of the LZ4 block format
+ * (sequences of a token, literals, a 16-bit match offset and match length),
+ * which trades ratio for speed.
+ */
+
+#define CHUNK_SIZE (64)
+
+#define LZ_HASH_BITS (12)
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (65535)
+
+struct compress_store {
+    size_t block_size;
+
+    char *chunk_data; // # chunks * CHUNK_SIZE
+    int *chunk_next;
+    int free_chunk_head;
+    size_t free_chunk_count;
+    size_t chunk_count;
+
+    int *block_first_chunk;  // -1 if the block holds no data
+    size_t *block_stored_len; // == block size if stored uncompressed
+
+    uint8_t *scratch; // compressed bytes of the block being read/written
+    pthread_mutex_t lock;
+};
+static inline uint32_t read32(uint8_t const *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline size_t lz_hash(uint32_t v) {
+    return (size_t)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+/**
+ * Append the extra bytes of a length that didn't fit in a token nibble.
+ *
+ * Returns the new output position, or NULL if the output is full.
+ */
+static uint8_t *lz_put_length(uint8_t *op, uint8_t const *oend, size_t len) {
+    while (len >= 255) {
+        if (op >= oend) {
+            return NULL;
+        }
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend) {
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/**
+ * Append a sequence: literals followed (unless it is the last one) by a match.
+ *
+ * Returns the new output position, or NULL if the output is full.
+ */
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t const *oend,
+                                uint8_t const *literals, size_t lit_len,
+                                size_t offset, size_t match_len) {
+    if (op >= oend) {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+
+    if (lit_len >= 15 && (op = lz_put_length(op, oend, lit_len - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(oend - op) < lit_len) {
+        return NULL;
+    }
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (offset == 0) {
+        return op; // last sequence
+    }
+
+    if (oend - op < 2) {
+        return NULL;
+    }
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    size_t len = match_len - LZ_MIN_MATCH;
+    *token |= (uint8_t)(len < 15 ? len : 15);
+    if (len >= 15 && (op = lz_put_length(op, oend, len - 15)) == NULL) {
+        return NULL;
+    }
+    return op;
+}
+
+/**
+ * Compress a buffer.
+ *
+ * Returns the compressed length, or 0 if it doesn't fit in 'cap' bytes.
+ */
+static size_t lz_compress(uint8_t const *src, size_t len, uint8_t *dst,
+                          size_t cap) {
+    uint32_t table[1 << LZ_HASH_BITS]; // position + 1 of the last occurrence
+    memset(table, 0, sizeof(table));
+
+    uint8_t *op = dst;
+    uint8_t const *oend = dst + cap;
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t seq = read32(src + ip);
+        size_t h = lz_hash(seq);
+        size_t candidate = table[h];
+        table[h] = (uint32_t)(ip + 1);
+
+        if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET ||
+            read32(src + candidate - 1) != seq) {
+            ip++;
+            continue;
+        }
+        candidate--;
+
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len &&
+               src[candidate + match_len] == src[ip + match_len]) {
+            match_len++;
+        }
+
+        op = lz_put_sequence(op, oend, src + anchor, ip - anchor,
+                             ip - candidate, match_len);
+        if (op == NULL) {
+            return 0;
+        }
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = lz_put_sequence(op, oend, src + anchor, len - anchor, 0, 0);
+    if (op == NULL) {
+        return 0;
+    }
+    return (size_t)(op - dst);
+}
+
+/**
+ * Read the extra bytes of a length whose token nibble was 15.
+ *
+ * Returns 0 if successful, -1 if the input ends first.
+ */
+static int lz_get_length(uint8_t const *src, size_t len, size_t *ip,
+                         size_t *value) {
+    uint8_t b;
+    do {
+        if (*ip >= len) {
+            return -1;
+        }
+        b = src[(*ip)++];
+        *value += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * Decompress a buffer produced by lz_compress().
+ *
+ * Returns 0 if exactly 'out_len' bytes were produced, -1 otherwise.
+ */
+static int lz_decompress(uint8_t const *src, size_t len, uint8_t *dst,
+                         size_t out_len) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < len) {
+        uint8_t token = src[ip++];
+
+        size_t lit_len = (size_t)(token >> 4);
+        if (lit_len == 15 && lz_get_length(src, len, &ip, &lit_len) == -1) {
+            return -1;
+        }
+        if (lit_len > len - ip || lit_len > out_len - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == len) {
+            break; // last sequence
+        }
+
+        if (len - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+
+        size_t match_len = (size_t)(token & 15);
+        if (match_len == 15 &&
+            lz_get_length(src, len, &ip, &match_len) == -1) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (match_len > out_len - op) {
+            return -1;
+        }
+
+        // byte by byte, as the match may overlap the bytes it produces
+        for (size_t i = 0; i < match_len; i++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+
+    return op == out_len ? 0 : -1;
+}
+
+static inline size_t chunks_for(size_t len) {
+    return (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+static void free_block_chunks(compress_store_t *pool, int block_number) {
+    int chunk = pool->block_first_chunk[block_number];
+    while (chunk != -1) {
+        int next = pool->chunk_next[chunk];
+        pool->chunk_next[chunk] = pool->free_chunk_head;
+        pool->free_chunk_head = chunk;
+        pool->free_chunk_count++;
+        chunk = next;
+    }
+
+    pool->block_first_chunk[block_number] = -1;
+    pool->block_stored_len[block_number] = 0;
+}
+
+static int compress_read(void *store, int block_number, void *buffer) {
+    compress_store_t *pool = store;
+    if (pthread_mutex_lock(&pool->lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t stored_len = pool->block_stored_len[block_number];
+    bool raw = stored_len == pool->block_size;
+
+    // Gathers the chain of chunks (directly into the buffer if uncompressed)
+    uint8_t *dst = raw ? buffer : pool->scratch;
+    size_t copied = 0;
+    for (int chunk = pool->block_first_chunk[block_number]; chunk != -1;
+         chunk = pool->chunk_next[chunk]) {
+        size_t n = stored_len - copied < CHUNK_SIZE ? stored_len - copied
+                                                    : CHUNK_SIZE;
+        memcpy(dst + copied, &pool->chunk_data[(size_t)chunk * CHUNK_SIZE], n);
+        copied += n;
+    }
+
+    int res = 0;
+    if (stored_len == 0) {
+        memset(buffer, 0, pool->block_size); // never written
+    } else if (!raw && lz_decompress(pool->scratch, stored_len, buffer,
+                                     pool->block_size) != 0) {
+        res = -1; // corrupted compressed block
+    }
+
+    if (pthread_mutex_unlock(&pool->lock) != 0) {
+        perror("pthread_mutex_unlock");
+        exit(EXIT_FAILURE);
+    }
+    return res;
+}
+
+static int compress_write(void *store, int block_number, void const *buffer) {
+    compress_store_t *pool = store;
+    if (pthread_mutex_lock(&pool->lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+
+    // Anything that doesn't compress to less than a block is stored as is
+    uint8_t const *src = pool->scratch;
+    size_t stored_len = lz_compress(buffer, pool->block_size, pool->scratch,
+                                    pool->block_size - 1);
+    if (stored_len == 0) {
+        src = buffer;
+        stored_len = pool->block_size;
+    }
+
+    size_t needed = chunks_for(stored_len);
+    size_t owned = chunks_for(pool->block_stored_len[block_number]);
+    if (needed > pool->free_chunk_count + owned) {
+        if (pthread_mutex_unlock(&pool->lock) != 0) {
+            perror("pthread_mutex_unlock");
+            exit(EXIT_FAILURE);
+        }
+        return -1; // pool is full, the old contents are kept
+    }
+
+    free_block_chunks(pool, block_number);
+
+    int *link = &pool->block_first_chunk[block_number];
+    for (size_t copied = 0; copied < stored_len; copied += CHUNK_SIZE) {
+        int chunk = pool->free_chunk_head;
+        pool->free_chunk_head = pool->chunk_next[chunk];
+        pool->free_chunk_count--;
+
+        size_t n = stored_len - copied < CHUNK_SIZE ? stored_len - copied
+                                                    : CHUNK_SIZE;
+        memcpy(&pool->chunk_data[(size_t)chunk * CHUNK_SIZE], src + copied, n);
+
+        *link = chunk;
+        link = &pool->chunk_next[chunk];
+    }
+    *link = -1;
+    pool->block_stored_len[block_number] = stored_len;
+
+    if (pthread_mutex_unlock(&pool->lock) != 0) {
+        perror("pthread_mutex_unlock");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+static void compress_discard(void *store, int block_number) {
+    compress_store_t *pool = store;
+    if (pthread_mutex_lock(&pool->lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+
+    free_block_chunks(pool, block_number);
+
+    if (pthread_mutex_unlock(&pool->lock) != 0) {
+        perror("pthread_mutex_unlock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+cache_backend_t const compress_backend = {
+    .read = compress_read,
+    .write = compress_write,
+    .discard = compress_discard,
+    .write_through = true,
+};
+
+static void compress_store_free(compress_store_t *pool) {
+    free(pool->chunk_data);
+    free(pool->chunk_next);
+    free(pool->block_first_chunk);
+    free(pool->block_stored_len);
+    free(pool->scratch);
+    free(pool);
+}
+
+/**
+ * Initialize the compressed block pool.
+ *
+ * Input:
+ *   - block_count: number of (uncompressed) blocks that can be stored
+ *   - block_size: size of each block
+ *   - pool_size: memory available for compressed data, in bytes
+ *
+ * Returns the pool if successful, NULL otherwise.
+ */
+compress_store_t *compress_store_init(size_t block_count, size_t block_size,
+                                      size_t pool_size) {
+    compress_store_t *pool = calloc(1, sizeof(compress_store_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->block_size = block_size;
+    pool->chunk_count = pool_size / CHUNK_SIZE;
+
+    pool->chunk_data = malloc(pool->chunk_count * CHUNK_SIZE);
+    pool->chunk_next = malloc(pool->chunk_count * sizeof(int));
+    pool->block_first_chunk = malloc(block_count * sizeof(int));
+    pool->block_stored_len = malloc(block_count * sizeof(size_t));
+    pool->scratch = malloc(block_size);
+
+    if (!pool->chunk_data || !pool->chunk_next || !pool->block_first_chunk ||
+        !pool->block_stored_len || !pool->scratch) {
+        compress_store_free(pool);
+        return NULL; // allocation failed
+    }
+
+    for (size_t i = 0; i < pool->chunk_count; i++) {
+        pool->chunk_next[i] = i + 1 < pool->chunk_count ? (int)(i + 1) : -1;
+    }
+    pool->free_chunk_head = pool->chunk_count > 0 ? 0 : -1;
+    pool->free_chunk_count = pool->chunk_count;
+
+    for (size_t i = 0; i < block_count; i++) {
+        pool->block_first_chunk[i] = -1;
+        pool->block_stored_len[i] = 0;
+    }
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        perror("pthread_mutex_init");
+        exit(EXIT_FAILURE);
+    }
+
+    return pool;
+}
+
+/**
+ * Destroy the compressed block pool.
+ */
+void compress_store_destroy(compress_store_t *pool) {
+    pthread_mutex_destroy(&pool->lock);
+    compress_store_free(pool);
+}
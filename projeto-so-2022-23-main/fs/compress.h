@@ -0,0 +1,16 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "cache.h"
+
+#include <stddef.h>
+
+typedef struct compress_store compress_store_t;
+
+compress_store_t *compress_store_init(size_t block_count, size_t block_size,
+                                      size_t pool_size);
+void compress_store_destroy(compress_store_t *pool);
+
+extern cache_backend_t const compress_backend;
+
+#endif // COMPRESS_H
@@ -8,4 +8,25 @@
 
 #define DELAY (5000)
 
+// Size of a cache line, to keep data written by different threads apart
+#define CACHE_LINE_SIZE (64)
+
+// Files up to this size keep their contents in the inode instead of a block
+// (sized to fill the padding of the inode's two cache lines, see inode_t)
+#define INODE_INLINE_SIZE (104)
+
+// Symbolic links followed when opening a file before giving up (loops)
+#define MAX_SYMLINK_HOPS (40)
+
+// Number of locks sharing the block deduplication index
+#define DEDUP_LOCK_STRIPES (64)
+
+// Blocks kept in memory by the block cache when block_cache_count is 0
+#define DEFAULT_BLOCK_CACHE_COUNT (64)
+
+// Independent parts of the block cache (each with its own lock), and the
+// fewest frames each of them gets
+#define CACHE_STRIPES (16)
+#define CACHE_STRIPE_MIN_FRAMES (8)
+
 #endif // CONFIG_H
@@ -0,0 +1,219 @@
+#include "events.h"
+
+#include <stddef.h>
+
+static char const *const type_names[EVENT_TYPE_COUNT] = {
+    [EVENT_LOOKUP] = "lookup",         [EVENT_INODE_ALLOC] = "inode_alloc",
+    [EVENT_BLOCK_ALLOC] = "block_alloc", [EVENT_DELAY] = "insert_delay",
+    [EVENT_LOCK_WAIT] = "lock_wait",   [EVENT_MEMCPY] = "memcpy",
+};
+
+char const *event_type_name(event_type_t type) {
+    if ((unsigned)type >= EVENT_TYPE_COUNT) {
+        return NULL;
+    }
+    return type_names[type];
+}
+
+#ifdef TFS_EVENTS
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef struct events_ring {
+    struct events_ring *next;
+    uint16_t thread;
+    // Events ever recorded; only the owner thread writes it and the events
+    // (field by field with relaxed atomics, see event_store, as the dump may
+    // read them meanwhile)
+    atomic_ulong head;
+    tfs_event_t events[EVENTS_RING_SIZE];
+} events_ring_t;
+
+// Rings of every thread that recorded an event (pushed, never removed)
+static _Atomic(events_ring_t *) rings = NULL;
+static atomic_uint next_thread = 1;
+static _Thread_local events_ring_t *ring = NULL;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static uint64_t tsc_begin;
+static uint64_t ns_begin;
+
+static void dump(void);
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Timestamp counter (on other architectures than x86, CLOCK_MONOTONIC).
+ */
+uint64_t events_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+static void init(void) {
+    tsc_begin = events_clock();
+    ns_begin = monotonic_ns();
+    atexit(dump);
+}
+
+static events_ring_t *ring_create(void) {
+    pthread_once(&init_once, init);
+
+    events_ring_t *new_ring = calloc(1, sizeof(events_ring_t));
+    if (new_ring == NULL) {
+        perror("events: calloc");
+        exit(EXIT_FAILURE);
+    }
+    new_ring->thread = (uint16_t)atomic_fetch_add(&next_thread, 1);
+
+    new_ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &new_ring->next, new_ring)) {
+    }
+    return new_ring;
+}
+
+#define EVENT_STORE(field, value)                                              \
+    __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define EVENT_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static void event_store(tfs_event_t *slot, tfs_event_t const *event) {
+    EVENT_STORE(slot->tsc, event->tsc);
+    EVENT_STORE(slot->duration, event->duration);
+    EVENT_STORE(slot->thread, event->thread);
+    EVENT_STORE(slot->type, event->type);
+    EVENT_STORE(slot->arg, event->arg);
+}
+
+static void event_load(tfs_event_t *event, tfs_event_t *slot) {
+    event->tsc = EVENT_LOAD(slot->tsc);
+    event->duration = EVENT_LOAD(slot->duration);
+    event->thread = EVENT_LOAD(slot->thread);
+    event->type = EVENT_LOAD(slot->type);
+    event->arg = EVENT_LOAD(slot->arg);
+}
+
+void events_record(event_type_t type, uint64_t begin, int64_t arg) {
+    uint64_t end = events_clock();
+    if (ring == NULL) {
+        ring = ring_create();
+    }
+
+    unsigned long head =
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t duration = end - begin;
+    tfs_event_t event = {
+        .tsc = begin,
+        .duration = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration,
+        .thread = ring->thread,
+        .type = (uint16_t)type,
+        .arg = arg,
+    };
+    event_store(&ring->events[head & (EVENTS_RING_SIZE - 1)], &event);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Copy the events of a ring, oldest first, while its thread may still be
+ * recording: those that it may have overwritten meanwhile are dropped.
+ *
+ * Returns how many events were copied.
+ */
+static size_t ring_copy(events_ring_t *r, tfs_event_t *out) {
+    unsigned long head = atomic_load_explicit(&r->head, memory_order_acquire);
+    unsigned long first = head > EVENTS_RING_SIZE ? head - EVENTS_RING_SIZE : 0;
+    for (unsigned long i = first; i < head; i++) {
+        event_load(&out[i - first], &r->events[i & (EVENTS_RING_SIZE - 1)]);
+    }
+
+    // The owner may be writing over event head_now - EVENTS_RING_SIZE (a
+    // read-modify-write that changes nothing, so that the copies above can't
+    // be moved past it)
+    unsigned long head_now =
+        atomic_fetch_add_explicit(&r->head, 0, memory_order_acq_rel);
+    unsigned long valid = head_now >= EVENTS_RING_SIZE
+                              ? head_now - EVENTS_RING_SIZE + 1
+                              : 0;
+    if (valid <= first) {
+        return head - first;
+    }
+    if (valid >= head) {
+        return 0;
+    }
+    memmove(out, out + (valid - first), (head - valid) * sizeof(tfs_event_t));
+    return head - valid;
+}
+
+/**
+ * Write the rings to the events file (at exit).
+ */
+static void dump(void) {
+    char default_path[64];
+    char const *path = getenv("TFS_EVENTS");
+    if (path == NULL || path[0] == '\0') {
+        snprintf(default_path, sizeof(default_path), "/tmp/tfs_events.%ld",
+                 (long)getpid());
+        path = default_path;
+    }
+
+    FILE *f = fopen(path, "wb");
+    tfs_event_t *events = malloc(EVENTS_RING_SIZE * sizeof(tfs_event_t));
+    if (f == NULL || events == NULL) {
+        perror("events: dump");
+        if (f != NULL) {
+            fclose(f);
+        }
+        free(events);
+        return;
+    }
+
+    tfs_events_header_t header = {
+        .tsc_begin = tsc_begin,
+        .ns_begin = ns_begin,
+        .event_count = 0,
+    };
+    memcpy(header.magic, TFS_EVENTS_MAGIC, sizeof(header.magic));
+    // Rewritten with the final count below
+    int res = fwrite(&header, sizeof(header), 1, f) == 1 ? 0 : -1;
+
+    for (events_ring_t *r = atomic_load(&rings); r != NULL && res == 0;
+         r = r->next) {
+        size_t count = ring_copy(r, events);
+        if (fwrite(events, sizeof(tfs_event_t), count, f) != count) {
+            res = -1;
+        }
+        header.event_count += count;
+    }
+
+    header.tsc_end = events_clock();
+    header.ns_end = monotonic_ns();
+    if (res == 0 && (fseek(f, 0, SEEK_SET) != 0 ||
+                     fwrite(&header, sizeof(header), 1, f) != 1)) {
+        res = -1;
+    }
+    if (fclose(f) != 0 || res == -1) {
+        perror("events: dump");
+    } else {
+        fprintf(stderr, "events: %lu events written to %s\n",
+                (unsigned long)header.event_count, path);
+    }
+    free(events);
+}
+
+#endif // TFS_EVENTS
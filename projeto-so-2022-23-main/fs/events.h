@@ -0,0 +1,75 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+/*
+ * Event timelines, compiled in with -DTFS_EVENTS (make EVENTS=yes).
+ *
+ * Each thread appends fixed-size binary events to a ring of its own (keeping
+ * the last EVENTS_RING_SIZE), with no locks and no formatting. At exit, the
+ * rings are written to the file named by the TFS_EVENTS environment variable
+ * (by default, /tmp/tfs_events.<pid>), which bench/tfs_events converts into
+ * Chrome trace JSON (for chrome://tracing or Perfetto).
+ *
+ * An events file is a tfs_events_header_t followed by its events, grouped by
+ * thread and in order within each thread. Integers are in the byte order of
+ * the machine that wrote it.
+ */
+
+#define TFS_EVENTS_MAGIC "TFSEVNT1"
+
+// Events kept per thread (a power of two)
+#define EVENTS_RING_SIZE (1 << 15)
+
+typedef enum {
+    EVENT_LOOKUP,      // arg: inumber found, or -1
+    EVENT_INODE_ALLOC, // arg: inumber, or -1
+    EVENT_BLOCK_ALLOC, // arg: block number, or -1
+    EVENT_DELAY,       // simulated storage access (insert_delay)
+    EVENT_LOCK_WAIT,   // arg: address of the lock (contended ones only)
+    EVENT_MEMCPY,      // arg: bytes copied to or from a file
+    EVENT_TYPE_COUNT,
+} event_type_t;
+
+typedef struct {
+    char magic[8];
+    // Two readings of the timestamp counter and of CLOCK_MONOTONIC (ns), at
+    // the first event and at the dump, to convert between them
+    uint64_t tsc_begin;
+    uint64_t ns_begin;
+    uint64_t tsc_end;
+    uint64_t ns_end;
+    uint64_t event_count;
+} tfs_events_header_t;
+
+typedef struct {
+    uint64_t tsc;      // start
+    uint32_t duration; // in timestamp counter ticks
+    uint16_t thread;   // numbered from 1 in order of their first event
+    uint16_t type;
+    int64_t arg;
+} tfs_event_t;
+
+/**
+ * Name of an event type (as shown in the trace viewer).
+ */
+char const *event_type_name(event_type_t type);
+
+#ifdef TFS_EVENTS
+
+uint64_t events_clock(void);
+void events_record(event_type_t type, uint64_t begin, int64_t arg);
+
+// Times what runs between them: EVENT_BEGIN(t); ...; EVENT_END(t, type, arg);
+#define EVENT_BEGIN(var) uint64_t var = events_clock()
+#define EVENT_END(var, type, arg) events_record(type, var, (int64_t)(arg))
+
+#else
+
+#define EVENT_BEGIN(var)
+#define EVENT_END(var, type, arg)
+
+#endif // TFS_EVENTS
+
+#endif // EVENTS_H
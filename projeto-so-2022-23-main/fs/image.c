@@ -0,0 +1,84 @@
+#include "image.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Image file backing store for the block cache: block i is kept at offset
+ * i * block size.
+ */
+
+struct image {
+    int fd;
+    size_t block_size;
+};
+
+static int image_read(void *store, int block_number, void *buffer) {
+    image_t *image = store;
+    off_t offset = (off_t)block_number * (off_t)image->block_size;
+    if (pread(image->fd, buffer, image->block_size, offset) !=
+        (ssize_t)image->block_size) {
+        return -1;
+    }
+    return 0;
+}
+
+static int image_write(void *store, int block_number, void const *buffer) {
+    image_t *image = store;
+    off_t offset = (off_t)block_number * (off_t)image->block_size;
+    if (pwrite(image->fd, buffer, image->block_size, offset) !=
+        (ssize_t)image->block_size) {
+        return -1;
+    }
+    return 0;
+}
+
+cache_backend_t const image_backend = {
+    .read = image_read,
+    .write = image_write,
+    .discard = NULL,
+    .write_through = false,
+};
+
+/**
+ * Create (or truncate) the image file.
+ *
+ * Input:
+ *   - path: image file path
+ *   - block_count: number of blocks in the image
+ *   - block_size: size of each block
+ *
+ * Returns the image if successful, NULL otherwise.
+ */
+image_t *image_open(char const *path, size_t block_count, size_t block_size) {
+    image_t *image = malloc(sizeof(image_t));
+    if (image == NULL) {
+        return NULL;
+    }
+
+    image->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (image->fd == -1) {
+        free(image);
+        return NULL;
+    }
+
+    if (ftruncate(image->fd, (off_t)(block_count * block_size)) == -1) {
+        close(image->fd);
+        free(image);
+        return NULL;
+    }
+
+    image->block_size = block_size;
+    return image;
+}
+
+/**
+ * Close the image file.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int image_close(image_t *image) {
+    int res = close(image->fd);
+    free(image);
+    return res == 0 ? 0 : -1;
+}
@@ -0,0 +1,15 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "cache.h"
+
+#include <stddef.h>
+
+typedef struct image image_t;
+
+image_t *image_open(char const *path, size_t block_count, size_t block_size);
+int image_close(image_t *image);
+
+extern cache_backend_t const image_backend;
+
+#endif // IMAGE_H
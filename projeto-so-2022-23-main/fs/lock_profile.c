@@ -0,0 +1,343 @@
+#include "lock_profile.h"
+
+#ifdef TFS_LOCK_PROFILE
+
+#include "config.h"
+#include "events.h"
+#include "stats.h"
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOCK_CLASSES_MAX (64)
+#define LOCK_CLASS_NAME_SIZE (48)
+// Call sites with the longest waits kept per class
+#define WORST_SITES (4)
+// Locks held at once by a thread whose hold time is measured
+#define HELD_MAX (16)
+// Counter slots, taken by threads round robin (like those of stats.h)
+#define LOCK_SLOTS (16)
+
+typedef struct {
+    atomic_ulong acquired;
+    atomic_ulong contended;
+    atomic_ulong wait_ns;
+    atomic_ulong hold_ns;
+} class_counters_t;
+
+typedef struct {
+    alignas(CACHE_LINE_SIZE) class_counters_t classes[LOCK_CLASSES_MAX];
+} counter_slot_t;
+
+typedef struct {
+    char name[LOCK_CLASS_NAME_SIZE];
+    atomic_ulong max_wait_ns;
+    atomic_ulong max_hold_ns;
+    // Only taken after waiting for a lock of the class
+    pthread_mutex_t worst_lock;
+    lock_site_t const *worst_sites[WORST_SITES];
+    uint64_t worst_waits[WORST_SITES];
+} lock_class_t;
+
+typedef struct {
+    void const *lock;
+    int class_id;
+    uint64_t since;
+} held_lock_t;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static lock_class_t classes[LOCK_CLASSES_MAX];
+static int class_count = 0; // protected by registry_lock
+
+static counter_slot_t slots[LOCK_SLOTS];
+static atomic_uint next_slot = 0;
+static _Thread_local int thread_slot = -1;
+
+static _Thread_local held_lock_t held[HELD_MAX];
+static _Thread_local int held_count = 0;
+
+static void report(void);
+
+static void mutex_lock_or_exit(pthread_mutex_t *lock) {
+    if (pthread_mutex_lock(lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void mutex_unlock_or_exit(pthread_mutex_t *lock) {
+    if (pthread_mutex_unlock(lock) != 0) {
+        perror("pthread_mutex_unlock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Class name of a locked expression: without its leading "&" and "fs->", and
+ * up to any subscript (so that the locks of an array share a class).
+ */
+static void class_name(char const *expr, char *name) {
+    if (*expr == '&') {
+        expr++;
+    }
+    if (strncmp(expr, "fs->", 4) == 0) {
+        expr += 4;
+    }
+    size_t len = strcspn(expr, "[");
+    if (len >= LOCK_CLASS_NAME_SIZE) {
+        len = LOCK_CLASS_NAME_SIZE - 1;
+    }
+    memcpy(name, expr, len);
+    name[len] = '\0';
+}
+
+/**
+ * Class of a call site's lock, registered on its first acquisition.
+ *
+ * Returns the class, or -1 if there are too many classes to profile it.
+ */
+static int class_of(lock_site_t *site) {
+    int id = atomic_load_explicit(&site->class_id, memory_order_acquire);
+    if (id != -1) {
+        return id;
+    }
+
+    char name[LOCK_CLASS_NAME_SIZE];
+    class_name(site->lock_class, name);
+
+    mutex_lock_or_exit(&registry_lock);
+    for (id = 0; id < class_count; id++) {
+        if (strcmp(classes[id].name, name) == 0) {
+            break;
+        }
+    }
+    if (id == class_count) {
+        if (class_count == LOCK_CLASSES_MAX) {
+            mutex_unlock_or_exit(&registry_lock);
+            return -1;
+        }
+        if (class_count == 0 && atexit(report) != 0) {
+            fprintf(stderr, "lock profile: cannot report at exit\n");
+            exit(EXIT_FAILURE);
+        }
+        strcpy(classes[id].name, name);
+        if (pthread_mutex_init(&classes[id].worst_lock, NULL) != 0) {
+            perror("pthread_mutex_init");
+            exit(EXIT_FAILURE);
+        }
+        class_count++;
+    }
+    mutex_unlock_or_exit(&registry_lock);
+
+    atomic_store_explicit(&site->class_id, id, memory_order_release);
+    return id;
+}
+
+static class_counters_t *counters_of(int class_id) {
+    if (thread_slot == -1) {
+        thread_slot = (int)(atomic_fetch_add(&next_slot, 1) % LOCK_SLOTS);
+    }
+    return &slots[thread_slot].classes[class_id];
+}
+
+static void atomic_max(atomic_ulong *max, uint64_t value) {
+    unsigned long current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(
+               max, &current, value, memory_order_relaxed,
+               memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Keep a call site among the worst waiters of its class, if it is one.
+ */
+static void note_wait(lock_class_t *class, lock_site_t const *site,
+                      uint64_t wait) {
+    mutex_lock_or_exit(&class->worst_lock);
+    // The site's entry, or else the one with the shortest wait
+    int slot = 0;
+    for (int i = 0; i < WORST_SITES; i++) {
+        if (class->worst_sites[i] == site) {
+            slot = i;
+            break;
+        }
+        if (class->worst_waits[i] < class->worst_waits[slot]) {
+            slot = i;
+        }
+    }
+    if (wait > class->worst_waits[slot]) {
+        class->worst_sites[slot] = site;
+        class->worst_waits[slot] = wait;
+    }
+    mutex_unlock_or_exit(&class->worst_lock);
+}
+
+/**
+ * Account an acquisition; start is when this thread began waiting, if it had
+ * to (contended).
+ */
+static void acquired(lock_site_t *site, void const *lock, uint64_t start,
+                     bool contended) {
+    uint64_t now = stats_clock();
+    int id = class_of(site);
+    if (id == -1) {
+        return;
+    }
+
+    class_counters_t *counters = counters_of(id);
+    atomic_fetch_add_explicit(&counters->acquired, 1, memory_order_relaxed);
+    if (contended) {
+        uint64_t wait = now - start;
+        atomic_fetch_add_explicit(&counters->contended, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->wait_ns, wait,
+                                  memory_order_relaxed);
+        atomic_max(&classes[id].max_wait_ns, wait);
+        note_wait(&classes[id], site, wait);
+    }
+
+    if (held_count < HELD_MAX) {
+        held[held_count++] = (held_lock_t){lock, id, now};
+    }
+}
+
+void lock_profile_rdlock(pthread_rwlock_t *lock, lock_site_t *site) {
+    if (pthread_rwlock_tryrdlock(lock) == 0) {
+        acquired(site, lock, 0, false);
+        return;
+    }
+
+    uint64_t start = stats_clock();
+    EVENT_BEGIN(begin);
+    if (pthread_rwlock_rdlock(lock) != 0) {
+        perror("pthread_rwlock_rdlock");
+        exit(EXIT_FAILURE);
+    }
+    EVENT_END(begin, EVENT_LOCK_WAIT, (uintptr_t)lock);
+    acquired(site, lock, start, true);
+}
+
+void lock_profile_wrlock(pthread_rwlock_t *lock, lock_site_t *site) {
+    if (pthread_rwlock_trywrlock(lock) == 0) {
+        acquired(site, lock, 0, false);
+        return;
+    }
+
+    uint64_t start = stats_clock();
+    EVENT_BEGIN(begin);
+    if (pthread_rwlock_wrlock(lock) != 0) {
+        perror("pthread_rwlock_wrlock");
+        exit(EXIT_FAILURE);
+    }
+    EVENT_END(begin, EVENT_LOCK_WAIT, (uintptr_t)lock);
+    acquired(site, lock, start, true);
+}
+
+void lock_profile_mutex(pthread_mutex_t *lock, lock_site_t *site) {
+    if (pthread_mutex_trylock(lock) == 0) {
+        acquired(site, lock, 0, false);
+        return;
+    }
+
+    uint64_t start = stats_clock();
+    EVENT_BEGIN(begin);
+    if (pthread_mutex_lock(lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+    EVENT_END(begin, EVENT_LOCK_WAIT, (uintptr_t)lock);
+    acquired(site, lock, start, true);
+}
+
+void lock_profile_release(void const *lock) {
+    for (int i = held_count - 1; i >= 0; i--) {
+        if (held[i].lock == lock) {
+            uint64_t hold = stats_clock() - held[i].since;
+            class_counters_t *counters = counters_of(held[i].class_id);
+            atomic_fetch_add_explicit(&counters->hold_ns, hold,
+                                      memory_order_relaxed);
+            atomic_max(&classes[held[i].class_id].max_hold_ns, hold);
+
+            held[i] = held[--held_count];
+            return;
+        }
+    }
+}
+
+/**
+ * Print the profile, classes with the longest total wait first. It runs at
+ * exit, so it gives up on failure instead of exiting again.
+ */
+static void report(void) {
+    if (pthread_mutex_lock(&registry_lock) != 0) {
+        perror("pthread_mutex_lock");
+        return;
+    }
+    int count = class_count;
+    if (pthread_mutex_unlock(&registry_lock) != 0) {
+        perror("pthread_mutex_unlock");
+        return;
+    }
+
+    struct {
+        unsigned long acquired;
+        unsigned long contended;
+        unsigned long wait_ns;
+        unsigned long hold_ns;
+    } totals[LOCK_CLASSES_MAX] = {0};
+    int order[LOCK_CLASSES_MAX];
+
+    for (int id = 0; id < count; id++) {
+        for (int s = 0; s < LOCK_SLOTS; s++) {
+            class_counters_t *c = &slots[s].classes[id];
+            totals[id].acquired += atomic_load(&c->acquired);
+            totals[id].contended += atomic_load(&c->contended);
+            totals[id].wait_ns += atomic_load(&c->wait_ns);
+            totals[id].hold_ns += atomic_load(&c->hold_ns);
+        }
+
+        // Insertion sort by total wait
+        int i = id;
+        while (i > 0 && totals[order[i - 1]].wait_ns < totals[id].wait_ns) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = id;
+    }
+
+    fprintf(stderr, "lock profile:\n%-28s %10s %10s %12s %12s %12s %12s\n",
+            "class", "acquired", "contended", "wait_us", "max_wait_us",
+            "hold_us", "max_hold_us");
+    for (int i = 0; i < count; i++) {
+        lock_class_t *class = &classes[order[i]];
+        fprintf(stderr, "%-28s %10lu %10lu %12lu %12lu %12lu %12lu\n",
+                class->name, totals[order[i]].acquired,
+                totals[order[i]].contended, totals[order[i]].wait_ns / 1000,
+                atomic_load(&class->max_wait_ns) / 1000,
+                totals[order[i]].hold_ns / 1000,
+                atomic_load(&class->max_hold_ns) / 1000);
+
+        if (pthread_mutex_lock(&class->worst_lock) != 0) {
+            perror("pthread_mutex_lock");
+            return;
+        }
+        for (int w = 0; w < WORST_SITES; w++) {
+            if (class->worst_sites[w] != NULL) {
+                fprintf(stderr, "    waited up to %lu us at %s:%d\n",
+                        (unsigned long)(class->worst_waits[w] / 1000),
+                        class->worst_sites[w]->file,
+                        class->worst_sites[w]->line);
+            }
+        }
+        if (pthread_mutex_unlock(&class->worst_lock) != 0) {
+            perror("pthread_mutex_unlock");
+            return;
+        }
+    }
+}
+
+#endif // TFS_LOCK_PROFILE
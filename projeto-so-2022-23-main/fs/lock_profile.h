@@ -0,0 +1,50 @@
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+/*
+ * Lock profiler, compiled in with -DTFS_LOCK_PROFILE (make LOCK_PROFILE=yes).
+ *
+ * The locking wrappers of state.h then become macros that pass their call
+ * site, and every acquisition is accounted to the class of its lock, named
+ * after the locked expression (e.g. "datablocks_lock" for
+ * &fs->datablocks_lock). The profile is printed to stderr at exit.
+ */
+
+#ifdef TFS_LOCK_PROFILE
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Call site of a lock acquisition (one static instance per site).
+ */
+typedef struct {
+    char const *lock_class;
+    char const *file;
+    int line;
+    atomic_int class_id; // -1 until the first acquisition
+} lock_site_t;
+
+#define LOCK_PROFILE_SITE(fn, lock_class, ...)                                 \
+    do {                                                                       \
+        static lock_site_t site_ = {lock_class, __FILE__, __LINE__, -1};       \
+        fn(__VA_ARGS__, &site_);                                               \
+    } while (0)
+
+/*
+ * Acquire a lock, trying first without blocking (an uncontended acquisition
+ * only counts and timestamps it); the lock functions exit on failure like the
+ * wrappers they replace
+ */
+void lock_profile_rdlock(pthread_rwlock_t *lock, lock_site_t *site);
+void lock_profile_wrlock(pthread_rwlock_t *lock, lock_site_t *site);
+void lock_profile_mutex(pthread_mutex_t *lock, lock_site_t *site);
+
+/**
+ * Account the hold time of a lock about to be released by this thread.
+ */
+void lock_profile_release(void const *lock);
+
+#endif // TFS_LOCK_PROFILE
+
+#endif // LOCK_PROFILE_H
@@ -1,30 +1,49 @@
 #include "operations.h"
 #include "config.h"
+#include "events.h"
 #include "state.h"
+#include "stats.h"
+#include "trace.h"
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "betterassert.h"
 
 #define BUFFER_SIZE 128
 
-// mutex to protect the opened files table
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-
 tfs_params tfs_default_params() {
     tfs_params params = {
         .max_inode_count = 64,
         .max_block_count = 1024,
         .max_open_files_count = 16,
         .block_size = 1024,
+        .block_image_path = NULL,
+        .block_cache_count = 0,
+        .compressed_pool_size = 0,
+        .dedup_blocks = false,
+        .inline_small_files = false,
+        .huge_pages = false,
+        .shard_count = 1,
     };
     return params;
 }
 
-int tfs_init(tfs_params const *params_ptr) {
+/*
+ * Instances operated on by the functions that take no tfs_t (see tfs_init).
+ * Path names are spread across them by hash, and each file handle keeps the
+ * shard it belongs to in its lowest digit in base shard_count.
+ */
+static tfs_t **shards = NULL;
+static size_t shard_count = 0;
+static tfs_params front_params;
+static stats_t front_stats; // calls to the front end, since tfs_init
+
+tfs_t *tfs_create(tfs_params const *params_ptr) {
     tfs_params params;
     if (params_ptr != NULL) {
         params = *params_ptr;
@@ -32,45 +51,110 @@ int tfs_init(tfs_params const *params_ptr) {
         params = tfs_default_params();
     }
 
-    if (state_init(params) != 0) {
-        return -1;
-    }
-
-    if (pthread_mutex_init(&mutex, NULL) != 0) {
-        perror("pthread_mutex_init");
-        exit(EXIT_FAILURE);
+    tfs_t *fs = state_init(params);
+    if (fs == NULL) {
+        return NULL;
     }
 
     // create root inode
-    int root = inode_create(T_DIRECTORY);
+    int root = inode_create(fs, T_DIRECTORY);
     if (root != ROOT_DIR_INUM) {
-        return -1;
+        state_destroy(fs);
+        return NULL;
     }
 
+    return fs;
+}
+
+int tfs_release(tfs_t *fs) {
+    if (state_destroy(fs) != 0) {
+        return -1;
+    }
     return 0;
 }
 
-int tfs_destroy() {
+int tfs_init(tfs_params const *params_ptr) {
+    if (shards != NULL) {
+        return -1; // already initialized
+    }
 
-    if (pthread_mutex_destroy(&mutex) != 0) {
-        perror("pthread_mutex_init");
-        exit(EXIT_FAILURE);
+    tfs_params params;
+    if (params_ptr != NULL) {
+        params = *params_ptr;
+    } else {
+        params = tfs_default_params();
     }
 
-    if (state_destroy() != 0) {
+    size_t count = params.shard_count > 0 ? params.shard_count : 1;
+    tfs_t **instances = calloc(count, sizeof(tfs_t *));
+    if (instances == NULL) {
         return -1;
     }
+
+    for (size_t i = 0; i < count; i++) {
+        tfs_params shard_params = params;
+        char *image_path = NULL;
+
+        // Each shard keeps its blocks in its own image file, "<path>.<i>"
+        if (params.block_image_path != NULL && count > 1) {
+            size_t len = strlen(params.block_image_path) + 24;
+            image_path = malloc(len);
+            if (image_path != NULL) {
+                snprintf(image_path, len, "%s.%zu", params.block_image_path,
+                         i);
+                shard_params.block_image_path = image_path;
+            }
+        }
+
+        if (params.block_image_path == NULL || count == 1 ||
+            image_path != NULL) {
+            instances[i] = tfs_create(&shard_params);
+        }
+        free(image_path);
+
+        if (instances[i] == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                tfs_release(instances[j]);
+            }
+            free(instances);
+            return -1;
+        }
+    }
+
+    shards = instances;
+    shard_count = count;
+    front_params = params;
+    stats_reset(&front_stats);
+
+    // Trace the whole run, without changes to the program
+    char const *trace_path = getenv("TFS_TRACE");
+    if (trace_path != NULL && trace_start(trace_path, &params) != 0) {
+        fprintf(stderr, "cannot write trace to %s\n", trace_path);
+    }
     return 0;
 }
 
-static bool valid_pathname(char const *name) {
+int tfs_destroy() {
+    if (shards == NULL) {
+        return -1;
+    }
 
-    for (int i = 0; i < strlen(name); i++) {
-        if (name[i] == toupper(name[i])) {
-            return false;
+    trace_stop(); // if tracing
+
+    int res = 0;
+    for (size_t i = 0; i < shard_count; i++) {
+        if (tfs_release(shards[i]) != 0) {
+            res = -1;
         }
     }
 
+    free(shards);
+    shards = NULL;
+    shard_count = 0;
+    return res;
+}
+
+static bool valid_pathname(char const *name) {
     return name != NULL && strlen(name) > 1 && name[0] == '/';
 }
 
@@ -85,9 +169,9 @@ static bool valid_pathname(char const *name) {
  *   - root_inode: the root directory inode
  * Returns the inumber of the file, -1 if unsuccessful.
  */
-static int tfs_lookup(char const *name, inode_t const *root_inode) {
+static int tfs_lookup(tfs_t *fs, char const *name, inode_t const *root_inode) {
     // TODO: assert that root_inode is the root directory
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    inode_t *root_dir_inode = inode_get(fs, ROOT_DIR_INUM);
 
     if (memcmp(root_inode, root_dir_inode, MAX_FILE_NAME) != 0) {
         return -1;
@@ -100,131 +184,245 @@ static int tfs_lookup(char const *name, inode_t const *root_inode) {
     // skip the initial '/' character
     name++;
 
-    return find_in_dir(root_inode, name);
+    return find_in_dir(fs, root_inode, name);
 }
 
-int tfs_open(char const *name, tfs_file_mode_t mode) {
+int tfs_open_r(tfs_t *fs, char const *name, tfs_file_mode_t mode) {
     // Checks if the path name is valid
     if (!valid_pathname(name)) {
         return -1;
     }
 
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    inode_t *root_dir_inode = inode_get(fs, ROOT_DIR_INUM);
     ALWAYS_ASSERT(root_dir_inode != NULL,
                   "tfs_open: root dir inode must exist");
 
-    // Locks the opened files table
-    mutex_lock(&mutex);
-
-    int inum = tfs_lookup(name, root_dir_inode);
+    char link_target[INODE_INLINE_SIZE];
+    int inum;
+    inode_t *inode;
     size_t offset;
 
-    if (inum >= 0) {
-        mutex_unlock(&mutex);
-        // The file already exists
-        inode_t *inode = inode_get(inum);
-        ALWAYS_ASSERT(inode != NULL,
-                      "tfs_open: directory files must have an inode");
+    // Symbolic links are followed iteratively, up to MAX_SYMLINK_HOPS of them
+    for (int hops = 0;; hops++) {
+        // The lookup takes no lock (see find_in_dir), so opens of files that
+        // already exist never serialize with each other or with creations
+        inum = tfs_lookup(fs, name, root_dir_inode);
+
+        if (inum < 0 && (mode & TFS_O_CREAT)) {
+            // The file does not exist; the mode specified that it should be
+            // created
+            // Create inode
+            inum = inode_create(fs, T_FILE);
+            if (inum == -1) {
+                return -1; // no space in inode table
+            }
 
-        if (inode->i_node_type == T_LINK) {
-            return tfs_open(data_block_get(inode->i_data_block), mode);
-        }
+            // Add entry in the root directory (exclusive on the directory only)
+            if (add_dir_entry(fs, root_dir_inode, name + 1, inum) == -1) {
+                inode_delete(fs, inum);
 
-        // Truncate (if requested)
-        if (mode & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                data_block_free(inode->i_data_block);
-                inode->i_size = 0;
+                // Either the directory is full or a concurrent open created
+                // the same name first, in which case that file is opened
+                inum = tfs_lookup(fs, name, root_dir_inode);
             }
         }
-        // Determine initial offset
-        if (mode & TFS_O_APPEND) {
-            offset = inode->i_size;
-        } else {
-            offset = 0;
-        }
-    } else if (mode & TFS_O_CREAT) {
-        // The file does not exist; the mode specified that it should be created
-        // Create inode
-        inum = inode_create(T_FILE);
-        if (inum == -1) {
-            mutex_unlock(&mutex);
-            return -1; // no space in inode table
+
+        if (inum < 0) {
+            return -1; // no such file, or no space in directory
         }
 
-        // Add entry in the root directory
+        inode = inode_get(fs, inum);
+        ALWAYS_ASSERT(inode != NULL,
+                      "tfs_open: directory files must have an inode");
+
+        if (inode->i_node_type != T_LINK) {
+            break;
+        }
 
-        if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
-            mutex_unlock(&mutex);
-            inode_delete(inum);
-            return -1; // no space in directory
+        if (hops == MAX_SYMLINK_HOPS) {
+            return -1; // too many links, most likely a loop
         }
 
-        // Unlocks the opened files table
-        mutex_unlock(&mutex);
-        offset = 0;
-    } else {
+        // Continues with the link's target, which is kept in its inode
+        inode_lock(fs, inum, 0);
+        memcpy(link_target, inode->i_inline, sizeof(link_target));
+        inode_unlock(fs, inum);
+        name = link_target;
+    }
 
-        //
-        mutex_unlock(&mutex);
-        return -1;
+    inode_lock(fs, inum, 1);
+
+    // Truncate (if requested)
+    if (mode & TFS_O_TRUNC) {
+        if (inode->i_size > 0) {
+            inode_write_begin(fs, inum);
+            if (inode->i_data_block != -1) {
+                data_block_free(fs, inode->i_data_block);
+            }
+            INODE_STORE(inode->i_data_block, -1);
+            INODE_STORE(inode->i_size, 0);
+            inode_write_end(fs, inum);
+        }
+    }
+    // Determine initial offset
+    if (mode & TFS_O_APPEND) {
+        offset = inode->i_size;
+    } else {
+        offset = 0;
     }
 
+    inode_unlock(fs, inum);
+
     // Finally, add entry to the open file table and return the corresponding
     // handle
-    return add_to_open_file_table(inum, offset);
+    return add_to_open_file_table(fs, inum, offset, mode & TFS_O_BUFFERED);
 
     // Note: for simplification, if file was created with TFS_O_CREAT and there
     // is an error adding an entry to the open file table, the file is not
     // opened but it remains created
 }
 
-int tfs_sym_link(char const *target, char const *link_name) {
-
-    // Checks if the path names are valid
-    if (!valid_pathname(target) || !valid_pathname(link_name)) {
-        return -1;
-    }
-
+/**
+ * Create a symbolic link, without checking that its target exists.
+ *
+ * Input:
+ *   - target: absolute path name of the link target
+ *   - link_name: absolute path name of the link to be created
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int sym_link_create(tfs_t *fs, char const *target,
+                           char const *link_name) {
     // get's the root directory inode
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    inode_t *root_dir_inode = inode_get(fs, ROOT_DIR_INUM);
 
     // gets the inumber for the new link
-    int link_inum = tfs_lookup(link_name, root_dir_inode);
+    int link_inum = tfs_lookup(fs, link_name, root_dir_inode);
     if (link_inum != -1) {
         return -1;
     }
 
-    // gets the inumber for the target file
-    int target_inum = tfs_lookup(target, root_dir_inode);
-    if (target_inum == -1) {
+    // the target path must fit in the link's inode
+    size_t target_len = strlen(target);
+    if (target_len >= INODE_INLINE_SIZE) {
         return -1;
     }
 
     // Creates a new inode with type T_LINK (Symbolic Link)
-    int link_inode_inum = inode_create(T_LINK);
+    int link_inode_inum = inode_create(fs, T_LINK);
     if (link_inode_inum == -1) {
         return -1;
     }
 
     // gets the inode for the new link
-    inode_t *link_inode = inode_get(link_inode_inum);
+    inode_t *link_inode = inode_get(fs, link_inode_inum);
     if (link_inode == NULL) {
+        inode_delete(fs, link_inode_inum);
         return -1;
     }
 
-    // copies the target file path into the link's data block
-    strcpy(data_block_get(link_inode->i_data_block), target);
+    // copies the target file path into the link's inode
+    memcpy(link_inode->i_inline, target, target_len + 1);
+    INODE_STORE(link_inode->i_size, target_len);
 
     // adds the link to the directory
-    if (add_dir_entry(root_dir_inode, link_name + 1, link_inode_inum) == -1) {
+    if (add_dir_entry(fs, root_dir_inode, link_name + 1, link_inode_inum) ==
+        -1) {
+        // Either the directory is full or the name was taken meanwhile
+        inode_delete(fs, link_inode_inum);
         return -1;
     }
 
     return 0;
 }
 
-int tfs_link(char const *target, char const *link_name) {
+int tfs_sym_link_r(tfs_t *fs, char const *target, char const *link_name) {
+
+    // Checks if the path names are valid
+    if (!valid_pathname(target) || !valid_pathname(link_name)) {
+        return -1;
+    }
+
+    // gets the inumber for the target file
+    int target_inum = tfs_lookup(fs, target, inode_get(fs, ROOT_DIR_INUM));
+    if (target_inum == -1) {
+        return -1;
+    }
+
+    return sym_link_create(fs, target, link_name);
+}
+
+/**
+ * Obtain the target of a symbolic link.
+ *
+ * Input:
+ *   - name: absolute path name
+ *   - target: where to store the link's target
+ *
+ * Returns 0 if name is a symbolic link, -1 otherwise.
+ */
+static int read_link(tfs_t *fs, char const *name,
+                     char target[INODE_INLINE_SIZE]) {
+    int inum = tfs_lookup(fs, name, inode_get(fs, ROOT_DIR_INUM));
+    if (inum < 0) {
+        return -1;
+    }
+
+    inode_t *inode = inode_get(fs, inum);
+    if (inode->i_node_type != T_LINK) {
+        return -1;
+    }
+
+    inode_lock(fs, inum, 0);
+    memcpy(target, inode->i_inline, INODE_INLINE_SIZE);
+    inode_unlock(fs, inum);
+    return 0;
+}
+
+/**
+ * Drop one of the names of a file, deleting it once it has none left.
+ *
+ * The caller must have removed the name from its directory first (under the
+ * directory's write lock), so that each name is dropped exactly once.
+ *
+ * Input:
+ *   - inum: inumber of the file
+ */
+static void inode_drop_link(tfs_t *fs, int inum) {
+    inode_t *inode = inode_get(fs, inum);
+
+    // A symbolic link has no other names; otherwise, only whoever drops the
+    // last link deletes the file
+    if (inode->i_node_type == T_LINK ||
+        __atomic_sub_fetch(&inode->hard_links, 1, __ATOMIC_ACQ_REL) == 0) {
+        inode_delete(fs, inum);
+    }
+}
+
+/**
+ * Count one more name for a file, unless it has none left (it is being, or
+ * has been, deleted).
+ *
+ * Input:
+ *   - inum: inumber of the file
+ *
+ * Returns true if the link was counted, false otherwise.
+ */
+static bool inode_add_link(tfs_t *fs, int inum) {
+    inode_t *inode = inode_get(fs, inum);
+
+    int links = __atomic_load_n(&inode->hard_links, __ATOMIC_RELAXED);
+    do {
+        if (links == 0) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&inode->hard_links, &links,
+                                          links + 1, true, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+    return true;
+}
+
+int tfs_link_r(tfs_t *fs, char const *target, char const *link_name) {
 
     // Checks if the pathnames are valid
     if (!valid_pathname(target) || !valid_pathname(link_name)) {
@@ -232,22 +430,22 @@ int tfs_link(char const *target, char const *link_name) {
     }
 
     // get's the root directory inode
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    inode_t *root_dir_inode = inode_get(fs, ROOT_DIR_INUM);
 
     // gets the inumber for the new link
-    int target_inum = tfs_lookup(target, root_dir_inode);
+    int target_inum = tfs_lookup(fs, target, root_dir_inode);
     if (target_inum == -1) {
         return -1;
     }
 
     // gets the inumber for the target file
-    int link_inum = tfs_lookup(link_name, root_dir_inode);
+    int link_inum = tfs_lookup(fs, link_name, root_dir_inode);
     if (link_inum != -1) {
         return -1;
     }
 
     // Gets the inode for the target file
-    inode_t *target_file_inode = inode_get(target_inum);
+    inode_t *target_file_inode = inode_get(fs, target_inum);
     if (target_file_inode == NULL) {
         return -1;
     }
@@ -257,209 +455,474 @@ int tfs_link(char const *target, char const *link_name) {
         return -1;
     }
 
-    // Adds the link to the directory
-    int check = add_dir_entry(root_dir_inode, link_name + 1, target_inum);
-    if (check == -1) {
+    // Counts the new name before adding it, so that unlinking the target
+    // meanwhile cannot delete a file that is still named
+    if (!inode_add_link(fs, target_inum)) {
         return -1;
     }
 
-    // Increments the number of hard links for the target file
-    target_file_inode->hard_links++;
+    // Adds the link to the directory, unless the target was unlinked (and its
+    // inode reused) since the lookup
+    if (tfs_lookup(fs, target, root_dir_inode) != target_inum ||
+        add_dir_entry(fs, root_dir_inode, link_name + 1, target_inum) == -1) {
+        inode_drop_link(fs, target_inum);
+        return -1;
+    }
 
     return 0;
 }
 
-void tfs_rename(char const *path, char const *new_path) {
-    tfs_link(path, new_path);
-    tfs_unlink(path);
-}
+int tfs_rename_r(tfs_t *fs, char const *path, char const *new_path) {
+    if (!valid_pathname(path) || !valid_pathname(new_path)) {
+        return -1;
+    }
 
-int tfs_size(char const *path) {
-    int inum = tfs_lookup(path, inode_get(ROOT_DIR_INUM));
-    inode_t *inode = inode_get(inum);
-    return inode->i_size;
+    int replaced;
+    int res = rename_dir_entry(fs, inode_get(fs, ROOT_DIR_INUM), path + 1,
+                               new_path + 1, &replaced);
+    if (replaced != -1) {
+        inode_drop_link(fs, replaced);
+    }
+    return res;
 }
 
-int tfs_close(int fhandle) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
-        return -1; // invalid fd
+ssize_t tfs_stat_many_r(tfs_t *fs, char const *const paths[], size_t count,
+                        tfs_stat_t out[]) {
+    if (paths == NULL || out == NULL) {
+        return -1;
+    }
+
+    char const **names = malloc(count * sizeof(char const *));
+    if (names == NULL && count > 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        // skip the initial '/' character
+        names[i] = paths[i] != NULL && valid_pathname(paths[i]) ? paths[i] + 1
+                                                                : NULL;
     }
 
-    remove_from_open_file_table(fhandle);
+    ssize_t found = dir_stat_batch(fs, inode_get(fs, ROOT_DIR_INUM), names,
+                                   count, out);
+    free(names);
+    return found;
+}
 
+int tfs_stat_r(tfs_t *fs, char const *path, tfs_stat_t *st) {
+    if (st == NULL || tfs_stat_many_r(fs, &path, 1, st) != 1) {
+        return -1;
+    }
     return 0;
 }
 
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+/**
+ * Write to a file's data block (allocating it if needed), starting at a given
+ * offset. The caller must hold the inode's write lock.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - offset: offset in the block to start writing at
+ *   - buffer: buffer containing the contents to write
+ *   - to_write: length of the buffer contents (in bytes), which must fit
+ *
+ * Returns 0 if successful, -1 if no data block is available, the block could
+ * not be read, or there is no room left to store it.
+ */
+static int inode_block_write(tfs_t *fs, inode_t *inode, size_t offset,
+                             void const *buffer, size_t to_write) {
+    if (data_block_dedup_enabled(fs)) {
+        return data_block_write_dedup(fs, &inode->i_data_block, offset, buffer,
+                                      to_write, inode->i_size);
+    }
 
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
-        return -1;
+    bool new_block = inode->i_data_block == -1;
+    if (new_block) {
+        // If no block yet, allocate new block
+        int bnum = data_block_alloc(fs);
+        if (bnum == -1) {
+            return -1; // no space
+        }
+
+        INODE_STORE(inode->i_data_block, bnum);
     }
 
-    if (pthread_mutex_lock(&file->lock) != 0) {
-        perror("pthread_mutex_lock");
-        exit(EXIT_FAILURE);
+    void *block = data_block_get(fs, inode->i_data_block);
+    if (block != NULL) {
+        // Perform the actual write
+        EVENT_BEGIN(copy);
+        data_copy_in((char *)block + offset, buffer, to_write);
+        EVENT_END(copy, EVENT_MEMCPY, to_write);
+    }
+    if (block == NULL || data_block_put(fs, inode->i_data_block, true) == -1) {
+        // the block's previous contents were kept
+        if (new_block) {
+            data_block_free(fs, inode->i_data_block);
+            INODE_STORE(inode->i_data_block, -1);
+        }
+        return -1; // unreadable, or no space
     }
 
-    //  From the open file table entry, we get the inode
+    return 0;
+}
 
-    int inum = file->of_inumber;
-    inode_t *inode = inode_get(inum);
+/**
+ * Write to a file, starting at a given offset.
+ *
+ * If enabled, files of up to INODE_INLINE_SIZE bytes keep their contents in
+ * the inode; they are moved to a data block once they grow past it.
+ *
+ * Input:
+ *   - inum: inumber of the file
+ *   - offset: offset in the file to start writing at
+ *   - buffer: buffer containing the contents to write
+ *   - to_write: length of the buffer contents (in bytes)
+ *
+ * Returns the number of bytes that were written (can be lower than 'to_write'
+ * if the maximum file size is exceeded), or -1 if no data block is available,
+ * the block could not be read, or there is no room left to store it.
+ */
+static ssize_t inode_write_at(tfs_t *fs, int inum, size_t offset,
+                              void const *buffer, size_t to_write) {
+    inode_t *inode = inode_get(fs, inum);
     ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
 
-    inode_lock(inum, 1); // locks inode for writing
+    inode_lock(fs, inum, 1); // locks inode for writing
 
     // Determine how many bytes to write
-    size_t block_size = state_block_size();
-    if (to_write + file->of_offset >
-        block_size) { // escreve só o máximo permitido
-        to_write = block_size - file->of_offset;
+    size_t block_size = state_block_size(fs);
+    if (to_write + offset > block_size) { // escreve só o máximo permitido
+        to_write = block_size - offset;
     }
 
     if (to_write > 0) {
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                inode_unlock(inum);
-                if (pthread_mutex_unlock(&file->lock) != 0) {
-                    perror("pthread_mutex_unlock");
-                    exit(EXIT_FAILURE);
-                }
-                return -1; // no space
-            }
+        inode_write_begin(fs, inum);
 
-            inode->i_data_block = bnum;
+        int res = 0;
+        if (inode_inline_enabled(fs) && inode->i_data_block == -1 &&
+            offset + to_write <= INODE_INLINE_SIZE) {
+            // Still a tiny file: no data block needed
+            data_copy_in(inode->i_inline + offset, buffer, to_write);
+        } else {
+            if (inode->i_data_block == -1 && inode->i_size > 0) {
+                // Spills the inline contents to a data block first
+                res = inode_block_write(fs, inode, 0, inode->i_inline,
+                                        inode->i_size);
+            }
+            if (res == 0) {
+                res = inode_block_write(fs, inode, offset, buffer, to_write);
+            }
         }
 
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
+        if (res == 0 && offset + to_write > inode->i_size) {
+            // inode i_size is updated
+            INODE_STORE(inode->i_size, offset + to_write);
+        }
 
-        // Perform the actual write
-        memcpy(block + file->of_offset, buffer, to_write);
+        inode_write_end(fs, inum);
 
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            // inode i_size is updated
-            inode->i_size = file->of_offset;
+        if (res == -1) {
+            inode_unlock(fs, inum);
+            return -1; // no space
         }
     }
 
-    inode_unlock(inum);
-    if (pthread_mutex_unlock(&file->lock) != 0) {
-        perror("pthread_mutex_unlock");
-        exit(EXIT_FAILURE);
-    }
+    inode_unlock(fs, inum);
     return (ssize_t)to_write;
 }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+/**
+ * Write the pending contents of an open file's write-back buffer to the file.
+ *
+ * Input:
+ *   - file: open file entry, locked by the caller
+ *
+ * Returns 0 if successful, -1 otherwise (the contents are then kept pending,
+ * to be written by the next flush).
+ */
+static int flush_write_buffer(tfs_t *fs, open_file_entry_t *file) {
+    if (file->of_wb_len == 0) {
+        return 0;
+    }
 
-    open_file_entry_t *file = get_open_file_entry(fhandle);
+    ssize_t written = inode_write_at(fs, file->of_inumber, file->of_wb_start,
+                                     file->of_wb_buf, file->of_wb_len);
+    if (written == -1) {
+        return -1;
+    }
+
+    file->of_wb_len = 0;
+    return 0;
+}
+
+int tfs_flush_r(tfs_t *fs, int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
     if (file == NULL) {
         return -1;
     }
 
-    if (pthread_mutex_lock(&file->lock) != 0) {
-        perror("pthread_mutex_lock");
-        exit(EXIT_FAILURE);
+    mutex_lock(&file->lock);
+    int res = flush_write_buffer(fs, file);
+    mutex_unlock(&file->lock);
+
+    return res;
+}
+
+int tfs_close_r(tfs_t *fs, int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1; // invalid fd
     }
 
-    int inum = file->of_inumber;
-    // From the open file table entry, we get the inode
-    inode_t const *inode = inode_get(inum);
-    ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+    int res = tfs_flush_r(fs, fhandle);
+
+    remove_from_open_file_table(fs, fhandle);
+
+    return res;
+}
 
-    inode_lock(inum, 0);
+ssize_t tfs_write_r(tfs_t *fs, int fhandle, void const *buffer,
+                    size_t to_write) {
 
-    // Determine how many bytes to read
-    size_t to_read = inode->i_size - file->of_offset;
-    if (to_read > len) {
-        to_read = len;
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
     }
 
-    if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
+    mutex_lock(&file->lock);
+
+    ssize_t written;
+    if (file->of_buffered) {
+        // Only copies into the handle's buffer; the inode is not touched
+        // until the buffer reaches the end of the block or is flushed
+        size_t block_size = state_block_size(fs);
+        if (to_write + file->of_offset > block_size) {
+            to_write = block_size - file->of_offset;
+        }
+
+        if (file->of_wb_len == 0) {
+            file->of_wb_start = file->of_offset;
+        }
+        EVENT_BEGIN(copy);
+        memcpy(file->of_wb_buf + file->of_wb_len, buffer, to_write);
+        EVENT_END(copy, EVENT_MEMCPY, to_write);
+        file->of_wb_len += to_write;
+        file->of_offset += to_write;
+
+        written = (ssize_t)to_write;
+        if (file->of_offset == block_size &&
+            flush_write_buffer(fs, file) == -1) {
+            // Takes back this call's bytes only: the ones buffered before
+            // stay pending, as they were already reported as written
+            file->of_wb_len -= to_write;
+            file->of_offset -= to_write;
+            written = -1;
+        }
+    } else {
+        written = inode_write_at(fs, file->of_inumber, file->of_offset, buffer,
+                                 to_write);
 
-        // Perform the actual read
-        memcpy(buffer, block + file->of_offset, to_read);
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_read;
+        // The offset associated with the file handle is incremented
+        // accordingly
+        if (written > 0) {
+            file->of_offset += (size_t)written;
+        }
     }
 
-    if (pthread_mutex_unlock(&file->lock) != 0) {
-        perror("pthread_mutex_unlock");
-        exit(EXIT_FAILURE);
+    mutex_unlock(&file->lock);
+    return written;
+}
+
+/**
+ * Update the read-ahead window of an open file before a read.
+ *
+ * The window doubles on every read that continues where the previous one
+ * stopped, up to a whole block, and collapses (dropping the cached bytes) as
+ * soon as the access pattern stops being sequential.
+ *
+ * Input:
+ *   - file: open file entry, locked by the caller
+ *   - len: length of the read being issued
+ */
+static void read_ahead_update(tfs_t *fs, open_file_entry_t *file, size_t len) {
+    size_t block_size = state_block_size(fs);
+
+    if (file->of_offset != file->of_ra_next) {
+        file->of_ra_window = 0;
+        file->of_ra_len = 0;
+        return;
     }
 
-    inode_unlock(inum);
-    return (ssize_t)to_read;
+    if (file->of_ra_window == 0) {
+        file->of_ra_window = len < block_size / 2 ? 2 * len : block_size;
+    } else if (file->of_ra_window < block_size / 2) {
+        file->of_ra_window *= 2;
+    } else {
+        file->of_ra_window = block_size;
+    }
 }
 
-int tfs_unlink(char const *target) {
+/**
+ * Try to serve a read from the bytes read ahead for an open file.
+ *
+ * The cache is only valid while the inode's sequence number is the one it was
+ * filled at, i.e. no write or truncate happened since.
+ *
+ * Input:
+ *   - file: open file entry, locked by the caller
+ *   - len: length of the destination buffer
+ *   - to_read: where to store the number of bytes to copy on a hit
+ *
+ * Returns true if the whole read can be served from the cache.
+ */
+static bool read_ahead_hit(tfs_t *fs, open_file_entry_t *file, size_t len,
+                           size_t *to_read) {
+    if (file->of_ra_len == 0 ||
+        inode_read_begin(fs, file->of_inumber) != file->of_ra_seq) {
+        return false;
+    }
 
-    // Checks if the given path is a valid pathname
-    if (!valid_pathname(target)) {
-        return -1;
+    size_t offset = file->of_offset;
+    if (offset < file->of_ra_start) {
+        return false;
     }
 
-    // Gets the root directory inode
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    size_t n = file->of_ra_size > offset ? file->of_ra_size - offset : 0;
+    if (n > len) {
+        n = len;
+    }
 
-    // Gets the inumber of the target file
-    int target_inum = tfs_lookup(target, root_dir_inode);
-    if (target_inum == -1) {
+    if (offset + n > file->of_ra_start + file->of_ra_len) {
+        return false;
+    }
+
+    *to_read = n;
+    return true;
+}
+
+ssize_t tfs_read_r(tfs_t *fs, int fhandle, void *buffer, size_t len) {
+
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
         return -1;
     }
 
-    // Gets the inode for the target file
-    inode_t *target_file_inode = inode_get(target_inum);
-    if (target_file_inode == NULL) {
+    mutex_lock(&file->lock);
+
+    // Reads through a buffered handle see its own pending writes
+    if (flush_write_buffer(fs, file) == -1) {
+        mutex_unlock(&file->lock);
         return -1;
     }
 
-    // Checks if the target inode is of a Symbolic link
-    if (target_file_inode->i_node_type != T_LINK) {
+    int inum = file->of_inumber;
+    size_t offset = file->of_offset;
+    size_t to_read;
+
+    read_ahead_update(fs, file, len);
+
+    if (read_ahead_hit(fs, file, len, &to_read)) {
+        // Sequential hit: no inode or data block access needed
+        EVENT_BEGIN(copy);
+        memcpy(buffer, file->of_ra_buf + (offset - file->of_ra_start),
+               to_read);
+        EVENT_END(copy, EVENT_MEMCPY, to_read);
+    } else {
+        // From the open file table entry, we get the inode
+        inode_t const *inode = inode_get(fs, inum);
+        ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+
+        // Snapshot the size, data block and contents without taking the inode
+        // lock (see INODE_LOAD); the read is repeated only if a writer changed
+        // the inode meanwhile
+        size_t size;
+        size_t to_fetch;
+        unsigned int seq;
+        do {
+            seq = inode_read_begin(fs, inum);
+
+            size = INODE_LOAD(inode->i_size);
+            int block_number = INODE_LOAD(inode->i_data_block);
+
+            // Bounds a racing snapshot of a tiny file to its inline contents
+            size_t end = size;
+            if (block_number == -1 && end > INODE_INLINE_SIZE) {
+                end = INODE_INLINE_SIZE;
+            }
+
+            // Determine how many bytes to read, and how many to read ahead
+            size_t available = end > offset ? end - offset : 0;
+            to_read = available > len ? len : available;
+            to_fetch = available > file->of_ra_window ? file->of_ra_window
+                                                      : available;
+            if (to_fetch < to_read) {
+                to_fetch = to_read;
+            }
+
+            if (to_read > 0) {
+                // Tiny files are read straight from the inode
+                char const *block = block_number == -1
+                                        ? inode->i_inline
+                                        : data_block_get(fs, block_number);
+                if (block == NULL) {
+                    mutex_unlock(&file->lock);
+                    return -1; // the block could not be read
+                }
+
+                // Perform the actual read, keeping the window in the cache
+                EVENT_BEGIN(copy);
+                if (file->of_ra_window > 0) {
+                    data_copy_out(file->of_ra_buf, block + offset, to_fetch);
+                    memcpy(buffer, file->of_ra_buf, to_read);
+                } else {
+                    data_copy_out(buffer, block + offset, to_read);
+                }
+                EVENT_END(copy, EVENT_MEMCPY, to_fetch);
+                if (block_number != -1) {
+                    data_block_put(fs, block_number, false);
+                }
+            }
+        } while (inode_read_retry(fs, inum, seq));
 
-        // If it is a hard link, decrement the hard link count
-        if (target_file_inode->hard_links > 1) {
-            target_file_inode->hard_links--;
-        } else { // If the hard link count is 1, delete the file
-            inode_delete(target_inum);
+        if (file->of_ra_window > 0) {
+            file->of_ra_start = offset;
+            file->of_ra_len = to_fetch;
+            file->of_ra_size = size;
+            file->of_ra_seq = seq;
         }
     }
 
-    // Deletes target file from the given directory
-    int res = clear_dir_entry(root_dir_inode, target + 1);
-    if (res < 0) {
-        return -1;
-    }
+    // The offset associated with the file handle is incremented accordingly
+    file->of_offset += to_read;
+    file->of_ra_next = file->of_offset;
 
-    return 0;
+    mutex_unlock(&file->lock);
+
+    return (ssize_t)to_read;
 }
 
-int tfs_copy(char const *path, char const *newpath) {
-    int file_to_read = tfs_open(path, 0);
-    char buffer[BUFFER_SIZE];
-    memset(buffer, 0, sizeof(buffer));
-    int file_to_copy = tfs_open(newpath, TFS_O_CREAT | TFS_O_APPEND);
-    size_t bytes_read;
+int tfs_unlink_r(tfs_t *fs, char const *target) {
+
+    // Checks if the given path is a valid pathname
+    if (!valid_pathname(target)) {
+        return -1;
+    }
 
-    while ((bytes_read = tfs_read(file_to_read, buffer, strlen(buffer)))) {
+    // Gets the root directory inode
+    inode_t *root_dir_inode = inode_get(fs, ROOT_DIR_INUM);
 
-        tfs_write(file_to_copy, buffer, strlen(buffer));
-        memset(buffer, 0, sizeof(buffer));
+    // Deletes target file from the given directory
+    int target_inum;
+    int res = clear_dir_entry(fs, root_dir_inode, target + 1, &target_inum);
+    if (target_inum != -1) {
+        // Drops the target's link, deleting it if it was the last one
+        inode_drop_link(fs, target_inum);
     }
 
-    tfs_close(file_to_read);
-    tfs_close(file_to_copy);
+    return res;
 }
 
-int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
+int tfs_copy_from_external_fs_r(tfs_t *fs, char const *source_path,
+                                char const *dest_path) {
     // (void)source_path;
     // (void)dest_path;
 
@@ -473,7 +936,7 @@ int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
     char buffer[BUFFER_SIZE];
     memset(buffer, 0, sizeof(buffer));
 
-    int f_to_write = tfs_open(dest_path, TFS_O_CREAT | TFS_O_TRUNC);
+    int f_to_write = tfs_open_r(fs, dest_path, TFS_O_CREAT | TFS_O_TRUNC);
 
     // Check if the output file was successfully opened
     if (f_to_write < 0) {
@@ -487,25 +950,517 @@ int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
     while ((bytes_read = fread(buffer, sizeof(char), strlen(buffer) + 1,
                                f_to_read)) != 0) {
         // Write the data from the buffer to the output file using tfs_write()
-        tfs_write(f_to_write, buffer, strlen(buffer));
+        tfs_write_r(fs, f_to_write, buffer, strlen(buffer));
         memset(buffer, 0, sizeof(buffer));
     }
 
     // Close the input and output files
     fclose(f_to_read);
-    tfs_close(f_to_write);
+    tfs_close_r(fs, f_to_write);
+
+    return 0;
+}
+
+int tfs_cache_stats_r(tfs_t *fs, tfs_cache_stats_t *stats) {
+    return data_block_cache_stats(fs, stats);
+}
+
+int tfs_opendir_r(tfs_t *fs, char const *path, tfs_dir_t *dir) {
+    (void)fs;
+    // Only the root directory exists
+    if (path == NULL || dir == NULL || strcmp(path, "/") != 0) {
+        return -1;
+    }
+
+    dir->cursor = 0;
+    return 0;
+}
+
+ssize_t tfs_readdir_batch_r(tfs_t *fs, tfs_dir_t *dir, tfs_dirent_t *entries,
+                            size_t max) {
+    if (dir == NULL || (entries == NULL && max > 0)) {
+        return -1;
+    }
+
+    size_t cursor = (size_t)dir->cursor;
+    ssize_t count = dir_read_batch(fs, inode_get(fs, ROOT_DIR_INUM), &cursor,
+                                   entries, max);
+    if (count != -1) {
+        dir->cursor = cursor;
+    }
+    return count;
+}
+
+/**
+ * Shard holding a path name (FNV-1a hash of the name).
+ */
+static size_t shard_of(char const *name) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 0x100000001b3;
+    }
+    return (size_t)(hash % shard_count);
+}
+
+/**
+ * File handle of the front end for a handle of a shard (-1 stays -1).
+ */
+static int handle_encode(size_t shard, int fhandle) {
+    if (fhandle < 0) {
+        return -1;
+    }
+    return (int)((size_t)fhandle * shard_count + shard);
+}
+
+/**
+ * Inumber reported by the front end for an inumber of a shard (negative
+ * values are kept), unique across shards like file handles.
+ */
+static int inumber_encode(size_t shard, int inumber) {
+    if (inumber < 0) {
+        return inumber;
+    }
+    return (int)((size_t)inumber * shard_count + shard);
+}
+
+/**
+ * Shard of a front end file handle, storing the shard's own handle in local.
+ * Returns NULL if the handle is invalid or tecnicofs is not initialized.
+ */
+static tfs_t *handle_decode(int fhandle, int *local) {
+    if (shards == NULL || fhandle < 0) {
+        return NULL;
+    }
+    *local = (int)((size_t)fhandle / shard_count);
+    return shards[(size_t)fhandle % shard_count];
+}
+
+static int front_open(char const *name, tfs_file_mode_t mode) {
+    if (shards == NULL || name == NULL) {
+        return -1;
+    }
+    if (shard_count == 1) {
+        return tfs_open_r(shards[0], name, mode);
+    }
+
+    // A symbolic link's target may be in another shard, so links are
+    // followed here rather than by the shard
+    char link_target[INODE_INLINE_SIZE];
+    for (int hops = 0;; hops++) {
+        size_t shard = shard_of(name);
+        if (read_link(shards[shard], name, link_target) == -1) {
+            return handle_encode(shard, tfs_open_r(shards[shard], name, mode));
+        }
+
+        if (hops == MAX_SYMLINK_HOPS) {
+            return -1; // too many links, most likely a loop
+        }
+        name = link_target;
+    }
+}
+
+static int front_sym_link(char const *target, char const *link_name) {
+    if (shards == NULL || !valid_pathname(target) ||
+        !valid_pathname(link_name)) {
+        return -1;
+    }
+
+    tfs_t *target_fs = shards[shard_of(target)];
+    if (tfs_lookup(target_fs, target, inode_get(target_fs, ROOT_DIR_INUM)) ==
+        -1) {
+        return -1;
+    }
+
+    return sym_link_create(shards[shard_of(link_name)], target, link_name);
+}
+
+static int front_link(char const *target, char const *link_name) {
+    if (shards == NULL || target == NULL || link_name == NULL) {
+        return -1;
+    }
+
+    // Shards have separate inode tables, so hard links cannot cross them
+    size_t shard = shard_of(target);
+    if (shard_of(link_name) != shard) {
+        return TFS_EXDEV;
+    }
+    return tfs_link_r(shards[shard], target, link_name);
+}
+
+static int front_rename(char const *path, char const *new_path) {
+    if (shards == NULL || path == NULL || new_path == NULL) {
+        return -1;
+    }
+
+    // Shards have separate directories, so renames cannot cross them
+    size_t shard = shard_of(path);
+    if (shard_of(new_path) != shard) {
+        return TFS_EXDEV;
+    }
+    return tfs_rename_r(shards[shard], path, new_path);
+}
+
+static int front_flush(int fhandle) {
+    int local;
+    tfs_t *fs = handle_decode(fhandle, &local);
+    if (fs == NULL) {
+        return -1;
+    }
+    return tfs_flush_r(fs, local);
+}
+
+static int front_close(int fhandle) {
+    int local;
+    tfs_t *fs = handle_decode(fhandle, &local);
+    if (fs == NULL) {
+        return -1;
+    }
+    return tfs_close_r(fs, local);
+}
+
+static ssize_t front_write(int fhandle, void const *buffer,
+                           size_t to_write) {
+    int local;
+    tfs_t *fs = handle_decode(fhandle, &local);
+    if (fs == NULL) {
+        return -1;
+    }
+    return tfs_write_r(fs, local, buffer, to_write);
+}
+
+static ssize_t front_read(int fhandle, void *buffer, size_t len) {
+    int local;
+    tfs_t *fs = handle_decode(fhandle, &local);
+    if (fs == NULL) {
+        return -1;
+    }
+    return tfs_read_r(fs, local, buffer, len);
+}
+
+static int front_unlink(char const *target) {
+    if (shards == NULL || target == NULL) {
+        return -1;
+    }
+    return tfs_unlink_r(shards[shard_of(target)], target);
+}
+
+static int front_copy_from_external_fs(char const *source_path,
+                                       char const *dest_path) {
+    if (shards == NULL || dest_path == NULL) {
+        return -1;
+    }
+    return tfs_copy_from_external_fs_r(shards[shard_of(dest_path)],
+                                       source_path, dest_path);
+}
 
+static int front_stat(char const *path, tfs_stat_t *st) {
+    if (shards == NULL || path == NULL) {
+        return -1;
+    }
+    size_t shard = shard_of(path);
+    if (tfs_stat_r(shards[shard], path, st) == -1) {
+        return -1;
+    }
+    st->inumber = inumber_encode(shard, st->inumber);
     return 0;
 }
 
-void how_many_files_open() {
-    fprintf(stdout, "number of files = %d\n", n_files_open);
+static ssize_t front_stat_many(char const *const paths[], size_t count,
+                               tfs_stat_t out[]) {
+    if (shards == NULL || paths == NULL || out == NULL) {
+        return -1;
+    }
+    if (shard_count == 1) {
+        return tfs_stat_many_r(shards[0], paths, count, out);
+    }
+
+    // Gathers the path names of each shard, looks them up in one pass over
+    // its directory, and scatters the results back
+    char const **shard_paths = malloc(count * sizeof(char const *));
+    size_t *index = malloc(count * sizeof(size_t));
+    tfs_stat_t *shard_out = malloc(count * sizeof(tfs_stat_t));
+    ssize_t found = 0;
+    if (count > 0 && (shard_paths == NULL || index == NULL ||
+                      shard_out == NULL)) {
+        found = -1;
+    }
+
+    for (size_t shard = 0; shard < shard_count && found != -1; shard++) {
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (paths[i] == NULL) {
+                if (shard == 0) {
+                    memset(&out[i], 0, sizeof(out[i]));
+                    out[i].inumber = -1;
+                }
+            } else if (shard_of(paths[i]) == shard) {
+                shard_paths[n] = paths[i];
+                index[n++] = i;
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        ssize_t res = tfs_stat_many_r(shards[shard], shard_paths, n, shard_out);
+        if (res == -1) {
+            found = -1;
+            break;
+        }
+        found += res;
+        for (size_t j = 0; j < n; j++) {
+            out[index[j]] = shard_out[j];
+            out[index[j]].inumber = inumber_encode(shard, shard_out[j].inumber);
+        }
+    }
+
+    free(shard_paths);
+    free(index);
+    free(shard_out);
+    return found;
 }
 
-void how_many_blocks_taken() {
-    fprintf(stdout, "number of blocks taken = %d\n", n_blocks_taken);
+// Front end directory cursors hold the shard in their upper 32 bits, and the
+// cursor within it in the lower ones
+#define DIR_CURSOR_SHARD_SHIFT (32)
+
+static int front_opendir(char const *path, tfs_dir_t *dir) {
+    if (shards == NULL) {
+        return -1;
+    }
+    return tfs_opendir_r(shards[0], path, dir);
+}
+
+static ssize_t front_readdir_batch(tfs_dir_t *dir, tfs_dirent_t *entries,
+                                   size_t max) {
+    if (shards == NULL || dir == NULL) {
+        return -1;
+    }
+
+    size_t shard = (size_t)(dir->cursor >> DIR_CURSOR_SHARD_SHIFT);
+    tfs_dir_t shard_dir = {
+        dir->cursor & (((uint64_t)1 << DIR_CURSOR_SHARD_SHIFT) - 1)};
+    size_t count = 0;
+    while (shard < shard_count && count < max) {
+        ssize_t res = tfs_readdir_batch_r(shards[shard], &shard_dir,
+                                          entries + count, max - count);
+        if (res == -1) {
+            return -1;
+        }
+        for (size_t i = count; i < count + (size_t)res; i++) {
+            entries[i].inumber = inumber_encode(shard, entries[i].inumber);
+        }
+        count += (size_t)res;
+
+        if (count < max) {
+            // This shard's directory is done
+            shard++;
+            shard_dir.cursor = 0;
+        }
+    }
+
+    dir->cursor =
+        ((uint64_t)shard << DIR_CURSOR_SHARD_SHIFT) | shard_dir.cursor;
+    return (ssize_t)count;
+}
+
+/*
+ * Entry points of the front end, which count each call (see tfs_get_stats)
+ * and record it while a trace is being taken (see tfs_trace_start)
+ */
+
+/**
+ * Count a call, which started at stats_clock() time begin, and trace it.
+ */
+static void call_end(tfs_op_t op, uint64_t begin, int arg, uint64_t len,
+                     int64_t result, char const *name, char const *name2) {
+    uint64_t end = stats_clock();
+    uint64_t bytes = 0;
+    if ((op == TFS_OP_WRITE || op == TFS_OP_READ) && result > 0) {
+        bytes = (uint64_t)result;
+    }
+    stats_record(&front_stats, op, end - begin, bytes, result >= 0);
+    if (trace_enabled()) {
+        trace_record(op, begin, end, arg, len, result, name, name2);
+    }
+}
+
+int tfs_open(char const *name, tfs_file_mode_t mode) {
+    uint64_t begin = stats_clock();
+    int res = front_open(name, mode);
+    call_end(TFS_OP_OPEN, begin, (int)mode, 0, res, name, NULL);
+    return res;
 }
 
-void blocks_taken() {
-    fprintf(stdout, "number of blocks taken = %d\n", blocks_taken_taken());
+int tfs_sym_link(char const *target, char const *link_name) {
+    uint64_t begin = stats_clock();
+    int res = front_sym_link(target, link_name);
+    call_end(TFS_OP_SYM_LINK, begin, 0, 0, res, target, link_name);
+    return res;
+}
+
+int tfs_link(char const *target, char const *link_name) {
+    uint64_t begin = stats_clock();
+    int res = front_link(target, link_name);
+    call_end(TFS_OP_LINK, begin, 0, 0, res, target, link_name);
+    return res;
+}
+
+int tfs_flush(int fhandle) {
+    uint64_t begin = stats_clock();
+    int res = front_flush(fhandle);
+    call_end(TFS_OP_FLUSH, begin, fhandle, 0, res, NULL, NULL);
+    return res;
+}
+
+int tfs_close(int fhandle) {
+    uint64_t begin = stats_clock();
+    int res = front_close(fhandle);
+    call_end(TFS_OP_CLOSE, begin, fhandle, 0, res, NULL, NULL);
+    return res;
+}
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+    uint64_t begin = stats_clock();
+    ssize_t res = front_write(fhandle, buffer, to_write);
+    call_end(TFS_OP_WRITE, begin, fhandle, to_write, res, NULL, NULL);
+    return res;
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    uint64_t begin = stats_clock();
+    ssize_t res = front_read(fhandle, buffer, len);
+    call_end(TFS_OP_READ, begin, fhandle, len, res, NULL, NULL);
+    return res;
+}
+
+int tfs_unlink(char const *target) {
+    uint64_t begin = stats_clock();
+    int res = front_unlink(target);
+    call_end(TFS_OP_UNLINK, begin, 0, 0, res, target, NULL);
+    return res;
+}
+
+int tfs_rename(char const *path, char const *new_path) {
+    uint64_t begin = stats_clock();
+    int res = front_rename(path, new_path);
+    call_end(TFS_OP_RENAME, begin, 0, 0, res, path, new_path);
+    return res;
+}
+
+int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
+    // The replay of a trace copies a file of the same size
+    uint64_t len = 0;
+    struct stat source;
+    if (trace_enabled() && source_path != NULL &&
+        stat(source_path, &source) == 0) {
+        len = (uint64_t)source.st_size;
+    }
+
+    uint64_t begin = stats_clock();
+    int res = front_copy_from_external_fs(source_path, dest_path);
+    call_end(TFS_OP_COPY_FROM_EXTERNAL, begin, 0, len, res, source_path,
+             dest_path);
+    return res;
+}
+
+int tfs_opendir(char const *path, tfs_dir_t *dir) {
+    uint64_t begin = stats_clock();
+    int res = front_opendir(path, dir);
+    call_end(TFS_OP_OPENDIR, begin, 0, 0, res, path, NULL);
+    return res;
+}
+
+ssize_t tfs_readdir_batch(tfs_dir_t *dir, tfs_dirent_t *entries, size_t max) {
+    uint64_t begin = stats_clock();
+    ssize_t res = front_readdir_batch(dir, entries, max);
+    call_end(TFS_OP_READDIR, begin, 0, max, res, NULL, NULL);
+    return res;
+}
+
+int tfs_stat(char const *path, tfs_stat_t *st) {
+    uint64_t begin = stats_clock();
+    int res = front_stat(path, st);
+    call_end(TFS_OP_STAT, begin, 0, 0, res, path, NULL);
+    return res;
+}
+
+ssize_t tfs_stat_many(char const *const paths[], size_t count,
+                      tfs_stat_t out[]) {
+    uint64_t begin = stats_clock();
+    ssize_t res = front_stat_many(paths, count, out);
+    // The trace has room for two path names
+    char const *name = paths != NULL && count > 0 ? paths[0] : NULL;
+    char const *name2 = paths != NULL && count > 1 ? paths[1] : NULL;
+    call_end(TFS_OP_STAT_MANY, begin, 0, count, res, name, name2);
+    return res;
+}
+
+int tfs_trace_start(char const *path) {
+    if (shards == NULL) {
+        return -1;
+    }
+    return trace_start(path, &front_params);
+}
+
+int tfs_trace_stop() { return trace_stop(); }
+
+int tfs_cache_stats(tfs_cache_stats_t *stats) {
+    if (shards == NULL) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < shard_count; i++) {
+        tfs_cache_stats_t shard_stats;
+        if (tfs_cache_stats_r(shards[i], &shard_stats) != 0) {
+            return -1;
+        }
+        stats->hits += shard_stats.hits;
+        stats->misses += shard_stats.misses;
+        stats->evictions += shard_stats.evictions;
+        stats->writebacks += shard_stats.writebacks;
+    }
+    return 0;
+}
+
+int tfs_get_stats_r(tfs_t *fs, tfs_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    tfs_params const *params = state_params(fs);
+    stats->inodes = params->max_inode_count;
+    stats->free_inodes = stats->inodes - (size_t)state_inodes_taken(fs);
+    stats->blocks = params->max_block_count;
+    stats->free_blocks = stats->blocks - (size_t)state_blocks_taken(fs);
+    stats->handles = params->max_open_files_count;
+    stats->free_handles = stats->handles - (size_t)state_files_open(fs);
+    if (data_block_cache_stats(fs, &stats->cache) != 0) {
+        memset(&stats->cache, 0, sizeof(stats->cache));
+    }
+    return 0;
+}
+
+int tfs_get_stats(tfs_stats_t *stats) {
+    if (shards == NULL) {
+        return -1;
+    }
+
+    tfs_stats_t shard_stats;
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < shard_count; i++) {
+        tfs_get_stats_r(shards[i], &shard_stats);
+        stats->inodes += shard_stats.inodes;
+        stats->free_inodes += shard_stats.free_inodes;
+        stats->blocks += shard_stats.blocks;
+        stats->free_blocks += shard_stats.free_blocks;
+        stats->handles += shard_stats.handles;
+        stats->free_handles += shard_stats.free_handles;
+        stats->cache.hits += shard_stats.cache.hits;
+        stats->cache.misses += shard_stats.cache.misses;
+        stats->cache.evictions += shard_stats.cache.evictions;
+        stats->cache.writebacks += shard_stats.cache.writebacks;
+    }
+
+    stats_read(&front_stats, stats->ops);
+    return 0;
 }
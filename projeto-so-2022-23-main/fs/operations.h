@@ -2,6 +2,8 @@
 #define OPERATIONS_H
 
 #include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 /**
@@ -13,15 +15,121 @@ typedef struct {
     size_t max_open_files_count;
 
     size_t block_size;
+
+    // Optional image file holding the data blocks (NULL keeps them all in
+    // memory); only block_cache_count of them are then kept in memory (0 for
+    // DEFAULT_BLOCK_CACHE_COUNT)
+    char const *block_image_path;
+    size_t block_cache_count;
+
+    // Optional memory pool (in bytes) holding the data blocks compressed,
+    // instead of an image file; only block_cache_count of them are then kept
+    // uncompressed
+    size_t compressed_pool_size;
+
+    // Share the data block of files with identical contents (copy-on-write)
+    bool dedup_blocks;
+
+    // Keep files of up to INODE_INLINE_SIZE bytes in their inode, with no
+    // data block
+    bool inline_small_files;
+
+    // Back the data blocks and inode table with 2 MB huge pages (each page
+    // then lives on the NUMA node of the thread that first writes to it)
+    bool huge_pages;
+
+    // Spread the path names across this many independent instances (by hash
+    // of the name), each with its own tables and locks; only used by tfs_init.
+    // Hard links and renames cannot cross shards (see TFS_EXDEV), and the
+    // inumbers that tfs_stat and tfs_readdir_batch report are inumber *
+    // shard_count + shard, so that they are unique across shards
+    size_t shard_count;
 } tfs_params;
 
+/*
+ * Returned by tfs_link and tfs_rename when both names fall in different
+ * shards (see tfs_params), which have separate inode tables and directories,
+ * like EXDEV across file systems.
+ */
+#define TFS_EXDEV (-2)
+
+/**
+ * Block cache counters, when the data blocks are kept in an image file.
+ */
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t writebacks;
+} tfs_cache_stats_t;
+
+/**
+ * Functions whose calls are counted (see tfs_get_stats) and traced (see
+ * tfs_trace_start).
+ */
+typedef enum {
+    TFS_OP_OPEN,
+    TFS_OP_SYM_LINK,
+    TFS_OP_LINK,
+    TFS_OP_CLOSE,
+    TFS_OP_FLUSH,
+    TFS_OP_WRITE,
+    TFS_OP_READ,
+    TFS_OP_UNLINK,
+    TFS_OP_COPY_FROM_EXTERNAL,
+    TFS_OP_OPENDIR,
+    TFS_OP_READDIR, // tfs_readdir_batch
+    TFS_OP_STAT,
+    TFS_OP_STAT_MANY,
+    TFS_OP_RENAME,
+    TFS_OP_COUNT,
+} tfs_op_t;
+
+#define TFS_LATENCY_BUCKETS (32)
+
+/**
+ * Counters of the calls to one function.
+ */
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytes; // written or read
+    // Calls that took [2^i, 2^(i+1)) nanoseconds (the last bucket also counts
+    // longer ones)
+    uint64_t latency[TFS_LATENCY_BUCKETS];
+} tfs_op_stats_t;
+
+/**
+ * Runtime metrics of TécnicoFS.
+ */
+typedef struct {
+    tfs_op_stats_t ops[TFS_OP_COUNT];
+
+    size_t inodes;
+    size_t free_inodes;
+    size_t blocks;
+    size_t free_blocks;
+    size_t handles;
+    size_t free_handles;
+
+    // All zero if the data blocks are not kept in an image file or pool
+    tfs_cache_stats_t cache;
+} tfs_stats_t;
+
+/**
+ * A TécnicoFS instance. Instances share no state, so threads working on
+ * different instances never contend.
+ */
+typedef struct tfs tfs_t;
+
 /**
  * Return a sane default set of parameters for tecnicofs.
  */
 tfs_params tfs_default_params();
 
 /**
- * Initialize tecnicofs, optionally with a given configuration.
+ * Initialize tecnicofs, optionally with a given configuration. With more than
+ * one shard (see tfs_params), file handles encode the shard of their file.
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_init(tfs_params const *params);
@@ -32,13 +140,28 @@ int tfs_init(tfs_params const *params);
  */
 int tfs_destroy();
 
+/**
+ * Create a new, independent tecnicofs instance, optionally with a given
+ * configuration. The functions below that take no instance operate on the one
+ * created by tfs_init; their tfs_*_r variants operate on a given instance.
+ * Returns the instance if successful, NULL otherwise.
+ */
+tfs_t *tfs_create(tfs_params const *params);
+
+/**
+ * Destroy a tecnicofs instance created with tfs_create.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_release(tfs_t *fs);
+
 /**
  * TécnicoFS file opening modes.
  */
 typedef enum {
-    TFS_O_CREAT = 0b001,
-    TFS_O_TRUNC = 0b010,
-    TFS_O_APPEND = 0b100,
+    TFS_O_CREAT = 0b0001,
+    TFS_O_TRUNC = 0b0010,
+    TFS_O_APPEND = 0b0100,
+    TFS_O_BUFFERED = 0b1000,
 } tfs_file_mode_t;
 
 /**
@@ -50,6 +173,10 @@ typedef enum {
  *     - append mode (TFS_O_APPEND)
  *     - truncate file contents (TFS_O_TRUNC)
  *     - create file if it does not exist (TFS_O_CREAT)
+ *     - buffer writes in the file handle until a whole block is filled, the
+ *       file is closed or tfs_flush is called (TFS_O_BUFFERED)
+ *
+ * Symbolic links are followed, up to MAX_SYMLINK_HOPS of them.
  *
  * Returns file handle of the opened file if successful, -1 otherwise.
  */
@@ -59,7 +186,8 @@ int tfs_open(char const *name, tfs_file_mode_t mode);
  * Create a symbolic link to a file.
  *
  * Input:
- *   - target: absolute path name of the link target
+ *   - target: absolute path name of the link target (shorter than
+ *     INODE_INLINE_SIZE)
  *   - link_name: absolute path name of the link to be created
  *
  * Returns 0 if successful, -1 otherwise.
@@ -73,7 +201,8 @@ int tfs_sym_link(char const *target, char const *link_name);
  *   - target_file: absolute path name of the link target
  *   - link_name: absolute path name of the link to be created
  *
- * Returns 0 if successful, -1 otherwise.
+ * Returns 0 if successful, TFS_EXDEV if both names fall in different shards
+ * (see tfs_params), -1 otherwise.
  */
 int tfs_link(char const *target_file, char const *link_name);
 
@@ -87,6 +216,17 @@ int tfs_link(char const *target_file, char const *link_name);
  */
 int tfs_close(int fhandle);
 
+/**
+ * Write the buffered contents of a file opened with TFS_O_BUFFERED to the file.
+ * Does nothing for unbuffered file handles.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_flush(int fhandle);
+
 /**
  * Write to an open file, starting at the current offset.
  *
@@ -96,7 +236,10 @@ int tfs_close(int fhandle);
  *   - len: length of the buffer contents (in bytes)
  *
  * Returns the number of bytes that were written (can be lower than 'len' if the
- * maximum file size is exceeded), or -1 in case of error.
+ * maximum file size is exceeded), or -1 in case of error. For buffered file
+ * handles, errors allocating space may only be reported when the buffer is
+ * flushed; a write that fails that way leaves the offset unchanged, and the
+ * contents buffered before it pending until the next successful flush.
  */
 ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
 
@@ -124,6 +267,120 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_unlink(char const *target);
 
+/**
+ * Types of files.
+ */
+typedef enum {
+    TFS_T_FILE,
+    TFS_T_DIRECTORY,
+    TFS_T_SYMLINK,
+} tfs_file_type_t;
+
+/**
+ * Directory entry, as listed by tfs_readdir_batch.
+ */
+typedef struct {
+    char name[MAX_FILE_NAME]; // without the leading '/'
+    int inumber;              // unique across shards (see tfs_params)
+    tfs_file_type_t type;
+    size_t size; // in bytes (for symbolic links, of their target)
+} tfs_dirent_t;
+
+/**
+ * Position of a directory listing (see tfs_opendir).
+ */
+typedef struct {
+    // Where the next batch starts; entries never move, so a listing can be
+    // resumed from a saved cursor
+    uint64_t cursor;
+} tfs_dir_t;
+
+/**
+ * Start listing a directory (only the root directory, "/", exists).
+ *
+ * Input:
+ *   - path: absolute path name of the directory
+ *   - dir: listing position to initialize
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_opendir(char const *path, tfs_dir_t *dir);
+
+/**
+ * List the next entries of a directory, in a fixed order.
+ *
+ * Each batch costs one pass over the directory entries it covers, which only
+ * announces itself to writers, like lookups (with several shards, one per
+ * shard it covers). Entries that exist for the whole listing are listed
+ * exactly once, however many files are created or deleted meanwhile; those
+ * created or deleted during the listing may or may not be.
+ *
+ * Input:
+ *   - dir: listing position (from tfs_opendir), advanced past the batch
+ *   - entries: where to store the entries
+ *   - max: how many entries fit in entries
+ *
+ * Returns the number of entries stored (0 at the end of the directory), or -1
+ * in case of error.
+ */
+ssize_t tfs_readdir_batch(tfs_dir_t *dir, tfs_dirent_t *entries, size_t max);
+
+/**
+ * File metadata, as obtained by tfs_stat.
+ */
+typedef struct {
+    int inumber; // unique across shards (see tfs_params), -1 if not found
+    tfs_file_type_t type;
+    size_t size;   // in bytes (for symbolic links, of their target)
+    int links;     // hard links to the file
+    size_t blocks; // data blocks in use (none for empty or inline files)
+} tfs_stat_t;
+
+/**
+ * Obtain the metadata of a file, without opening it. Symbolic links are not
+ * followed.
+ *
+ * Input:
+ *   - path: absolute path name of the file
+ *   - st: where to store the metadata
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stat(char const *path, tfs_stat_t *st);
+
+/**
+ * Obtain the metadata of many files at once, resolving all the names with one
+ * pass over the directory (with several shards, one per shard), like
+ * tfs_readdir_batch.
+ *
+ * Input:
+ *   - paths: absolute path names of the files
+ *   - count: number of path names
+ *   - out: where to store the metadata of each file (with inumber -1 for
+ *     those that don't exist or whose path name is invalid)
+ *
+ * Returns the number of files found, or -1 in case of error.
+ */
+ssize_t tfs_stat_many(char const *const paths[], size_t count,
+                      tfs_stat_t out[]);
+
+/**
+ * Rename a file (or a link), replacing the file new_path referred to, if any,
+ * as if it was unlinked. Lookups of new_path find either file at every moment,
+ * so a file written under a temporary name and renamed over the one it
+ * replaces is never seen partially written, nor missing. File handles open on
+ * the renamed file remain valid.
+ *
+ * Input:
+ *   - path: absolute path name of the file
+ *   - new_path: its new absolute path name
+ *
+ * Returns 0 if successful (including when both names already refer to the
+ * same file, or are the same name, which is left alone), TFS_EXDEV if both
+ * names fall in different shards (see tfs_params), -1 otherwise.
+ */
+int tfs_rename(char const *path, char const *new_path);
+
 /**
  * Copy the contents of a file that exists in the OS' file system tree
  * (outside TécnicoFS) to the TécnicoFS.
@@ -137,8 +394,75 @@ int tfs_unlink(char const *target);
  */
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
 
-void how_many_files_open();
-void how_many_blocks_taken();
-void blocks_taken();
+/**
+ * Obtain the block cache counters.
+ *
+ * Input:
+ *   - stats: where to store the counters
+ *
+ * Returns 0 if successful, -1 if the data blocks are not kept in an image file.
+ */
+int tfs_cache_stats(tfs_cache_stats_t *stats);
+
+/**
+ * Obtain the runtime metrics. Counting calls costs each of them a few
+ * relaxed atomic increments on counters kept per thread (threads rarely share
+ * them), and reading them adds up those of every thread, so that the metrics
+ * can be read often.
+ *
+ * Input:
+ *   - stats: where to store the metrics
+ *
+ * Returns 0 if successful, -1 if tecnicofs is not initialized.
+ */
+int tfs_get_stats(tfs_stats_t *stats);
+
+/**
+ * Record the calls to the functions above (on the instance created by
+ * tfs_init) in a trace file, to be replayed by bench/tfs_replay. The trace
+ * holds the path names and sizes of the calls, not the data written. Setting
+ * the TFS_TRACE environment variable to a path traces from tfs_init to
+ * tfs_destroy.
+ *
+ * Input:
+ *   - path: path name of the trace file (in the OS' file system)
+ *
+ * Returns 0 if successful, -1 otherwise (including when already tracing).
+ */
+int tfs_trace_start(char const *path);
+
+/**
+ * Stop tracing, closing the trace file.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_trace_stop();
+
+/*
+ * Variants of the functions above operating on a given instance
+ */
+int tfs_open_r(tfs_t *fs, char const *name, tfs_file_mode_t mode);
+int tfs_sym_link_r(tfs_t *fs, char const *target, char const *link_name);
+int tfs_link_r(tfs_t *fs, char const *target_file, char const *link_name);
+int tfs_close_r(tfs_t *fs, int fhandle);
+int tfs_flush_r(tfs_t *fs, int fhandle);
+ssize_t tfs_write_r(tfs_t *fs, int fhandle, void const *buffer, size_t len);
+ssize_t tfs_read_r(tfs_t *fs, int fhandle, void *buffer, size_t len);
+int tfs_unlink_r(tfs_t *fs, char const *target);
+int tfs_rename_r(tfs_t *fs, char const *path, char const *new_path);
+int tfs_copy_from_external_fs_r(tfs_t *fs, char const *source_path,
+                                char const *dest_path);
+int tfs_cache_stats_r(tfs_t *fs, tfs_cache_stats_t *stats);
+int tfs_opendir_r(tfs_t *fs, char const *path, tfs_dir_t *dir);
+ssize_t tfs_readdir_batch_r(tfs_t *fs, tfs_dir_t *dir, tfs_dirent_t *entries,
+                            size_t max);
+int tfs_stat_r(tfs_t *fs, char const *path, tfs_stat_t *st);
+ssize_t tfs_stat_many_r(tfs_t *fs, char const *const paths[], size_t count,
+                        tfs_stat_t out[]);
+
+/**
+ * Obtain the metrics of an instance, without call counters (which only count
+ * the calls to the functions that take no instance).
+ */
+int tfs_get_stats_r(tfs_t *fs, tfs_stats_t *stats);
 
 #endif // OPERATIONS_H
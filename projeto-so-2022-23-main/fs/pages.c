@@ -0,0 +1,77 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, MAP_HUGETLB and madvise()
+
+#include "pages.h"
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+ * Large regions backed by 2 MB huge pages, to cut TLB misses when accessing
+ * them at random.
+ *
+ * Reserved huge pages (MAP_HUGETLB) are used when the system has them;
+ * otherwise the region is aligned to 2 MB and transparent huge pages are
+ * requested for it (MADV_HUGEPAGE).
+ *
+ * Regions are never touched here: the kernel places each page on the NUMA
+ * node of the thread that first writes to it, so blocks end up local to the
+ * threads that fill them.
+ */
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+static inline size_t huge_page_round(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+/**
+ * Allocate a region backed by huge pages where possible.
+ *
+ * Input:
+ *   - size: size of the region in bytes
+ *
+ * Returns a pointer to the (zeroed) region if successful, NULL otherwise.
+ */
+void *pages_alloc(size_t size) {
+    size = huge_page_round(size);
+
+#ifdef MAP_HUGETLB
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region != MAP_FAILED) {
+        return region;
+    }
+#endif
+
+    // Over-allocates so that a 2 MB aligned region can be cut from it
+    char *mapping = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    char *aligned = (char *)huge_page_round((uintptr_t)mapping);
+    size_t head = (size_t)(aligned - mapping);
+    if (head > 0) {
+        munmap(mapping, head);
+    }
+    munmap(aligned + size, HUGE_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE); // only a hint
+#endif
+
+    return aligned;
+}
+
+/**
+ * Free a region allocated with pages_alloc().
+ *
+ * Input:
+ *   - region: the region (may be NULL)
+ *   - size: the size it was allocated with
+ */
+void pages_free(void *region, size_t size) {
+    if (region != NULL) {
+        munmap(region, huge_page_round(size));
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <stddef.h>
+
+void *pages_alloc(size_t size);
+void pages_free(void *region, size_t size);
+
+#endif // PAGES_H
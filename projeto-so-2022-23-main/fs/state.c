@@ -1,61 +1,131 @@
 #include "state.h"
 #include "betterassert.h"
+#include "cache.h"
+#include "compress.h"
+#include "events.h"
+#include "image.h"
+#include "pages.h"
+#include <assert.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-/*
- * Persistent FS state
- * (in reality, it should be maintained in secondary memory;
- * for simplicity, this project maintains it in primary memory).
- */
-static tfs_params fs_params;
+// Per-inode lock and sequence counter, one cache line each (like inode_t)
+typedef struct {
+    alignas(CACHE_LINE_SIZE) pthread_rwlock_t lock;
+    // Versions the inode's size, data block and contents (seqlock)
+    atomic_uint seq;
+} inode_sync_t;
 
-// Inode table
-static inode_t *inode_table;
-static allocation_state_t *freeinode_ts;
-
-// Data blocks
-static char *fs_data; // # blocks * block size
-static allocation_state_t *free_blocks;
+static_assert(offsetof(inode_t, i_inline) < CACHE_LINE_SIZE,
+              "inode_t: the fields before i_inline must share a cache line");
+static_assert(sizeof(inode_t) == 2 * CACHE_LINE_SIZE,
+              "inode_t: INODE_INLINE_SIZE must fill its cache lines");
 
 /*
- * Volatile FS state
+ * State of a TécnicoFS instance; instances share nothing.
  */
-static open_file_entry_t *open_file_table;
-static allocation_state_t *free_open_file_entries;
-
-// Read-write locks
-static pthread_rwlock_t *inode_table_locks;
-static pthread_rwlock_t freeinode_ts_locks;
-static pthread_rwlock_t datablocks_lock;
-static pthread_rwlock_t free_open_file_entries_lock;
-
-static pthread_mutex_t *open_file_table_locks;
+struct tfs {
+    /*
+     * Persistent FS state
+     * (in reality, it should be maintained in secondary memory;
+     * for simplicity, this project maintains it in primary memory).
+     */
+    tfs_params params;
+
+    // Inode table
+    inode_t *inode_table;
+    allocation_state_t *freeinode_ts;
+    atomic_int n_inodes_taken; // written under freeinode_ts_locks
+
+    // Data blocks
+    char *fs_data; // # blocks * block size, NULL if using the block cache
+    bool fs_data_cached;
+    atomic_uint *block_refs; // references to each block, 0 if free
+    atomic_int n_blocks_taken; // written under datablocks_lock
+
+    // Block cache and its backing store (image file or compressed pool)
+    cache_t *cache;
+    image_t *image;
+    compress_store_t *pool;
+
+    // Deduplication index of file blocks, by hash of their contents
+    uint64_t *block_hashes;
+    bool *block_indexed;
+    int *dedup_buckets; // first block of each bucket, -1 if empty
+    int *dedup_next;    // next block in the same bucket, -1 if last
+
+    /*
+     * Volatile FS state
+     */
+    open_file_entry_t *open_file_table;
+    char *open_file_ra_data; // read-ahead cache, # open files * block size
+    char *open_file_wb_data; // write-back buffers, # open files * block size
+    allocation_state_t *free_open_file_entries;
+    atomic_int n_files_open; // written under free_open_file_entries_lock
+
+    // Read-write locks
+    inode_sync_t *inode_table_sync;
+    pthread_rwlock_t freeinode_ts_locks;
+    pthread_rwlock_t datablocks_lock;
+    pthread_rwlock_t free_open_file_entries_lock;
+    pthread_rwlock_t dedup_locks[DEDUP_LOCK_STRIPES];
+
+    // Epoch-based reclamation of directory entries (lookups take no locks)
+    atomic_ulong dir_epoch;
+    atomic_long dir_readers[2];
+    pthread_mutex_t dir_reclaim_lock;
+};
 
 // Convenience macros
-#define INODE_TABLE_SIZE (fs_params.max_inode_count)
-#define DATA_BLOCKS (fs_params.max_block_count)
-#define MAX_OPEN_FILES (fs_params.max_open_files_count)
-#define BLOCK_SIZE (fs_params.block_size)
+#define INODE_TABLE_SIZE (fs->params.max_inode_count)
+#define DATA_BLOCKS (fs->params.max_block_count)
+#define MAX_OPEN_FILES (fs->params.max_open_files_count)
+#define BLOCK_SIZE (fs->params.block_size)
 #define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
 
-static inline bool valid_inumber(int inumber) {
+// Directory entry states (d_inumber values other than a valid inumber)
+#define FREE_DIR_ENTRY (-1)
+#define RETIRED_DIR_ENTRY (-2)
+
+static inline bool valid_inumber(tfs_t *fs, int inumber) {
     return inumber >= 0 && inumber < INODE_TABLE_SIZE;
 }
 
-static inline bool valid_block_number(int block_number) {
+static inline bool valid_block_number(tfs_t *fs, int block_number) {
     return block_number >= 0 && block_number < DATA_BLOCKS;
 }
 
-static inline bool valid_file_handle(int file_handle) {
+static inline bool valid_file_handle(tfs_t *fs, int file_handle) {
     return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
 }
 
-size_t state_block_size(void) { return BLOCK_SIZE; }
+size_t state_block_size(tfs_t *fs) { return BLOCK_SIZE; }
+
+tfs_params const *state_params(tfs_t *fs) { return &fs->params; }
+
+/**
+ * Number of inodes taken in the inode table.
+ */
+int state_inodes_taken(tfs_t *fs) { return atomic_load(&fs->n_inodes_taken); }
+
+/**
+ * Number of data blocks allocated with data_block_alloc().
+ */
+int state_blocks_taken(tfs_t *fs) { return atomic_load(&fs->n_blocks_taken); }
+
+/**
+ * Number of entries taken in the open file table.
+ */
+int state_files_open(tfs_t *fs) { return atomic_load(&fs->n_files_open); }
 
 /**
  * Do nothing, while preventing the compiler from performing any optimizations.
@@ -83,9 +153,71 @@ static void touch_all_memory(void) { __asm volatile("" : : : "memory"); }
  * latencies as if such data structures were really stored in secondary memory.
  */
 static void insert_delay(void) {
+    EVENT_BEGIN(begin);
     for (int i = 0; i < DELAY; i++) {
         touch_all_memory();
     }
+    EVENT_END(begin, EVENT_DELAY, 0);
+}
+
+/**
+ * Allocate one of the large FS regions (data blocks, inode table), cache-line
+ * aligned, and backed by huge pages if requested.
+ *
+ * Returns a pointer to the region if successful, NULL otherwise.
+ */
+static void *table_alloc(tfs_t *fs, size_t size) {
+    if (fs->params.huge_pages) {
+        return pages_alloc(size);
+    }
+    return aligned_alloc(CACHE_LINE_SIZE, size);
+}
+
+/**
+ * Free a region allocated with table_alloc().
+ */
+static void table_free(tfs_t *fs, void *table, size_t size) {
+    if (fs->params.huge_pages) {
+        pages_free(table, size);
+    } else {
+        free(table);
+    }
+}
+
+/**
+ * Free the memory of an FS state, closing its block cache and backing store.
+ *
+ * Returns 0 if successful, -1 if writing the cached blocks back failed.
+ */
+static int state_free(tfs_t *fs) {
+    int res = 0;
+    if (fs->cache != NULL) {
+        res = cache_destroy(fs->cache);
+    }
+    if (fs->image != NULL && image_close(fs->image) != 0) {
+        res = -1;
+    }
+    if (fs->pool != NULL) {
+        compress_store_destroy(fs->pool);
+    }
+
+    table_free(fs, fs->inode_table, INODE_TABLE_SIZE * sizeof(inode_t));
+    table_free(fs, fs->inode_table_sync,
+               INODE_TABLE_SIZE * sizeof(inode_sync_t));
+    free(fs->freeinode_ts);
+    table_free(fs, fs->fs_data, DATA_BLOCKS * BLOCK_SIZE);
+    free(fs->block_refs);
+    free(fs->block_hashes);
+    free(fs->block_indexed);
+    free(fs->dedup_buckets);
+    free(fs->dedup_next);
+    free(fs->open_file_table);
+    free(fs->open_file_ra_data);
+    free(fs->open_file_wb_data);
+    free(fs->free_open_file_entries);
+
+    free(fs);
+    return res;
 }
 
 /**
@@ -94,56 +226,117 @@ static void insert_delay(void) {
  * Input:
  *   - params: TécnicoFS parameters
  *
- * Returns 0 if successful, -1 otherwise.
+ * Returns the new FS state if successful, NULL otherwise.
  *
  * Possible errors:
- *   - TFS already initialized.
+ *   - Both an image file and a compressed pool requested.
  *   - malloc failure when allocating TFS structures.
  */
-int state_init(tfs_params params) {
-    n_blocks_taken = 0;
-    fs_params = params;
+tfs_t *state_init(tfs_params params) {
+    if (params.block_image_path != NULL && params.compressed_pool_size > 0) {
+        return NULL; // only one backing store for the block cache
+    }
 
-    if (inode_table != NULL) {
-        return -1; // already initialized
+    tfs_t *fs = calloc(1, sizeof(tfs_t));
+    if (fs == NULL) {
+        return NULL;
     }
 
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
-    inode_table_locks = malloc(INODE_TABLE_SIZE * sizeof(pthread_rwlock_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    open_file_table_locks = malloc(MAX_OPEN_FILES * sizeof(pthread_mutex_t));
-    free_open_file_entries =
+    fs->params = params;
+
+    fs->inode_table = table_alloc(fs, INODE_TABLE_SIZE * sizeof(inode_t));
+    fs->inode_table_sync =
+        table_alloc(fs, INODE_TABLE_SIZE * sizeof(inode_sync_t));
+    fs->freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
+    fs->fs_data_cached =
+        params.block_image_path != NULL || params.compressed_pool_size > 0;
+    size_t cache_count = params.block_cache_count > 0
+                             ? params.block_cache_count
+                             : DEFAULT_BLOCK_CACHE_COUNT;
+    if (params.block_image_path != NULL) {
+        fs->image =
+            image_open(params.block_image_path, DATA_BLOCKS, BLOCK_SIZE);
+        if (fs->image != NULL) {
+            fs->cache = cache_init(&image_backend, fs->image, DATA_BLOCKS,
+                                   BLOCK_SIZE, cache_count);
+        }
+    } else if (params.compressed_pool_size > 0) {
+        fs->pool = compress_store_init(DATA_BLOCKS, BLOCK_SIZE,
+                                       params.compressed_pool_size);
+        if (fs->pool != NULL) {
+            fs->cache = cache_init(&compress_backend, fs->pool, DATA_BLOCKS,
+                                   BLOCK_SIZE, cache_count);
+        }
+    } else {
+        fs->fs_data = table_alloc(fs, DATA_BLOCKS * BLOCK_SIZE);
+    }
+    fs->block_refs = malloc(DATA_BLOCKS * sizeof(atomic_uint));
+    if (params.dedup_blocks) {
+        fs->block_hashes = malloc(DATA_BLOCKS * sizeof(uint64_t));
+        fs->block_indexed = malloc(DATA_BLOCKS * sizeof(bool));
+        fs->dedup_buckets = malloc(DATA_BLOCKS * sizeof(int));
+        fs->dedup_next = malloc(DATA_BLOCKS * sizeof(int));
+    }
+    fs->open_file_table = aligned_alloc(
+        CACHE_LINE_SIZE, MAX_OPEN_FILES * sizeof(open_file_entry_t));
+    fs->open_file_ra_data = malloc(MAX_OPEN_FILES * BLOCK_SIZE);
+    fs->open_file_wb_data = malloc(MAX_OPEN_FILES * BLOCK_SIZE);
+    fs->free_open_file_entries =
         malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
 
-    if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !open_file_table || !free_open_file_entries) {
-        return -1; // allocation failed
+    if (!fs->inode_table || !fs->inode_table_sync || !fs->freeinode_ts ||
+        (!fs->fs_data && !fs->cache) || !fs->block_refs ||
+        (params.dedup_blocks && (!fs->block_hashes || !fs->block_indexed ||
+                                 !fs->dedup_buckets || !fs->dedup_next)) ||
+        !fs->open_file_table || !fs->open_file_ra_data ||
+        !fs->open_file_wb_data || !fs->free_open_file_entries) {
+        state_free(fs);
+        return NULL; // allocation failed
     }
 
     for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
-        rw_init(&inode_table_locks[i], NULL);
+        fs->freeinode_ts[i] = FREE;
+        rw_init(&fs->inode_table_sync[i].lock, NULL);
+        atomic_init(&fs->inode_table_sync[i].seq, 0);
     }
 
-    rw_init(&freeinode_ts_locks, NULL);
+    rw_init(&fs->freeinode_ts_locks, NULL);
 
     for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
+        atomic_init(&fs->block_refs[i], 0);
     }
 
-    rw_init(&datablocks_lock, NULL);
+    rw_init(&fs->datablocks_lock, NULL);
+
+    if (params.dedup_blocks) {
+        for (size_t i = 0; i < DATA_BLOCKS; i++) {
+            fs->block_indexed[i] = false;
+            fs->dedup_buckets[i] = -1;
+            fs->dedup_next[i] = -1;
+        }
+        for (size_t i = 0; i < DEDUP_LOCK_STRIPES; i++) {
+            rw_init(&fs->dedup_locks[i], NULL);
+        }
+    }
 
     for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        pthread_mutex_init(&open_file_table_locks[i], NULL);
-        free_open_file_entries[i] = FREE;
+        open_file_entry_t *entry = &fs->open_file_table[i];
+        entry->of_ra_buf = &fs->open_file_ra_data[i * BLOCK_SIZE];
+        entry->of_wb_buf = &fs->open_file_wb_data[i * BLOCK_SIZE];
+        fs->free_open_file_entries[i] = FREE;
     }
 
-    rw_init(&free_open_file_entries_lock, NULL);
+    rw_init(&fs->free_open_file_entries_lock, NULL);
 
-    return 0;
+    atomic_init(&fs->dir_epoch, 0);
+    atomic_init(&fs->dir_readers[0], 0);
+    atomic_init(&fs->dir_readers[1], 0);
+    if (pthread_mutex_init(&fs->dir_reclaim_lock, NULL) != 0) {
+        perror("pthread_mutex_init");
+        exit(EXIT_FAILURE);
+    }
+
+    return fs;
 }
 
 /**
@@ -151,35 +344,29 @@ int state_init(tfs_params params) {
  *
  * Returns 0 if succesful, -1 otherwise.
  */
-int state_destroy(void) {
-    free(inode_table);
-    free(freeinode_ts);
-    free(fs_data);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
+int state_destroy(tfs_t *fs) {
+    rw_destroy(&fs->datablocks_lock);
 
-    rw_destroy(&datablocks_lock);
+    if (fs->params.dedup_blocks) {
+        for (size_t i = 0; i < DEDUP_LOCK_STRIPES; i++) {
+            rw_destroy(&fs->dedup_locks[i]);
+        }
+    }
 
-    rw_destroy(&freeinode_ts_locks);
+    rw_destroy(&fs->freeinode_ts_locks);
 
-    rw_destroy(&free_open_file_entries_lock);
+    rw_destroy(&fs->free_open_file_entries_lock);
 
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        rw_destroy(&inode_table_locks[i]);
+    if (pthread_mutex_destroy(&fs->dir_reclaim_lock) != 0) {
+        perror("pthread_mutex_destroy");
+        exit(EXIT_FAILURE);
     }
 
-    free(inode_table_locks);
-
-    inode_table = NULL;
-    inode_table_locks = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    free_open_file_entries = NULL;
+    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+        rw_destroy(&fs->inode_table_sync[i].lock);
+    }
 
-    return 0;
+    return state_free(fs);
 }
 
 /**
@@ -191,8 +378,9 @@ int state_destroy(void) {
  * Possible errors:
  *   - No free slots in inode table.
  */
-static int inode_alloc(void) {
-    rw_read_lock(&freeinode_ts_locks);
+static int inode_alloc(tfs_t *fs) {
+    EVENT_BEGIN(begin);
+    rw_read_lock(&fs->freeinode_ts_locks);
 
     for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
         if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
@@ -200,21 +388,31 @@ static int inode_alloc(void) {
         }
 
         // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            rw_unlock(&freeinode_ts_locks);
-            rw_write_lock(&freeinode_ts_locks);
+        if (fs->freeinode_ts[inumber] == FREE) {
+            rw_unlock(&fs->freeinode_ts_locks);
+            rw_write_lock(&fs->freeinode_ts_locks);
+
+            // Another thread may have taken it in between
+            if (fs->freeinode_ts[inumber] != FREE) {
+                rw_unlock(&fs->freeinode_ts_locks);
+                rw_read_lock(&fs->freeinode_ts_locks);
+                continue;
+            }
 
             //  Found a free entry, so takes it for the new inode
-            freeinode_ts[inumber] = TAKEN;
+            fs->freeinode_ts[inumber] = TAKEN;
+            atomic_fetch_add(&fs->n_inodes_taken, 1);
 
-            rw_unlock(&freeinode_ts_locks);
+            rw_unlock(&fs->freeinode_ts_locks);
 
+            EVENT_END(begin, EVENT_INODE_ALLOC, inumber);
             return (int)inumber;
         }
     }
 
-    rw_unlock(&freeinode_ts_locks);
+    rw_unlock(&fs->freeinode_ts_locks);
     // no free inodes
+    EVENT_END(begin, EVENT_INODE_ALLOC, -1);
     return -1;
 }
 
@@ -233,86 +431,79 @@ static int inode_alloc(void) {
  *
  * Possible errors:
  *   - No free slots in inode table.
- *   - (if creating a directory) No free data blocks.
+ *   - (if creating a directory) No free data blocks, or its block could not
+ *     be read or stored.
  */
-int inode_create(inode_type i_type) {
+int inode_create(tfs_t *fs, inode_type i_type) {
 
-    int inumber = inode_alloc();
+    int inumber = inode_alloc(fs);
     if (inumber == -1) {
-        rw_unlock(&freeinode_ts_locks);
         return -1; // no free slots in inode table
     }
 
-    rw_read_lock(&freeinode_ts_locks);
+    rw_read_lock(&fs->freeinode_ts_locks);
 
-    inode_t *inode = &inode_table[inumber];
+    inode_t *inode = &fs->inode_table[inumber];
     insert_delay(); // simulate storage access delay (to inode)
 
-    inode->i_node_type = i_type;
+    INODE_STORE(inode->i_node_type, i_type);
     inode->inumber = inumber;
     switch (i_type) {
     case T_DIRECTORY: {
         // Initializes directory (filling its block with empty entries, labeled
         // with inumber==-1)
-        int b = data_block_alloc();
+        int b = data_block_alloc(fs);
         if (b == -1) {
             // ensure fields are initialized
-            inode->i_size = 0;
-            inode->i_data_block = -1;
+            INODE_STORE(inode->i_size, 0);
+            INODE_STORE(inode->i_data_block, -1);
             inode->inumber = -1;
 
-            // run regular deletion process
-            inode_delete(inumber);
-            rw_unlock(&freeinode_ts_locks);
+            // run regular deletion process (which takes the lock itself)
+            rw_unlock(&fs->freeinode_ts_locks);
+            inode_delete(fs, inumber);
             return -1;
         }
 
-        inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
-        inode_table[inumber].hard_links = 1;
+        INODE_STORE(inode->i_size, BLOCK_SIZE);
+        INODE_STORE(inode->i_data_block, b);
+        INODE_STORE(inode->hard_links, 1);
 
-        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-        ALWAYS_ASSERT(dir_entry != NULL,
-                      "inode_create: data block freed while in use");
-
-        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-            dir_entry[i].d_inumber = -1;
+        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(fs, b);
+        if (dir_entry != NULL) {
+            for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+                atomic_init(&dir_entry[i].d_inumber, FREE_DIR_ENTRY);
+            }
+        }
+        if (dir_entry == NULL || data_block_put(fs, b, true) == -1) {
+            // the block could not be read or stored; delete the inode and its
+            // block
+            rw_unlock(&fs->freeinode_ts_locks);
+            inode_delete(fs, inumber);
+            return -1;
         }
     } break;
     case T_FILE:
         // In case of a new file, simply sets its size to 0
 
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        inode_table[inumber].hard_links = 1;
+        INODE_STORE(inode->i_size, 0);
+        INODE_STORE(inode->i_data_block, -1);
+        INODE_STORE(inode->hard_links, 1);
 
         break;
-    case T_LINK:;
-        // Initializes directory (filling its block with empty entries, labeled
-        // with inumber==-1)
-        int b = data_block_alloc();
-        if (b == -1) {
-            // ensure fields are initialized
-            inode->i_size = 0;
-            inode->i_data_block = -1;
-            inode->inumber = -1;
+    case T_LINK:
+        // The target path is kept in the inode itself (see tfs_sym_link)
 
-            // run regular deletion process
-            inode_delete(inumber);
-            rw_unlock(&freeinode_ts_locks);
-            return -1;
-        }
-
-        inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
-        inode_table[inumber].hard_links = 0;
+        INODE_STORE(inode->i_size, 0);
+        INODE_STORE(inode->i_data_block, -1);
+        INODE_STORE(inode->hard_links, 0);
 
         break;
     default:
         PANIC("inode_create: unknown file type");
     }
 
-    rw_unlock(&freeinode_ts_locks);
+    rw_unlock(&fs->freeinode_ts_locks);
     return inumber;
 }
 
@@ -322,31 +513,32 @@ int inode_create(inode_type i_type) {
  * Input:
  *   - inumber: inode's number
  */
-void inode_delete(int inumber) {
+void inode_delete(tfs_t *fs, int inumber) {
     // simulate storage access delay (to inode and freeinode_ts)
     insert_delay();
     insert_delay();
 
-    ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
+    ALWAYS_ASSERT(valid_inumber(fs, inumber), "inode_delete: invalid inumber");
 
-    rw_read_lock(&freeinode_ts_locks);
+    rw_read_lock(&fs->freeinode_ts_locks);
 
-    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
+    ALWAYS_ASSERT(fs->freeinode_ts[inumber] == TAKEN,
                   "inode_delete: inode already freed");
 
-    rw_unlock(&freeinode_ts_locks);
+    rw_unlock(&fs->freeinode_ts_locks);
 
-    rw_write_lock(&freeinode_ts_locks);
-    rw_write_lock(&inode_table_locks[inumber]);
+    rw_write_lock(&fs->freeinode_ts_locks);
+    rw_write_lock(&fs->inode_table_sync[inumber].lock);
 
-    if (inode_table[inumber].i_size > 0) {
+    if (fs->inode_table[inumber].i_data_block != -1) {
 
-        data_block_free(inode_table[inumber].i_data_block);
+        data_block_free(fs, fs->inode_table[inumber].i_data_block);
     }
-    freeinode_ts[inumber] = FREE;
+    fs->freeinode_ts[inumber] = FREE;
+    atomic_fetch_sub(&fs->n_inodes_taken, 1);
 
-    rw_unlock(&inode_table_locks[inumber]);
-    rw_unlock(&freeinode_ts_locks);
+    rw_unlock(&fs->inode_table_sync[inumber].lock);
+    rw_unlock(&fs->freeinode_ts_locks);
 }
 
 /**
@@ -357,62 +549,155 @@ void inode_delete(int inumber) {
  *
  * Returns pointer to inode.
  */
-inode_t *inode_get(int inumber) {
-    ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
+inode_t *inode_get(tfs_t *fs, int inumber) {
+    ALWAYS_ASSERT(valid_inumber(fs, inumber), "inode_get: invalid inumber");
 
     insert_delay(); // simulate storage access delay to inode
-    return &inode_table[inumber];
+    return &fs->inode_table[inumber];
+}
+
+/**
+ * Enter a directory read-side critical section.
+ *
+ * Lookups never block: they only announce themselves in the counter of the
+ * current epoch, so that writers know when deleted entries can be reused.
+ *
+ * Returns the epoch to pass to dir_read_exit().
+ */
+static unsigned long dir_read_enter(tfs_t *fs) {
+    for (;;) {
+        unsigned long epoch = atomic_load(&fs->dir_epoch);
+        atomic_fetch_add(&fs->dir_readers[epoch & 1], 1);
+
+        // A writer may have started a grace period before we were counted
+        if (atomic_load(&fs->dir_epoch) == epoch) {
+            return epoch;
+        }
+
+        atomic_fetch_sub(&fs->dir_readers[epoch & 1], 1);
+    }
+}
+
+/**
+ * Leave a directory read-side critical section.
+ *
+ * Input:
+ *   - epoch: value returned by dir_read_enter()
+ */
+static void dir_read_exit(tfs_t *fs, unsigned long epoch) {
+    atomic_fetch_sub(&fs->dir_readers[epoch & 1], 1);
+}
+
+/**
+ * Wait for a grace period: every lookup that could still observe an entry
+ * retired before this call has finished.
+ */
+static void dir_synchronize(tfs_t *fs) {
+    mutex_lock(&fs->dir_reclaim_lock);
+
+    unsigned long epoch = atomic_fetch_add(&fs->dir_epoch, 1);
+    while (atomic_load(&fs->dir_readers[epoch & 1]) != 0) {
+        sched_yield();
+    }
+
+    mutex_unlock(&fs->dir_reclaim_lock);
 }
 
 /**
  * Clear the directory entry associated with a sub file.
  *
+ * The entry is retired rather than freed: lookups running concurrently may
+ * still be comparing its name, so add_dir_entry() only reuses it after a
+ * grace period.
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
+ *   - removed: where to store the inumber of the file the entry referred to
+ *     (its link to be dropped by the caller, even if -1 is returned because
+ *     the directory's block could not be stored), or -1 if none
  *
  * Returns 0 if successful, -1 otherwise.
  *
  * Possible errors:
  *   - inode is not a directory inode.
  *   - Directory does not contain an entry for sub_name.
+ *   - (block cache) The directory's block could not be read.
  */
-int clear_dir_entry(inode_t *inode, char const *sub_name) {
+int clear_dir_entry(tfs_t *fs, inode_t *inode, char const *sub_name,
+                    int *removed) {
     insert_delay();
 
+    *removed = -1;
+
     if (inode->i_node_type != T_DIRECTORY) {
         return -1; // not a directory
     }
 
-    rw_read_lock(&datablocks_lock);
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    int inum = inode->inumber;
 
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "clear_dir_entry: directory must have a data block");
+    // Serializes with other writers of the same directory; lookups don't lock
+    rw_write_lock(&fs->inode_table_sync[inum].lock);
+    // Locates the block containing the entries of the directory
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_data_block);
+    if (dir_entry == NULL) {
+        rw_unlock(&fs->inode_table_sync[inum].lock);
+        return -1; // the directory's block could not be read
+    }
 
     for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (!strcmp(dir_entry[i].d_name, sub_name)) {
-
-            rw_unlock(&datablocks_lock);
-            rw_write_lock(&datablocks_lock);
+        if ((atomic_load(&dir_entry[i].d_inumber) >= 0) &&
+            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
 
-            dir_entry[i].d_inumber = -1;
-            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
+            *removed = atomic_load(&dir_entry[i].d_inumber);
+            atomic_store(&dir_entry[i].d_inumber, RETIRED_DIR_ENTRY);
 
-            rw_unlock(&datablocks_lock);
+            int res = data_block_put(fs, inode->i_data_block, true);
+            rw_unlock(&fs->inode_table_sync[inum].lock);
 
-            return 0;
+            return res;
         }
     }
 
-    rw_unlock(&datablocks_lock);
+    data_block_put(fs, inode->i_data_block, false);
+    rw_unlock(&fs->inode_table_sync[inum].lock);
     return -1; // sub_name not found
 }
 
+/**
+ * Free the retired entries of a directory once no lookup can be reading them.
+ * The caller must hold the directory's write lock.
+ *
+ * Input:
+ *   - dir_entry: the directory's entries
+ *
+ * Returns the first entry freed, or NULL if there were none.
+ */
+static dir_entry_t *reclaim_dir_entries(tfs_t *fs, dir_entry_t *dir_entry) {
+    dir_synchronize(fs);
+
+    dir_entry_t *free_entry = NULL;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (atomic_load(&dir_entry[i].d_inumber) == RETIRED_DIR_ENTRY) {
+            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
+            atomic_store(&dir_entry[i].d_inumber, FREE_DIR_ENTRY);
+            if (free_entry == NULL) {
+                free_entry = &dir_entry[i];
+            }
+        }
+    }
+    return free_entry;
+}
+
 /**
  * Store the inumber for a sub file in a directory.
  *
+ * The directory is locked exclusively against other writers, so the check for
+ * an existing entry with the same name and the insert itself are atomic. The
+ * name is written before the inumber is published, so lock-free lookups never
+ * see a partially written entry.
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
@@ -423,9 +708,12 @@ int clear_dir_entry(inode_t *inode, char const *sub_name) {
  * Possible errors:
  *   - inode is not a directory inode.
  *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
+ *   - Directory already contains an entry named sub_name.
  *   - Directory is already full of entries.
+ *   - (block cache) The directory's block could not be read.
  */
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
+int add_dir_entry(tfs_t *fs, inode_t *inode, char const *sub_name,
+                  int sub_inumber) {
     if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
         return -1; // invalid sub_name
     }
@@ -435,36 +723,179 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
         return -1; // not a directory
     }
 
-    rw_write_lock(&inode_table_locks[sub_inumber]);
+    int inum = inode->inumber;
+
+    rw_write_lock(&fs->inode_table_sync[inum].lock);
 
     // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "add_dir_entry: directory must have a data block");
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_data_block);
+    if (dir_entry == NULL) {
+        rw_unlock(&fs->inode_table_sync[inum].lock);
+        return -1; // the directory's block could not be read
+    }
 
-    // Finds and fills the first empty entry
+    // Looks for a clashing name while remembering the first empty entry
+    dir_entry_t *free_entry = NULL;
+    bool has_retired = false;
     for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int d_inumber = atomic_load(&dir_entry[i].d_inumber);
+        if (d_inumber == FREE_DIR_ENTRY) {
+            if (free_entry == NULL) {
+                free_entry = &dir_entry[i];
+            }
+        } else if (d_inumber == RETIRED_DIR_ENTRY) {
+            has_retired = true;
+        } else if (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) ==
+                   0) {
+            data_block_put(fs, inode->i_data_block, false);
+            rw_unlock(&fs->inode_table_sync[inum].lock);
+            return -1; // entry already exists
+        }
+    }
+
+    if (free_entry == NULL && has_retired) {
+        free_entry = reclaim_dir_entries(fs, dir_entry);
+    }
 
-        if (dir_entry[i].d_inumber == -1) {
+    if (free_entry == NULL) {
+        data_block_put(fs, inode->i_data_block, false);
+        rw_unlock(&fs->inode_table_sync[inum].lock);
+        return -1; // no space for entry
+    }
+
+    // Fills the first empty entry, publishing it only once the name is set
+    strncpy(free_entry->d_name, sub_name, MAX_FILE_NAME - 1);
+    free_entry->d_name[MAX_FILE_NAME - 1] = '\0';
+    atomic_store(&free_entry->d_inumber, sub_inumber);
 
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
+    int res = data_block_put(fs, inode->i_data_block, true);
+    rw_unlock(&fs->inode_table_sync[inum].lock);
 
-            rw_unlock(&inode_table_locks[sub_inumber]);
+    return res;
+}
 
-            return 0;
+/**
+ * Rename a sub file of a directory, as one atomic change to the directory.
+ *
+ * If new_name exists, its entry is switched to the renamed file with a single
+ * atomic store, so lookups of new_name find either file at every moment, never
+ * none. Otherwise the file is given a new entry, which is published before
+ * its old one is retired (names are never rewritten in place, since lock-free
+ * lookups may be reading them).
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - old_name: current sub file name
+ *   - new_name: new sub file name
+ *   - replaced: where to store the inumber of the file that new_name referred
+ *     to before (its link to be dropped by the caller, even if -1 is returned
+ *     because the directory's block could not be stored), or -1 if none
+ *
+ * Returns 0 if successful (renaming a file to its own name changes nothing),
+ * -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - new_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
+ *   - Directory does not contain an entry for old_name.
+ *   - new_name does not exist and the directory is full of entries.
+ *   - (block cache) The directory's block could not be read.
+ */
+int rename_dir_entry(tfs_t *fs, inode_t *inode, char const *old_name,
+                     char const *new_name, int *replaced) {
+    *replaced = -1;
+    if (strlen(new_name) == 0 || strlen(new_name) > MAX_FILE_NAME - 1) {
+        return -1; // invalid new_name
+    }
+    if (strcmp(old_name, new_name) == 0) {
+        // Otherwise the scan below would take it for a new name, and give the
+        // file a second entry (failing if the directory is full)
+        return find_in_dir(fs, inode, old_name) == -1 ? -1 : 0;
+    }
+
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    int inum = inode->inumber;
+
+    rw_write_lock(&fs->inode_table_sync[inum].lock);
+
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_data_block);
+    if (dir_entry == NULL) {
+        rw_unlock(&fs->inode_table_sync[inum].lock);
+        return -1; // the directory's block could not be read
+    }
+
+    // Finds both names in one scan, remembering the first empty entry
+    dir_entry_t *old_entry = NULL;
+    dir_entry_t *new_entry = NULL;
+    dir_entry_t *free_entry = NULL;
+    bool has_retired = false;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int d_inumber = atomic_load(&dir_entry[i].d_inumber);
+        if (d_inumber == FREE_DIR_ENTRY) {
+            if (free_entry == NULL) {
+                free_entry = &dir_entry[i];
+            }
+        } else if (d_inumber == RETIRED_DIR_ENTRY) {
+            has_retired = true;
+        } else if (strncmp(dir_entry[i].d_name, old_name, MAX_FILE_NAME) ==
+                   0) {
+            old_entry = &dir_entry[i];
+        } else if (strncmp(dir_entry[i].d_name, new_name, MAX_FILE_NAME) ==
+                   0) {
+            new_entry = &dir_entry[i];
         }
     }
 
-    rw_unlock(&inode_table_locks[sub_inumber]);
+    int res = -1;
+    bool dirty = false;
+    if (old_entry == NULL) {
+        // no such file
+    } else if (new_entry != NULL) {
+        int old_inumber = atomic_load(&old_entry->d_inumber);
+        int new_inumber = atomic_load(&new_entry->d_inumber);
+        // Names of the same file (e.g. hard links) are left alone
+        if (new_inumber != old_inumber) {
+            atomic_store(&new_entry->d_inumber, old_inumber);
+            atomic_store(&old_entry->d_inumber, RETIRED_DIR_ENTRY);
+            *replaced = new_inumber;
+            dirty = true;
+        }
+        res = 0;
+    } else {
+        if (free_entry == NULL && has_retired) {
+            free_entry = reclaim_dir_entries(fs, dir_entry);
+        }
+        if (free_entry != NULL) {
+            // Publishes the new name before retiring the old one
+            strncpy(free_entry->d_name, new_name, MAX_FILE_NAME - 1);
+            free_entry->d_name[MAX_FILE_NAME - 1] = '\0';
+            atomic_store(&free_entry->d_inumber,
+                         atomic_load(&old_entry->d_inumber));
+            atomic_store(&old_entry->d_inumber, RETIRED_DIR_ENTRY);
+            dirty = true;
+            res = 0;
+        }
+    }
 
-    return -1; // no space for entry
+    if (data_block_put(fs, inode->i_data_block, dirty) == -1) {
+        res = -1;
+    }
+    rw_unlock(&fs->inode_table_sync[inum].lock);
+    return res;
 }
 
 /**
  * Obtain the inumber for a sub file inside a directory.
  *
+ * Takes no locks: runs inside a directory read-side critical section, so
+ * entries deleted meanwhile keep their names until it finishes.
+ *
  * Input:
  *   - inode: directory inode
  *   - sub_name: sub file name
@@ -474,40 +905,385 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
  * Possible errors:
  *   - inode is not a directory inode.
  *   - Directory does not contain a file named sub_name.
+ *   - (block cache) The directory's block could not be read.
  */
-int find_in_dir(inode_t const *inode, char const *sub_name) {
+int find_in_dir(tfs_t *fs, inode_t const *inode, char const *sub_name) {
 
     ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
     ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
 
+    EVENT_BEGIN(begin);
     insert_delay(); // simulate storage access delay to inode with inumber
 
     if (inode->i_node_type != T_DIRECTORY) {
+        EVENT_END(begin, EVENT_LOOKUP, -1);
         return -1; // not a directory
     }
 
-    int inum = inode->inumber;
-
-    rw_read_lock(&inode_table_locks[inum]);
+    unsigned long epoch = dir_read_enter(fs);
     // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "find_in_dir: directory inode must have a data block");
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_data_block);
+    if (dir_entry == NULL) {
+        dir_read_exit(fs, epoch);
+        EVENT_END(begin, EVENT_LOOKUP, -1);
+        return -1; // the directory's block could not be read
+    }
 
     // Iterates over the directory entries looking for one that has the target
     // name
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
+    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int sub_inumber = atomic_load(&dir_entry[i].d_inumber);
+        if ((sub_inumber >= 0) &&
             (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
 
-            int sub_inumber = dir_entry[i].d_inumber;
-            rw_unlock(&inode_table_locks[inum]);
+            data_block_put(fs, inode->i_data_block, false);
+            dir_read_exit(fs, epoch);
+            EVENT_END(begin, EVENT_LOOKUP, sub_inumber);
             return sub_inumber;
         }
-    rw_unlock(&inode_table_locks[inum]);
+    }
+    data_block_put(fs, inode->i_data_block, false);
+    dir_read_exit(fs, epoch);
+    EVENT_END(begin, EVENT_LOOKUP, -1);
     return -1; // entry not found
 }
 
+/**
+ * Public type of an inode.
+ */
+static tfs_file_type_t file_type_of(inode_type type) {
+    switch (type) {
+    case T_DIRECTORY:
+        return TFS_T_DIRECTORY;
+    case T_LINK:
+        return TFS_T_SYMLINK;
+    case T_FILE:
+    default:
+        return TFS_T_FILE;
+    }
+}
+
+/**
+ * Snapshot of an inode's metadata, taken without locking the inode.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *   - st: where to store the metadata
+ */
+static void inode_stat(tfs_t *fs, int inumber, tfs_stat_t *st) {
+    inode_t const *inode = &fs->inode_table[inumber];
+    unsigned int seq;
+    do {
+        seq = inode_read_begin(fs, inumber);
+        st->type = file_type_of(INODE_LOAD(inode->i_node_type));
+        st->size = INODE_LOAD(inode->i_size);
+        st->links = INODE_LOAD(inode->hard_links);
+        st->blocks = INODE_LOAD(inode->i_data_block) == -1 ? 0 : 1;
+    } while (inode_read_retry(fs, inumber, seq));
+    st->inumber = inumber;
+}
+
+/**
+ * Snapshot of the metadata of the file a directory entry refers to, read
+ * again if the entry is switched to another file meanwhile (see
+ * rename_dir_entry). The caller must be in a directory read-side critical
+ * section.
+ *
+ * Input:
+ *   - entry: the directory entry
+ *   - sub_inumber: inumber just loaded from the entry
+ *   - st: where to store the metadata
+ *
+ * Returns the inumber the metadata belongs to, or a negative value if the
+ * entry was deleted meanwhile (its inode may then have been reused).
+ */
+static int entry_stat(tfs_t *fs, dir_entry_t *entry, int sub_inumber,
+                      tfs_stat_t *st) {
+    while (sub_inumber >= 0) {
+        inode_stat(fs, sub_inumber, st);
+        int now = atomic_load(&entry->d_inumber);
+        if (now == sub_inumber) {
+            break;
+        }
+        sub_inumber = now;
+    }
+    return sub_inumber;
+}
+
+/**
+ * List the entries of a directory, starting at a given entry index.
+ *
+ * Takes no locks: like find_in_dir, runs inside one directory read-side
+ * critical section (for the whole batch), so entries deleted meanwhile keep
+ * their names until it finishes. Entries never move, so the entry index is a
+ * stable cursor.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - cursor: index of the first entry to look at, advanced past the last
+ *     one looked at
+ *   - entries: where to store the entries found
+ *   - max: how many entries fit in entries
+ *
+ * Returns the number of entries stored (less than max only once the end of
+ * the directory is reached), or -1 if inode is not a directory inode or its
+ * block could not be read.
+ */
+ssize_t dir_read_batch(tfs_t *fs, inode_t const *inode, size_t *cursor,
+                       tfs_dirent_t *entries, size_t max) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    unsigned long epoch = dir_read_enter(fs);
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_data_block);
+    if (dir_entry == NULL) {
+        dir_read_exit(fs, epoch);
+        return -1; // the directory's block could not be read
+    }
+
+    size_t count = 0;
+    size_t i = *cursor;
+    for (; i < MAX_DIR_ENTRIES && count < max; i++) {
+        int sub_inumber = atomic_load(&dir_entry[i].d_inumber);
+        if (sub_inumber < 0) {
+            continue;
+        }
+
+        tfs_dirent_t *entry = &entries[count];
+        memcpy(entry->name, dir_entry[i].d_name, MAX_FILE_NAME);
+        entry->name[MAX_FILE_NAME - 1] = '\0';
+
+        tfs_stat_t st;
+        sub_inumber = entry_stat(fs, &dir_entry[i], sub_inumber, &st);
+        if (sub_inumber < 0) {
+            continue; // deleted meanwhile
+        }
+        entry->inumber = sub_inumber;
+        entry->type = st.type;
+        entry->size = st.size;
+        count++;
+    }
+    *cursor = i;
+
+    data_block_put(fs, inode->i_data_block, false);
+    dir_read_exit(fs, epoch);
+    return (ssize_t)count;
+}
+
+/**
+ * Obtain the metadata of several sub files of a directory.
+ *
+ * Like dir_read_batch, takes no locks and resolves every name inside one
+ * directory read-side critical section.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - names: sub file names (NULL ones are not looked up)
+ *   - count: number of names
+ *   - out: where to store the metadata of each name (with inumber -1 if it
+ *     is not found)
+ *
+ * Returns the number of names found, or -1 if inode is not a directory inode
+ * or its block could not be read.
+ */
+ssize_t dir_stat_batch(tfs_t *fs, inode_t const *inode,
+                       char const *const names[], size_t count,
+                       tfs_stat_t out[]) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    unsigned long epoch = dir_read_enter(fs);
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, inode->i_data_block);
+    if (dir_entry == NULL) {
+        dir_read_exit(fs, epoch);
+        return -1; // the directory's block could not be read
+    }
+
+    size_t found = 0;
+    for (size_t n = 0; n < count; n++) {
+        memset(&out[n], 0, sizeof(out[n]));
+        out[n].inumber = -1;
+        if (names[n] == NULL) {
+            continue;
+        }
+
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            int sub_inumber = atomic_load(&dir_entry[i].d_inumber);
+            if (sub_inumber < 0 ||
+                strncmp(dir_entry[i].d_name, names[n], MAX_FILE_NAME) != 0) {
+                continue;
+            }
+
+            // An entry deleted meanwhile counts as not found
+            if (entry_stat(fs, &dir_entry[i], sub_inumber, &out[n]) < 0) {
+                memset(&out[n], 0, sizeof(out[n]));
+                out[n].inumber = -1;
+            } else {
+                found++;
+            }
+            break;
+        }
+    }
+
+    data_block_put(fs, inode->i_data_block, false);
+    dir_read_exit(fs, epoch);
+    return (ssize_t)found;
+}
+
+/**
+ * Hash the contents of a data block (64-bit multiply-rotate mixing, 8 bytes
+ * at a time).
+ */
+static uint64_t block_hash(tfs_t *fs, void const *contents) {
+    uint8_t const *bytes = contents;
+    uint64_t h = 0x9E3779B97F4A7C15u ^ BLOCK_SIZE;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= BLOCK_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        h ^= word * 0xFF51AFD7ED558CCDu;
+        h = ((h << 31) | (h >> 33)) * 0x9E3779B97F4A7C15u;
+    }
+    for (; i < BLOCK_SIZE; i++) {
+        h = (h ^ bytes[i]) * 0x100000001B3u;
+    }
+
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53u;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline size_t dedup_bucket(tfs_t *fs, uint64_t hash) {
+    return (size_t)(hash % DATA_BLOCKS);
+}
+
+// The lock of a bucket is taken as &fs->dedup_locks[stripe] at each call
+// site, so that the lock profiler names its class after the array
+static inline size_t dedup_stripe(tfs_t *fs, uint64_t hash) {
+    return dedup_bucket(fs, hash) % DEDUP_LOCK_STRIPES;
+}
+
+/**
+ * Find an indexed block with the given contents, taking a reference to it.
+ *
+ * Returns the block number, or -1 if there is none.
+ */
+static int dedup_find(tfs_t *fs, uint64_t hash, void const *contents) {
+    size_t stripe = dedup_stripe(fs, hash);
+    rw_read_lock(&fs->dedup_locks[stripe]);
+
+    for (int b = fs->dedup_buckets[dedup_bucket(fs, hash)]; b != -1;
+         b = fs->dedup_next[b]) {
+        if (fs->block_hashes[b] != hash) {
+            continue;
+        }
+
+        // Indexed blocks aren't modified, so the comparison is stable
+        void const *block = data_block_get(fs, b);
+        if (block == NULL) {
+            continue; // unreadable, so not shared
+        }
+        bool equal = memcmp(block, contents, BLOCK_SIZE) == 0;
+        data_block_put(fs, b, false);
+        if (equal) {
+            atomic_fetch_add(&fs->block_refs[b], 1);
+            rw_unlock(&fs->dedup_locks[stripe]);
+            return b;
+        }
+    }
+
+    rw_unlock(&fs->dedup_locks[stripe]);
+    return -1;
+}
+
+/**
+ * Add a block, with a single reference, to the index.
+ */
+static void dedup_insert(tfs_t *fs, int block_number, uint64_t hash) {
+    size_t stripe = dedup_stripe(fs, hash);
+    rw_write_lock(&fs->dedup_locks[stripe]);
+
+    size_t bucket = dedup_bucket(fs, hash);
+    fs->block_hashes[block_number] = hash;
+    fs->block_indexed[block_number] = true;
+    fs->dedup_next[block_number] = fs->dedup_buckets[bucket];
+    fs->dedup_buckets[bucket] = block_number;
+
+    rw_unlock(&fs->dedup_locks[stripe]);
+}
+
+/**
+ * Remove a block from the index. Must be called with its lock held.
+ */
+static void dedup_unlink(tfs_t *fs, int block_number) {
+    int *link =
+        &fs->dedup_buckets[dedup_bucket(fs, fs->block_hashes[block_number])];
+    while (*link != block_number) {
+        link = &fs->dedup_next[*link];
+    }
+    *link = fs->dedup_next[block_number];
+    fs->block_indexed[block_number] = false;
+}
+
+/**
+ * Take sole ownership of a block before modifying it, removing it from the
+ * index. The caller must hold a reference to the block.
+ *
+ * Returns true if successful, false if the block is shared with other files.
+ */
+static bool dedup_claim(tfs_t *fs, int block_number) {
+    if (!fs->block_indexed[block_number]) {
+        return true; // never shared
+    }
+
+    size_t stripe = dedup_stripe(fs, fs->block_hashes[block_number]);
+    rw_write_lock(&fs->dedup_locks[stripe]);
+
+    bool owned = atomic_load(&fs->block_refs[block_number]) == 1;
+    if (owned) {
+        dedup_unlink(fs, block_number);
+    }
+
+    rw_unlock(&fs->dedup_locks[stripe]);
+    return owned;
+}
+
+/**
+ * Drop a reference to a block, removing it from the index if it was the last.
+ *
+ * Returns true if it was the last reference, false otherwise.
+ */
+static bool dedup_release(tfs_t *fs, int block_number) {
+    if (!fs->block_indexed[block_number]) {
+        return true; // never shared
+    }
+
+    size_t stripe = dedup_stripe(fs, fs->block_hashes[block_number]);
+    rw_write_lock(&fs->dedup_locks[stripe]);
+
+    // Lookups only take references with the lock held, so this can't race
+    bool last = atomic_load(&fs->block_refs[block_number]) == 1;
+    if (last) {
+        dedup_unlink(fs, block_number);
+    } else {
+        atomic_fetch_sub(&fs->block_refs[block_number], 1);
+    }
+
+    rw_unlock(&fs->dedup_locks[stripe]);
+    return last;
+}
+
 /**
  * Allocate a new data block.
  *
@@ -517,59 +1293,208 @@ int find_in_dir(inode_t const *inode, char const *sub_name) {
  *   - No free data blocks.
  */
 
-int data_block_alloc(void) {
+int data_block_alloc(tfs_t *fs) {
 
-    rw_read_lock(&datablocks_lock);
+    // Holds the write lock for the whole scan, so that a free block can't be
+    // handed out twice
+    EVENT_BEGIN(begin);
+    rw_write_lock(&fs->datablocks_lock);
     for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
+        if (i * sizeof(atomic_uint) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to block_refs
         }
 
-        if (free_blocks[i] == FREE) {
-            rw_unlock(&datablocks_lock);
-            rw_write_lock(&datablocks_lock);
-
-            free_blocks[i] = TAKEN;
-            n_blocks_taken++;
+        if (atomic_load(&fs->block_refs[i]) == 0) {
+            atomic_store(&fs->block_refs[i], 1);
+            atomic_fetch_add(&fs->n_blocks_taken, 1);
 
-            rw_unlock(&datablocks_lock);
+            rw_unlock(&fs->datablocks_lock);
 
+            EVENT_END(begin, EVENT_BLOCK_ALLOC, i);
             return (int)i;
         }
     }
-    rw_unlock(&datablocks_lock);
+    rw_unlock(&fs->datablocks_lock);
+    EVENT_END(begin, EVENT_BLOCK_ALLOC, -1);
     return -1;
 }
 
 /**
- * Free a data block.
+ * Free a data block (with block deduplication, drop a reference to it and
+ * only free it once no file refers to it anymore).
  *
  * Input:
  *   - block_number: the block number/index
  */
-void data_block_free(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
+void data_block_free(tfs_t *fs, int block_number) {
+    ALWAYS_ASSERT(valid_block_number(fs, block_number),
                   "data_block_free: invalid block number");
 
-    insert_delay(); // simulate storage access delay to free_blocks
-    free_blocks[block_number] = FREE;
-    n_blocks_taken--;
+    insert_delay(); // simulate storage access delay to block_refs
+    if (fs->params.dedup_blocks && !dedup_release(fs, block_number)) {
+        return; // still shared with other files
+    }
+
+    if (fs->fs_data_cached) {
+        cache_block_discard(fs->cache, block_number);
+    }
+    rw_write_lock(&fs->datablocks_lock);
+    atomic_store(&fs->block_refs[block_number], 0);
+    atomic_fetch_sub(&fs->n_blocks_taken, 1);
+    rw_unlock(&fs->datablocks_lock);
 }
 
 /**
  * Obtain a pointer to the contents of a given block.
  *
+ * Every call must be matched by a data_block_put() once the caller is done
+ * with the pointer, as the block may be evicted from the block cache after.
+ *
  * Input:
  *   - block_number: the block number/index
  *
- * Returns a pointer to the first byte of the block.
+ * Returns a pointer to the first byte of the block, or NULL if the block cache
+ * could not read it from its backing store (nor need it be put then).
  */
-void *data_block_get(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
+void *data_block_get(tfs_t *fs, int block_number) {
+    ALWAYS_ASSERT(valid_block_number(fs, block_number),
                   "data_block_get: invalid block number");
 
+    if (fs->fs_data_cached) {
+        // the backing store access replaces the simulated delay
+        return cache_block_get(fs->cache, block_number);
+    }
+
     insert_delay(); // simulate storage access delay to block
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+    return &fs->fs_data[(size_t)block_number * BLOCK_SIZE];
+}
+
+/**
+ * Release a pointer obtained with data_block_get().
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *   - dirty: whether the block's contents were modified
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - (compressed store) No room to store the modified block; its previous
+ *     contents are restored.
+ */
+int data_block_put(tfs_t *fs, int block_number, bool dirty) {
+    if (fs->fs_data_cached) {
+        return cache_block_put(fs->cache, block_number, dirty);
+    }
+    return 0;
+}
+
+/**
+ * Whether tiny files are kept in their inode (see inode_t).
+ */
+bool inode_inline_enabled(tfs_t *fs) { return fs->params.inline_small_files; }
+
+/**
+ * Whether file blocks are deduplicated (see data_block_write_dedup()).
+ */
+bool data_block_dedup_enabled(tfs_t *fs) { return fs->params.dedup_blocks; }
+
+/**
+ * Write to a file's data block, sharing it with every other file whose block
+ * has the same contents.
+ *
+ * The block is never modified while shared: the new contents are looked up in
+ * the deduplication index first, and otherwise written to a block of the
+ * file's own (a copy, if the current one is shared).
+ *
+ * Input:
+ *   - block_number: the file's data block (-1 if none); updated on success
+ *   - offset: offset of the write in the block
+ *   - buffer: data to write
+ *   - to_write: length of the data (offset + to_write <= block size)
+ *   - size: current size of the file
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks.
+ *   - (compressed store) No room to store the block.
+ *   - (block cache) A block could not be read from its backing store.
+ */
+int data_block_write_dedup(tfs_t *fs, int *block_number, size_t offset,
+                           void const *buffer, size_t to_write, size_t size) {
+    char *contents = malloc(BLOCK_SIZE);
+    if (contents == NULL) {
+        return -1;
+    }
+
+    // Builds the new contents, zeroing everything past the end of the file
+    int old = *block_number;
+    memset(contents, 0, BLOCK_SIZE);
+    if (old != -1) {
+        void const *block = data_block_get(fs, old);
+        if (block == NULL) {
+            free(contents);
+            return -1; // the current contents could not be read
+        }
+        memcpy(contents, block, size);
+        data_block_put(fs, old, false);
+    }
+    memcpy(contents + offset, buffer, to_write);
+    uint64_t hash = block_hash(fs, contents);
+
+    int b = dedup_find(fs, hash, contents);
+    if (b != -1) {
+        if (old != -1) {
+            data_block_free(fs, old); // also right if b == old (contents equal)
+        }
+        INODE_STORE(*block_number, b);
+        free(contents);
+        return 0;
+    }
+
+    // No identical block exists; the file needs a block it owns
+    b = old;
+    if (b == -1 || !dedup_claim(fs, b)) {
+        b = data_block_alloc(fs);
+        if (b == -1) {
+            free(contents);
+            return -1; // no space
+        }
+    }
+
+    void *block = data_block_get(fs, b);
+    if (block != NULL) {
+        data_copy_in(block, contents, BLOCK_SIZE);
+    }
+    free(contents);
+    if (block == NULL || data_block_put(fs, b, true) == -1) {
+        if (b != old) {
+            data_block_free(fs, b);
+        }
+        return -1; // no space, or the block could not be read
+    }
+
+    dedup_insert(fs, b, hash);
+    if (old != -1 && b != old) {
+        data_block_free(fs, old);
+    }
+    INODE_STORE(*block_number, b);
+    return 0;
+}
+
+/**
+ * Obtain the block cache counters.
+ *
+ * Returns 0 if successful, -1 if the block cache is not in use.
+ */
+int data_block_cache_stats(tfs_t *fs, tfs_cache_stats_t *stats) {
+    if (!fs->fs_data_cached) {
+        return -1;
+    }
+
+    cache_get_stats(fs->cache, stats);
+    return 0;
 }
 
 /**
@@ -578,6 +1503,7 @@ void *data_block_get(int block_number) {
  * Input:
  *   - inumber: inode number of the file to open
  *   - offset: initial offset
+ *   - buffered: whether writes are buffered in the entry (TFS_O_BUFFERED)
  *
  * Returns file handle if successful, -1 otherwise.
  *
@@ -585,33 +1511,36 @@ void *data_block_get(int block_number) {
  *   - No space in open file table for a new open file.
  */
 
-int add_to_open_file_table(int inumber, size_t offset) {
+int add_to_open_file_table(tfs_t *fs, int inumber, size_t offset,
+                           bool buffered) {
 
-    rw_read_lock(&free_open_file_entries_lock);
+    // Held exclusively for the whole scan, so that two opens can't both
+    // claim the same free entry
+    rw_write_lock(&fs->free_open_file_entries_lock);
 
     for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            rw_unlock(&free_open_file_entries_lock);
-            rw_write_lock(&free_open_file_entries_lock);
-            mutex_lock(&open_file_table_locks[i]);
-
-            free_open_file_entries[i] = TAKEN;
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            n_files_open++;
-
-            if (pthread_mutex_init(&get_open_file_entry(i)->lock, NULL) != 0) {
+        if (fs->free_open_file_entries[i] == FREE) {
+            fs->free_open_file_entries[i] = TAKEN;
+            fs->open_file_table[i].of_inumber = inumber;
+            fs->open_file_table[i].of_offset = offset;
+            fs->open_file_table[i].of_buffered = buffered;
+            fs->open_file_table[i].of_wb_len = 0;
+            fs->open_file_table[i].of_ra_next = offset;
+            fs->open_file_table[i].of_ra_window = 0;
+            fs->open_file_table[i].of_ra_len = 0;
+            atomic_fetch_add(&fs->n_files_open, 1);
+
+            if (pthread_mutex_init(&fs->open_file_table[i].lock, NULL) != 0) {
                 perror("pthread_mutex_init");
                 exit(EXIT_FAILURE);
             }
 
-            mutex_unlock(&open_file_table_locks[i]);
-            rw_unlock(&free_open_file_entries_lock);
+            rw_unlock(&fs->free_open_file_entries_lock);
             return i;
         }
     }
 
-    rw_unlock(&free_open_file_entries_lock);
+    rw_unlock(&fs->free_open_file_entries_lock);
 
     return -1;
 }
@@ -622,25 +1551,25 @@ int add_to_open_file_table(int inumber, size_t offset) {
  * Input:
  *   - fhandle: file handle to free/close
  */
-void remove_from_open_file_table(int fhandle) {
+void remove_from_open_file_table(tfs_t *fs, int fhandle) {
 
-    rw_write_lock(&free_open_file_entries_lock);
+    rw_write_lock(&fs->free_open_file_entries_lock);
 
-    ALWAYS_ASSERT(valid_file_handle(fhandle),
+    ALWAYS_ASSERT(valid_file_handle(fs, fhandle),
                   "remove_from_open_file_table: file handle must be valid");
 
-    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
+    ALWAYS_ASSERT(fs->free_open_file_entries[fhandle] == TAKEN,
                   "remove_from_open_file_table: file handle must be taken");
 
-    if (pthread_mutex_destroy(&get_open_file_entry(fhandle)->lock) != 0) {
+    if (pthread_mutex_destroy(&fs->open_file_table[fhandle].lock) != 0) {
         perror("pthread_mutex_destroy");
         exit(EXIT_FAILURE);
     }
 
-    free_open_file_entries[fhandle] = FREE;
-    n_files_open--;
+    fs->free_open_file_entries[fhandle] = FREE;
+    atomic_fetch_sub(&fs->n_files_open, 1);
 
-    rw_unlock(&free_open_file_entries_lock);
+    rw_unlock(&fs->free_open_file_entries_lock);
 }
 
 /**
@@ -652,16 +1581,20 @@ void remove_from_open_file_table(int fhandle) {
  * Returns pointer to the entry, or NULL if the fhandle is invalid/closed/never
  * opened.
  */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
+open_file_entry_t *get_open_file_entry(tfs_t *fs, int fhandle) {
+    if (!valid_file_handle(fs, fhandle)) {
         return NULL;
     }
 
-    if (free_open_file_entries[fhandle] != TAKEN) {
+    rw_read_lock(&fs->free_open_file_entries_lock);
+    bool taken = fs->free_open_file_entries[fhandle] == TAKEN;
+    rw_unlock(&fs->free_open_file_entries_lock);
+
+    if (!taken) {
         return NULL;
     }
 
-    return &open_file_table[fhandle];
+    return &fs->open_file_table[fhandle];
 }
 
 void rw_init(pthread_rwlock_t *lock, pthread_rwlockattr_t *attr) {
@@ -678,69 +1611,211 @@ void rw_destroy(pthread_rwlock_t *lock) {
     }
 }
 
+#ifndef TFS_LOCK_PROFILE
 void rw_read_lock(pthread_rwlock_t *lock) {
+#ifdef TFS_EVENTS
+    // Only the waits for a contended lock are recorded
+    if (pthread_rwlock_tryrdlock(lock) == 0) {
+        return;
+    }
+#endif
+    EVENT_BEGIN(begin);
     if (pthread_rwlock_rdlock(lock) != 0) {
         perror("pthread_rwlock_rdlock");
         exit(EXIT_FAILURE);
     }
+    EVENT_END(begin, EVENT_LOCK_WAIT, (uintptr_t)lock);
 }
 
 void rw_write_lock(pthread_rwlock_t *lock) {
+#ifdef TFS_EVENTS
+    if (pthread_rwlock_trywrlock(lock) == 0) {
+        return;
+    }
+#endif
+    EVENT_BEGIN(begin);
     if (pthread_rwlock_wrlock(lock) != 0) {
         perror("pthread_rwlock_wrlock");
         exit(EXIT_FAILURE);
     }
+    EVENT_END(begin, EVENT_LOCK_WAIT, (uintptr_t)lock);
 }
+#endif
 
 void rw_unlock(pthread_rwlock_t *lock) {
+#ifdef TFS_LOCK_PROFILE
+    lock_profile_release(lock);
+#endif
     if (pthread_rwlock_unlock(lock) != 0) {
         perror("pthread_rwlock_unlock");
         exit(EXIT_FAILURE);
     }
 }
 
-void inode_lock(int index, int rw) {
+#ifdef TFS_LOCK_PROFILE
+void inode_lock_at(tfs_t *fs, int index, int rw, lock_site_t *site) {
     // RW: 0 = read, 1 = write
     if (rw == 0) {
-        if (pthread_rwlock_rdlock(&inode_table_locks[index]) != 0) {
-            perror("pthread_rwlock_rdlock");
-            exit(EXIT_FAILURE);
-        }
+        lock_profile_rdlock(&fs->inode_table_sync[index].lock, site);
     } else {
-        if (pthread_rwlock_wrlock(&inode_table_locks[index]) != 0) {
-            perror("pthread_rwlock_wrlock");
-            exit(EXIT_FAILURE);
-        }
+        lock_profile_wrlock(&fs->inode_table_sync[index].lock, site);
     }
 }
+#else
+void inode_lock(tfs_t *fs, int index, int rw) {
+    // RW: 0 = read, 1 = write
+    if (rw == 0) {
+        rw_read_lock(&fs->inode_table_sync[index].lock);
+    } else {
+        rw_write_lock(&fs->inode_table_sync[index].lock);
+    }
+}
+#endif
 
-void inode_unlock(int index) {
-    if (pthread_rwlock_unlock(&inode_table_locks[index]) != 0) {
+void inode_unlock(tfs_t *fs, int index) {
+#ifdef TFS_LOCK_PROFILE
+    lock_profile_release(&fs->inode_table_sync[index].lock);
+#endif
+    if (pthread_rwlock_unlock(&fs->inode_table_sync[index].lock) != 0) {
         perror("pthread_rwlock_unlock");
         exit(EXIT_FAILURE);
     }
 }
 
+/**
+ * Start an optimistic read of an inode's size and data block.
+ *
+ * Waits while a writer is inside its critical section (odd sequence number),
+ * without writing to any shared memory.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns the sequence number to pass to inode_read_retry().
+ */
+unsigned int inode_read_begin(tfs_t *fs, int inumber) {
+    unsigned int seq;
+    while ((seq = atomic_load_explicit(&fs->inode_table_sync[inumber].seq,
+                                       memory_order_acquire)) &
+           1) {
+        sched_yield();
+    }
+    return seq;
+}
+
+/**
+ * Finish an optimistic read started with inode_read_begin().
+ *
+ * Input:
+ *   - inumber: inode's number
+ *   - seq: value returned by inode_read_begin()
+ *
+ * Returns true if a writer raced with the read and it must be repeated.
+ */
+// Out of line: gcc rejects the fence once inlined under -fsanitize=thread
+__attribute__((noinline)) bool inode_read_retry(tfs_t *fs, int inumber,
+                                               unsigned int seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&fs->inode_table_sync[inumber].seq,
+                                memory_order_relaxed) != seq;
+}
+
+/**
+ * Copy file contents that a writer may be changing meanwhile (in an
+ * optimistic read), a word at a time where possible.
+ *
+ * Input:
+ *   - dest: where to copy to (private to the caller)
+ *   - src: file contents
+ *   - len: number of bytes to copy
+ */
+void data_copy_out(void *dest, void const *src, size_t len) {
+    char *d = dest;
+    char const *s = src;
+    while (len > 0 && (uintptr_t)s % sizeof(uint64_t) != 0) {
+        *d++ = __atomic_load_n(s++, __ATOMIC_RELAXED);
+        len--;
+    }
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        uint64_t const *src_word = (uint64_t const *)(void const *)s;
+        uint64_t word = __atomic_load_n(src_word, __ATOMIC_RELAXED);
+        memcpy(d, &word, sizeof(word));
+        d += sizeof(word);
+        s += sizeof(word);
+    }
+    while (len-- > 0) {
+        *d++ = __atomic_load_n(s++, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Copy into file contents that optimistic readers may be reading meanwhile
+ * (see data_copy_out). The caller must hold the inode's write lock.
+ *
+ * Input:
+ *   - dest: file contents
+ *   - src: where to copy from (private to the caller)
+ *   - len: number of bytes to copy
+ */
+void data_copy_in(void *dest, void const *src, size_t len) {
+    char *d = dest;
+    char const *s = src;
+    while (len > 0 && (uintptr_t)d % sizeof(uint64_t) != 0) {
+        __atomic_store_n(d++, *s++, __ATOMIC_RELAXED);
+        len--;
+    }
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, s, sizeof(word));
+        __atomic_store_n((uint64_t *)(void *)d, word, __ATOMIC_RELAXED);
+        d += sizeof(word);
+        s += sizeof(word);
+    }
+    while (len-- > 0) {
+        __atomic_store_n(d++, *s++, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Mark the start of a change to an inode's size, data block or contents.
+ * The caller must hold the inode's write lock.
+ */
+void inode_write_begin(tfs_t *fs, int inumber) {
+    atomic_fetch_add_explicit(&fs->inode_table_sync[inumber].seq, 1,
+                              memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * Mark the end of a change started with inode_write_begin().
+ */
+void inode_write_end(tfs_t *fs, int inumber) {
+    atomic_fetch_add_explicit(&fs->inode_table_sync[inumber].seq, 1,
+                              memory_order_release);
+}
+
+#ifndef TFS_LOCK_PROFILE
 void mutex_lock(pthread_mutex_t *lock) {
+#ifdef TFS_EVENTS
+    if (pthread_mutex_trylock(lock) == 0) {
+        return;
+    }
+#endif
+    EVENT_BEGIN(begin);
     if (pthread_mutex_lock(lock) != 0) {
         perror("pthread_mutex_lock");
         exit(EXIT_FAILURE);
     }
+    EVENT_END(begin, EVENT_LOCK_WAIT, (uintptr_t)lock);
 }
+#endif
 
 void mutex_unlock(pthread_mutex_t *lock) {
+#ifdef TFS_LOCK_PROFILE
+    lock_profile_release(lock);
+#endif
     if (pthread_mutex_unlock(lock) != 0) {
         perror("pthread_mutex_unlock");
         exit(EXIT_FAILURE);
     }
 }
-
-int blocks_taken_taken() {
-    int taken = 0;
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (free_blocks[i] == TAKEN) {
-            taken++;
-        }
-    }
-    return taken;
-}
\ No newline at end of file
@@ -2,8 +2,11 @@
 #define STATE_H
 
 #include "config.h"
+#include "lock_profile.h"
 #include "operations.h"
 
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,27 +14,43 @@
 
 /**
  * Directory entry
+ *
+ * d_inumber is -1 for a free entry and -2 for a deleted entry that lock-free
+ * lookups may still be reading (see clear_dir_entry).
  */
 typedef struct {
     char d_name[MAX_FILE_NAME];
-    int d_inumber;
+    atomic_int d_inumber;
 } dir_entry_t;
 
 typedef enum { T_FILE, T_DIRECTORY, T_LINK } inode_type;
 
 /**
  * Inode
+ *
+ * Inodes are cache-line aligned, so that writes to one file never invalidate
+ * the cache lines of another; the fields written on every write come first.
+ *
+ * The words written by readers too (each inode's lock and sequence number)
+ * are already kept apart, in an array of their own (see inode_sync_t). The
+ * rest is not split further into hot and cold arrays: an operation that
+ * writes a file's size or data block also reads its type and, for tiny files,
+ * its inline contents, so the split would cost each access a second line
+ * without keeping any two files apart that the padding doesn't already.
  */
 typedef struct {
 
-    inode_type i_node_type;
+    alignas(CACHE_LINE_SIZE) size_t i_size;
+    int i_data_block; // -1 if none (for files, also if kept in i_inline)
 
-    size_t i_size;
-    int i_data_block;
+    inode_type i_node_type;
 
     int hard_links;
     int inumber;
 
+    // Contents of files up to INODE_INLINE_SIZE bytes with no data block
+    char i_inline[INODE_INLINE_SIZE];
+
     // in a more complete FS, more fields could exist here
 } inode_t;
 
@@ -41,54 +60,115 @@ typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
  * Open file entry (in open file table)
  */
 typedef struct {
-    int of_inumber;
+    alignas(CACHE_LINE_SIZE) int of_inumber; // entries don't share lines
     size_t of_offset;
     pthread_mutex_t lock;
-} open_file_entry_t;
 
-int state_init(tfs_params);
-int state_destroy(void);
+    // Write-back buffer for TFS_O_BUFFERED (see tfs_write)
+    bool of_buffered;
+    char *of_wb_buf; // pending bytes [of_wb_start, of_wb_start + of_wb_len)
+    size_t of_wb_start;
+    size_t of_wb_len;
+
+    // Read-ahead state (see tfs_read)
+    size_t of_ra_next;      // offset at which a sequential read would start
+    size_t of_ra_window;    // read-ahead window in bytes, 0 if access is random
+    char *of_ra_buf;        // cached bytes [of_ra_start, of_ra_start + len)
+    size_t of_ra_start;
+    size_t of_ra_len;
+    size_t of_ra_size;      // file size when the cache was filled
+    unsigned int of_ra_seq; // inode sequence number when it was filled
+} open_file_entry_t;
 
-size_t state_block_size(void);
+tfs_t *state_init(tfs_params params);
+int state_destroy(tfs_t *fs);
+
+size_t state_block_size(tfs_t *fs);
+tfs_params const *state_params(tfs_t *fs);
+int state_inodes_taken(tfs_t *fs);
+int state_blocks_taken(tfs_t *fs);
+int state_files_open(tfs_t *fs);
+
+int inode_create(tfs_t *fs, inode_type n_type);
+void inode_delete(tfs_t *fs, int inumber);
+inode_t *inode_get(tfs_t *fs, int inumber);
+bool inode_inline_enabled(tfs_t *fs);
+
+int clear_dir_entry(tfs_t *fs, inode_t *inode, char const *sub_name,
+                    int *removed);
+int add_dir_entry(tfs_t *fs, inode_t *inode, char const *sub_name,
+                  int sub_inumber);
+int rename_dir_entry(tfs_t *fs, inode_t *inode, char const *old_name,
+                     char const *new_name, int *replaced);
+int find_in_dir(tfs_t *fs, inode_t const *inode, char const *sub_name);
+ssize_t dir_read_batch(tfs_t *fs, inode_t const *inode, size_t *cursor,
+                       tfs_dirent_t *entries, size_t max);
+ssize_t dir_stat_batch(tfs_t *fs, inode_t const *inode,
+                       char const *const names[], size_t count,
+                       tfs_stat_t out[]);
+
+int data_block_alloc(tfs_t *fs);
+void data_block_free(tfs_t *fs, int block_number);
+void *data_block_get(tfs_t *fs, int block_number);
+int data_block_put(tfs_t *fs, int block_number, bool dirty);
+bool data_block_dedup_enabled(tfs_t *fs);
+int data_block_write_dedup(tfs_t *fs, int *block_number, size_t offset,
+                           void const *buffer, size_t to_write, size_t size);
+int data_block_cache_stats(tfs_t *fs, tfs_cache_stats_t *stats);
+
+int add_to_open_file_table(tfs_t *fs, int inumber, size_t offset,
+                           bool buffered);
+void remove_from_open_file_table(tfs_t *fs, int fhandle);
+open_file_entry_t *get_open_file_entry(tfs_t *fs, int fhandle);
 
-int inode_create(inode_type n_type);
-void inode_delete(int inumber);
-inode_t *inode_get(int inumber);
+void rw_init(pthread_rwlock_t *lock, pthread_rwlockattr_t *attr);
 
-int clear_dir_entry(inode_t *inode, char const *sub_name);
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
-int find_in_dir(inode_t const *inode, char const *sub_name);
+void rw_destroy(pthread_rwlock_t *lock);
 
-static int n_blocks_taken;
+#ifdef TFS_LOCK_PROFILE
+// The lock wrappers pass their call site to the lock profiler
+#define rw_read_lock(lock) LOCK_PROFILE_SITE(lock_profile_rdlock, #lock, lock)
+#define rw_write_lock(lock) LOCK_PROFILE_SITE(lock_profile_wrlock, #lock, lock)
+#define mutex_lock(lock) LOCK_PROFILE_SITE(lock_profile_mutex, #lock, lock)
+#define inode_lock(fs, index, rw)                                              \
+    LOCK_PROFILE_SITE(inode_lock_at, "inode_table_sync", fs, index, rw)
+void inode_lock_at(tfs_t *fs, int index, int rw, lock_site_t *site);
+#else
+void rw_read_lock(pthread_rwlock_t *lock);
 
-int data_block_alloc(void);
-void data_block_free(int block_number);
-void *data_block_get(int block_number);
+void rw_write_lock(pthread_rwlock_t *lock);
 
-static int n_files_open = 0;
+void inode_lock(tfs_t *fs, int index, int rw);
 
-int add_to_open_file_table(int inumber, size_t offset);
-void remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
+void mutex_lock(pthread_mutex_t *lock);
+#endif
 
-void rw_init(pthread_rwlock_t *lock, pthread_rwlockattr_t *attr);
+void rw_unlock(pthread_rwlock_t *lock);
 
-void rw_destroy(pthread_rwlock_t *lock);
+void inode_unlock(tfs_t *fs, int index);
 
-void rw_read_lock(pthread_rwlock_t *lock);
+unsigned int inode_read_begin(tfs_t *fs, int inumber);
 
-void rw_write_lock(pthread_rwlock_t *lock);
+bool inode_read_retry(tfs_t *fs, int inumber, unsigned int seq);
 
-void rw_unlock(pthread_rwlock_t *lock);
+void inode_write_begin(tfs_t *fs, int inumber);
 
-void inode_lock(int index, int rw);
+void inode_write_end(tfs_t *fs, int inumber);
 
-void inode_unlock(int index);
+/*
+ * The inode fields and file contents that optimistic readers (see
+ * inode_read_begin) may read while a writer changes them are read and
+ * written with relaxed atomic accesses: the sequence number decides whether
+ * what was read is consistent, and the accesses themselves are not racy.
+ */
+#define INODE_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define INODE_STORE(field, value)                                              \
+    __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
 
-void mutex_unlock(pthread_mutex_t *lock);
+void data_copy_out(void *dest, void const *src, size_t len);
 
-void mutex_lock(pthread_mutex_t *lock);
+void data_copy_in(void *dest, void const *src, size_t len);
 
-int blocks_taken_taken();
+void mutex_unlock(pthread_mutex_t *lock);
 
 #endif // STATE_H
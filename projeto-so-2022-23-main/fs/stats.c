@@ -0,0 +1,70 @@
+#include "stats.h"
+#include <string.h>
+#include <time.h>
+
+static atomic_uint next_slot = 0;
+static _Thread_local int thread_slot = -1;
+
+uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void stats_reset(stats_t *stats) {
+    for (size_t s = 0; s < STATS_SLOTS; s++) {
+        for (size_t op = 0; op < TFS_OP_COUNT; op++) {
+            stats_counters_t *counters = &stats->slots[s].ops[op];
+            atomic_store(&counters->calls, 0);
+            atomic_store(&counters->errors, 0);
+            atomic_store(&counters->bytes, 0);
+            for (size_t i = 0; i < TFS_LATENCY_BUCKETS; i++) {
+                atomic_store(&counters->latency[i], 0);
+            }
+        }
+    }
+}
+
+void stats_record(stats_t *stats, tfs_op_t op, uint64_t ns, uint64_t bytes,
+                  bool ok) {
+    if (thread_slot == -1) {
+        thread_slot = (int)(atomic_fetch_add(&next_slot, 1) % STATS_SLOTS);
+    }
+    stats_counters_t *counters = &stats->slots[thread_slot].ops[op];
+
+    size_t bucket = ns == 0 ? 0 : 63 - (size_t)__builtin_clzll(ns);
+    if (bucket >= TFS_LATENCY_BUCKETS) {
+        bucket = TFS_LATENCY_BUCKETS - 1;
+    }
+
+    // Slots may be shared by several threads, hence the atomic increments
+    atomic_fetch_add_explicit(&counters->calls, 1, memory_order_relaxed);
+    if (!ok) {
+        atomic_fetch_add_explicit(&counters->errors, 1, memory_order_relaxed);
+    }
+    if (bytes > 0) {
+        atomic_fetch_add_explicit(&counters->bytes, bytes,
+                                  memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&counters->latency[bucket], 1,
+                              memory_order_relaxed);
+}
+
+void stats_read(stats_t *stats, tfs_op_stats_t ops[TFS_OP_COUNT]) {
+    memset(ops, 0, TFS_OP_COUNT * sizeof(tfs_op_stats_t));
+    for (size_t s = 0; s < STATS_SLOTS; s++) {
+        for (size_t op = 0; op < TFS_OP_COUNT; op++) {
+            stats_counters_t *counters = &stats->slots[s].ops[op];
+            ops[op].calls += atomic_load_explicit(&counters->calls,
+                                                  memory_order_relaxed);
+            ops[op].errors += atomic_load_explicit(&counters->errors,
+                                                   memory_order_relaxed);
+            ops[op].bytes += atomic_load_explicit(&counters->bytes,
+                                                  memory_order_relaxed);
+            for (size_t i = 0; i < TFS_LATENCY_BUCKETS; i++) {
+                ops[op].latency[i] += atomic_load_explicit(
+                    &counters->latency[i], memory_order_relaxed);
+            }
+        }
+    }
+}
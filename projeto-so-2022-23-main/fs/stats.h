@@ -0,0 +1,48 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "config.h"
+#include "operations.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counter slots; threads take them round robin, so that they rarely write to
+// the same cache lines
+#define STATS_SLOTS (32)
+
+typedef struct {
+    atomic_ulong calls;
+    atomic_ulong errors;
+    atomic_ulong bytes;
+    atomic_ulong latency[TFS_LATENCY_BUCKETS];
+} stats_counters_t;
+
+typedef struct {
+    alignas(CACHE_LINE_SIZE) stats_counters_t ops[TFS_OP_COUNT];
+} stats_slot_t;
+
+/**
+ * Call counters (see tfs_get_stats).
+ */
+typedef struct {
+    stats_slot_t slots[STATS_SLOTS];
+} stats_t;
+
+/**
+ * Monotonic clock, in nanoseconds.
+ */
+uint64_t stats_clock(void);
+
+void stats_reset(stats_t *stats);
+void stats_record(stats_t *stats, tfs_op_t op, uint64_t ns, uint64_t bytes,
+                  bool ok);
+
+/**
+ * Add up the counters of every slot.
+ */
+void stats_read(stats_t *stats, tfs_op_stats_t ops[TFS_OP_COUNT]);
+
+#endif // STATS_H
@@ -0,0 +1,154 @@
+#include "trace.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_NAME_MAX (255)
+
+// Traced calls check this flag only; the file is guarded by trace_lock
+static atomic_bool tracing = false;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static uint64_t trace_epoch;
+
+static atomic_uint thread_count = 0;
+static _Thread_local uint32_t thread_id = 0;
+
+static void lock(void) {
+    if (pthread_mutex_lock(&trace_lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void unlock(void) {
+    if (pthread_mutex_unlock(&trace_lock) != 0) {
+        perror("pthread_mutex_unlock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int trace_start(char const *path, tfs_params const *params) {
+    tfs_trace_header_t header = {
+        .max_inode_count = params->max_inode_count,
+        .max_block_count = params->max_block_count,
+        .max_open_files_count = params->max_open_files_count,
+        .block_size = params->block_size,
+        .block_cache_count = params->block_cache_count,
+        .compressed_pool_size = params->compressed_pool_size,
+        .shard_count = params->shard_count,
+        .dedup_blocks = params->dedup_blocks,
+        .inline_small_files = params->inline_small_files,
+        .huge_pages = params->huge_pages,
+    };
+    memcpy(header.magic, TFS_TRACE_MAGIC, sizeof(header.magic));
+
+    lock();
+    if (trace_file != NULL) {
+        unlock();
+        return -1; // already tracing
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(&header, sizeof(header), 1, f) != 1) {
+        if (f != NULL) {
+            fclose(f);
+        }
+        unlock();
+        return -1;
+    }
+
+    trace_file = f;
+    trace_epoch = stats_clock();
+    atomic_store(&tracing, true);
+    unlock();
+    return 0;
+}
+
+int trace_stop(void) {
+    lock();
+    if (trace_file == NULL) {
+        unlock();
+        return -1;
+    }
+
+    atomic_store(&tracing, false);
+    int res = fclose(trace_file) == 0 ? 0 : -1;
+    trace_file = NULL;
+    unlock();
+    return res;
+}
+
+bool trace_enabled(void) {
+    return atomic_load_explicit(&tracing, memory_order_relaxed);
+}
+
+void trace_record(tfs_op_t op, uint64_t begin, uint64_t end, int arg,
+                  uint64_t len, int64_t result, char const *name,
+                  char const *name2) {
+    if (!trace_enabled()) {
+        return;
+    }
+
+    uint64_t duration = end - begin;
+    if (thread_id == 0) {
+        thread_id = atomic_fetch_add(&thread_count, 1) + 1;
+    }
+
+    size_t name_len = name == NULL ? 0 : strlen(name);
+    size_t name2_len = name2 == NULL ? 0 : strlen(name2);
+    if (name_len > TRACE_NAME_MAX) {
+        name_len = TRACE_NAME_MAX;
+    }
+    if (name2_len > TRACE_NAME_MAX) {
+        name2_len = TRACE_NAME_MAX;
+    }
+
+    tfs_trace_record_t record = {
+        .duration_ns = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration,
+        .thread = thread_id,
+        .len = len,
+        .result = result,
+        .arg = arg,
+        .op = (uint8_t)op,
+        .name_len = (uint8_t)name_len,
+        .name2_len = (uint8_t)name2_len,
+    };
+
+    // Records are written whole, so that concurrent calls never interleave
+    char buffer[sizeof(record) + 2 * TRACE_NAME_MAX];
+    if (name_len > 0) {
+        memcpy(buffer + sizeof(record), name, name_len);
+    }
+    if (name2_len > 0) {
+        memcpy(buffer + sizeof(record) + name_len, name2, name2_len);
+    }
+
+    lock();
+    if (trace_file != NULL) {
+        // The trace may have been restarted since begin
+        record.start_ns = begin > trace_epoch ? begin - trace_epoch : 0;
+        memcpy(buffer, &record, sizeof(record));
+        fwrite(buffer, sizeof(record) + name_len + name2_len, 1, trace_file);
+    }
+    unlock();
+}
+
+int trace_read_record(FILE *f, tfs_trace_record_t *record, char *name,
+                      char *name2) {
+    size_t read = fread(record, 1, sizeof(*record), f);
+    if (read == 0 && feof(f)) {
+        return 0;
+    }
+    if (read != sizeof(*record) || record->op >= TFS_OP_COUNT ||
+        fread(name, 1, record->name_len, f) != record->name_len ||
+        fread(name2, 1, record->name2_len, f) != record->name2_len) {
+        return -1;
+    }
+    name[record->name_len] = '\0';
+    name2[record->name2_len] = '\0';
+    return 1;
+}
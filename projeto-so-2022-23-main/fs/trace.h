@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "operations.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Binary traces of the calls to the operations.h functions that take no
+ * instance (see tfs_trace_start), replayed by bench/tfs_replay.
+ *
+ * A trace is a tfs_trace_header_t followed by one tfs_trace_record_t per call,
+ * in the order the calls returned, each followed by its path names (without
+ * terminators). Integers are in the byte order of the machine that wrote it.
+ */
+
+#define TFS_TRACE_MAGIC "TFSTRAC1"
+
+/**
+ * Parameters of the traced instance (all but the image path).
+ */
+typedef struct {
+    char magic[8];
+    uint64_t max_inode_count;
+    uint64_t max_block_count;
+    uint64_t max_open_files_count;
+    uint64_t block_size;
+    uint64_t block_cache_count;
+    uint64_t compressed_pool_size;
+    uint64_t shard_count;
+    uint8_t dedup_blocks;
+    uint8_t inline_small_files;
+    uint8_t huge_pages;
+    uint8_t padding[5];
+} tfs_trace_header_t;
+
+typedef struct {
+    // Time of the call since the trace started, and how long it took
+    uint64_t start_ns;
+    uint32_t duration_ns;
+    // Calling thread, numbered from 1 in order of their first traced call
+    uint32_t thread;
+    // Bytes to write or read, size of the external file copied, entries to
+    // list, or files to look up
+    uint64_t len;
+    int64_t result;
+    // Mode of an open, file handle of the calls that take one
+    int32_t arg;
+    uint8_t op;
+    // Path names (two for links and renames, the source file first for
+    // copies, the first two of those looked up by tfs_stat_many)
+    uint8_t name_len;
+    uint8_t name2_len;
+    uint8_t padding;
+} tfs_trace_record_t;
+
+int trace_start(char const *path, tfs_params const *params);
+int trace_stop(void);
+
+bool trace_enabled(void);
+
+/**
+ * Append a call, which ran between stats_clock() times begin and end, to the
+ * trace (if tracing). Path names longer than 255 bytes are truncated.
+ */
+void trace_record(tfs_op_t op, uint64_t begin, uint64_t end, int arg,
+                  uint64_t len, int64_t result, char const *name,
+                  char const *name2);
+
+/**
+ * Read a record and its path names (buffers of at least 256 bytes).
+ *
+ * Returns 1 if successful, 0 at the end of the trace, -1 otherwise.
+ */
+int trace_read_record(FILE *f, tfs_trace_record_t *record, char *name,
+                      char *name2);
+
+#endif // TRACE_H
@@ -0,0 +1,102 @@
+#define _DEFAULT_SOURCE // syscall
+
+#include "protocol.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Checks of the ring before going to sleep (each costs a few nanoseconds,
+// a futex wakeup a few microseconds)
+#define SHM_SPIN_COUNT (4096)
+
+// Longest sleep of shm_futex_wait, after which the peer is checked
+#define SHM_WAIT_NS (100 * 1000 * 1000)
+
+static_assert(sizeof(atomic_uint) == sizeof(uint32_t),
+              "futexes are 32-bit words");
+
+int pipe_read_all(int fd, void *buffer, size_t len) {
+    char *bytes = buffer;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t res = read(fd, bytes + done, len - done);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+        if (res == -1) {
+            return -1;
+        }
+        if (res == 0) {
+            return done == 0 ? 0 : -1; // end of file mid-message
+        }
+        done += (size_t)res;
+    }
+    return 1;
+}
+
+int pipe_write_all(int fd, void const *buffer, size_t len) {
+    char const *bytes = buffer;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t res = write(fd, bytes + done, len - done);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+        if (res == -1) {
+            return -1;
+        }
+        done += (size_t)res;
+    }
+    return 0;
+}
+
+void shm_futex_wait(atomic_uint *word, unsigned int value) {
+    struct timespec timeout = {0, SHM_WAIT_NS};
+    // Not FUTEX_WAIT_PRIVATE: the word is shared with another process
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+void shm_futex_wake(atomic_uint *word) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+int shm_ring_wait(tfs_shm_ring_t *ring, pid_t peer) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    for (int i = 0; i < SHM_SPIN_COUNT; i++) {
+        if (atomic_load(&ring->head) != tail) {
+            return 0;
+        }
+    }
+
+    for (;;) {
+        // The producer checks sleeping after publishing, so either it sees
+        // the flag or this thread sees the new head
+        atomic_store(&ring->sleeping, 1);
+        if (atomic_load(&ring->head) == tail) {
+            shm_futex_wait(&ring->head, tail);
+        }
+        atomic_store(&ring->sleeping, 0);
+
+        if (atomic_load(&ring->head) != tail) {
+            return 0;
+        }
+        if (peer > 0 && kill(peer, 0) == -1 && errno == ESRCH) {
+            return -1;
+        }
+    }
+}
+
+void shm_ring_publish(tfs_shm_ring_t *ring) {
+    atomic_fetch_add(&ring->head, 1);
+    if (atomic_load(&ring->sleeping)) {
+        shm_futex_wake(&ring->head);
+    }
+}
+
+void shm_ring_release(tfs_shm_ring_t *ring) {
+    atomic_fetch_add_explicit(&ring->tail, 1, memory_order_release);
+}
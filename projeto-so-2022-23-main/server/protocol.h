@@ -0,0 +1,151 @@
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include <assert.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Wire protocol between TécnicoFS clients and the server (see tfs_server.c).
+ *
+ * Every message is a fixed-size struct, written with a single write(), so that
+ * several clients can share the server's registration pipe. A client registers
+ * by sending TFS_OP_CODE_MOUNT there, naming its session pipes
+ * ("<path>.req" and "<path>.rep"); all its other requests go to its own
+ * request pipe, and are answered, in order, through its reply pipe.
+ *
+ * Alternatively, a client registers with TFS_OP_CODE_MOUNT_SHM, naming a file
+ * ("<path>.shm") holding a tfs_shm_region_t, which both processes map; the
+ * same requests and replies then go through rings in that region, so read and
+ * write payloads are copied once, from or to the ring slots.
+ */
+
+typedef enum {
+    TFS_OP_CODE_MOUNT = 1,
+    TFS_OP_CODE_UNMOUNT = 2,
+    TFS_OP_CODE_OPEN = 3,
+    TFS_OP_CODE_CLOSE = 4,
+    TFS_OP_CODE_WRITE = 5,
+    TFS_OP_CODE_READ = 6,
+    TFS_OP_CODE_FLUSH = 7,
+    TFS_OP_CODE_UNLINK = 8,
+    TFS_OP_CODE_LINK = 9,
+    TFS_OP_CODE_SYM_LINK = 10,
+    TFS_OP_CODE_SHUTDOWN = 11,
+    TFS_OP_CODE_MOUNT_SHM = 12,
+} tfs_op_code_t;
+
+// Size of path names in requests (pipe paths and TécnicoFS names)
+#define TFS_PATH_SIZE (256)
+
+// Maximum payload of a single read or write request
+#define TFS_IO_SIZE (512)
+
+/**
+ * Request; unused fields are ignored.
+ */
+typedef struct {
+    uint8_t op_code;
+    int32_t fhandle;
+    int32_t mode;
+    uint32_t len; // bytes to read or write, up to TFS_IO_SIZE
+    char name[TFS_PATH_SIZE];
+    char name2[TFS_PATH_SIZE]; // link name (TFS_OP_CODE_*LINK)
+    char data[TFS_IO_SIZE];
+} tfs_request_t;
+
+/**
+ * Reply to a request on a session's request pipe.
+ */
+typedef struct {
+    int64_t result; // return value of the operation
+    char data[TFS_IO_SIZE];
+} tfs_reply_t;
+
+// Writes of up to PIPE_BUF bytes to a pipe are never interleaved
+static_assert(sizeof(tfs_request_t) <= PIPE_BUF,
+              "requests must be written atomically");
+
+// Slots in each ring of a shared memory session; clients never have more
+// requests than this waiting for replies
+#define TFS_SHM_RING_SIZE (16)
+
+/**
+ * Single-producer single-consumer ring indices; slot i % TFS_SHM_RING_SIZE
+ * holds the i-th element. The producer and consumer counters are kept on
+ * separate cache lines.
+ */
+typedef struct {
+    alignas(64) atomic_uint head; // elements published by the producer
+    atomic_uint sleeping;         // the consumer may be waiting on head
+    alignas(64) atomic_uint tail; // elements released by the consumer
+} tfs_shm_ring_t;
+
+/**
+ * Shared memory of a session: the client produces requests and the server
+ * produces replies, the reply to request i going in slot i of its ring.
+ */
+typedef struct {
+    int32_t client_pid;
+    int32_t server_pid;        // set by the server before attached
+    atomic_uint attached;      // 1 once a server worker serves the session
+    tfs_shm_ring_t requests_ring;
+    tfs_shm_ring_t replies_ring;
+    tfs_request_t requests[TFS_SHM_RING_SIZE];
+    tfs_reply_t replies[TFS_SHM_RING_SIZE];
+} tfs_shm_region_t;
+
+/**
+ * Wait while *word == value, for a short while at most (wakeups may be
+ * spurious). Works across processes sharing the memory.
+ */
+void shm_futex_wait(atomic_uint *word, unsigned int value);
+
+/**
+ * Wake all the threads, of any process, waiting on word.
+ */
+void shm_futex_wake(atomic_uint *word);
+
+/**
+ * Wait (as the consumer) until a ring has an element, spinning briefly before
+ * sleeping.
+ *
+ * Input:
+ *   - ring: the ring
+ *   - peer: process id of the producer, checked while waiting (0 for none)
+ *
+ * Returns 0 once the element at the tail is available, -1 if the producer
+ * process went away.
+ */
+int shm_ring_wait(tfs_shm_ring_t *ring, pid_t peer);
+
+/**
+ * Publish (as the producer) the element at the head of a ring, waking the
+ * consumer if it is sleeping.
+ */
+void shm_ring_publish(tfs_shm_ring_t *ring);
+
+/**
+ * Release (as the consumer) the element at the tail of a ring.
+ */
+void shm_ring_release(tfs_shm_ring_t *ring);
+
+/**
+ * Read exactly len bytes from a pipe, retrying interrupted or partial reads.
+ *
+ * Returns 1 if successful, 0 at end of file, -1 otherwise.
+ */
+int pipe_read_all(int fd, void *buffer, size_t len);
+
+/**
+ * Write exactly len bytes to a pipe, retrying interrupted or partial writes.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int pipe_write_all(int fd, void const *buffer, size_t len);
+
+#endif // SERVER_PROTOCOL_H
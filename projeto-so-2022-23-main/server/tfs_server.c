@@ -0,0 +1,384 @@
+#include "fs/operations.h"
+#include "server/protocol.h"
+#include "utils/logging.h"
+#include "utils/producer-consumer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * TécnicoFS server: exposes the operations.h API to other processes.
+ *
+ * The main thread reads registrations from the server pipe and queues the new
+ * sessions in a bounded producer-consumer queue, from which a pool of
+ * max_sessions worker threads takes them. Each worker then serves the requests
+ * of its session, in order, until the client unmounts (clients may send
+ * several requests before reading their replies), through either the session's
+ * pipes or its shared memory rings.
+ */
+
+// File handles a session may have open at once
+#define SESSION_MAX_OPEN_FILES (64)
+
+typedef struct {
+    char pipe_path[TFS_PATH_SIZE]; // "<path>.req" and "<path>.rep"
+    bool shm;                      // "<path>.shm" instead
+
+    // Handles opened by the session (-1 if free): sessions can only use their
+    // own, and those left open are closed when the session ends
+    int handles[SESSION_MAX_OPEN_FILES];
+} session_t;
+
+/**
+ * Slot of a handle in a session's handles, -1 if the session does not own it.
+ */
+static int session_handle(session_t const *session, int fhandle) {
+    for (int i = 0; fhandle >= 0 && i < SESSION_MAX_OPEN_FILES; i++) {
+        if (session->handles[i] == fhandle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Open a file on behalf of a session.
+ */
+static int session_open(session_t *session, char const *name,
+                        tfs_file_mode_t mode) {
+    for (int i = 0; i < SESSION_MAX_OPEN_FILES; i++) {
+        if (session->handles[i] == -1) {
+            session->handles[i] = tfs_open(name, mode);
+            return session->handles[i];
+        }
+    }
+    return -1; // too many open files
+}
+
+/**
+ * Close the files a session left open.
+ */
+static void session_close_all(session_t *session) {
+    for (int i = 0; i < SESSION_MAX_OPEN_FILES; i++) {
+        if (session->handles[i] != -1) {
+            tfs_close(session->handles[i]);
+            session->handles[i] = -1;
+        }
+    }
+}
+
+/**
+ * Run a request on the file system.
+ *
+ * Input:
+ *   - session: the session sending the request
+ *   - request: the request (its data field is not used)
+ *   - data: the data to write
+ *   - reply_data: where to store the data read
+ *
+ * Returns the operation's result, to be sent back in reply.
+ */
+static int64_t handle_request(session_t *session, tfs_request_t *request,
+                              char const *data, char *reply_data) {
+    // Never trust lengths and strings coming from another process
+    size_t len = request->len < TFS_IO_SIZE ? request->len : TFS_IO_SIZE;
+    request->name[TFS_PATH_SIZE - 1] = '\0';
+    request->name2[TFS_PATH_SIZE - 1] = '\0';
+
+    int slot = session_handle(session, request->fhandle);
+    switch ((tfs_op_code_t)request->op_code) {
+    case TFS_OP_CODE_CLOSE:
+    case TFS_OP_CODE_WRITE:
+    case TFS_OP_CODE_READ:
+    case TFS_OP_CODE_FLUSH:
+        if (slot == -1) {
+            return -1; // not opened by this session
+        }
+        break;
+    case TFS_OP_CODE_MOUNT:
+    case TFS_OP_CODE_UNMOUNT:
+    case TFS_OP_CODE_OPEN:
+    case TFS_OP_CODE_UNLINK:
+    case TFS_OP_CODE_LINK:
+    case TFS_OP_CODE_SYM_LINK:
+    case TFS_OP_CODE_SHUTDOWN:
+    case TFS_OP_CODE_MOUNT_SHM:
+    default:
+        break;
+    }
+
+    switch ((tfs_op_code_t)request->op_code) {
+    case TFS_OP_CODE_OPEN:
+        return session_open(session, request->name,
+                            (tfs_file_mode_t)request->mode);
+    case TFS_OP_CODE_CLOSE:
+        session->handles[slot] = -1;
+        return tfs_close(request->fhandle);
+    case TFS_OP_CODE_WRITE:
+        return tfs_write(request->fhandle, data, len);
+    case TFS_OP_CODE_READ:
+        return tfs_read(request->fhandle, reply_data, len);
+    case TFS_OP_CODE_FLUSH:
+        return tfs_flush(request->fhandle);
+    case TFS_OP_CODE_UNLINK:
+        return tfs_unlink(request->name);
+    case TFS_OP_CODE_LINK:
+        return tfs_link(request->name, request->name2);
+    case TFS_OP_CODE_SYM_LINK:
+        return tfs_sym_link(request->name, request->name2);
+    case TFS_OP_CODE_UNMOUNT:
+        return 0;
+    case TFS_OP_CODE_MOUNT:
+    case TFS_OP_CODE_MOUNT_SHM:
+    case TFS_OP_CODE_SHUTDOWN:
+    default:
+        return -1; // only valid on the server pipe
+    }
+}
+
+/**
+ * Serve the requests of a pipe session until the client unmounts or goes
+ * away.
+ */
+static void serve_pipe_session(session_t *session) {
+    char path[TFS_PATH_SIZE + 8];
+
+    // Same opening order as the client (tfs_mount), or both would block
+    snprintf(path, sizeof(path), "%s.req", session->pipe_path);
+    int request_fd = open(path, O_RDONLY);
+    if (request_fd == -1) {
+        WARN("failed to open %s: %s", path, strerror(errno));
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s.rep", session->pipe_path);
+    int reply_fd = open(path, O_WRONLY);
+    if (reply_fd == -1) {
+        WARN("failed to open %s: %s", path, strerror(errno));
+        close(request_fd);
+        return;
+    }
+
+    LOG("session %s started", session->pipe_path);
+
+    tfs_request_t request;
+    tfs_reply_t reply;
+    while (pipe_read_all(request_fd, &request, sizeof(request)) == 1) {
+        reply.result =
+            handle_request(session, &request, request.data, reply.data);
+        if (pipe_write_all(reply_fd, &reply, sizeof(reply)) == -1) {
+            break; // the client went away
+        }
+        if (request.op_code == TFS_OP_CODE_UNMOUNT) {
+            break;
+        }
+    }
+
+    LOG("session %s ended", session->pipe_path);
+
+    close(reply_fd);
+    close(request_fd);
+}
+
+/**
+ * Serve the requests of a shared memory session until the client unmounts or
+ * goes away.
+ */
+static void serve_shm_session(session_t *session) {
+    char path[TFS_PATH_SIZE + 8];
+    snprintf(path, sizeof(path), "%s.shm", session->pipe_path);
+
+    // Not following links, so that a client can only have its own file mapped
+    int fd = open(path, O_RDWR | O_NOFOLLOW);
+    if (fd == -1) {
+        WARN("failed to open %s: %s", path, strerror(errno));
+        return;
+    }
+    // Touching the mapping past the end of the file would fault
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        st.st_size < (off_t)sizeof(tfs_shm_region_t)) {
+        WARN("refusing %s: not a shared memory region", path);
+        close(fd);
+        return;
+    }
+    tfs_shm_region_t *region = mmap(NULL, sizeof(tfs_shm_region_t),
+                                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        WARN("failed to map %s: %s", path, strerror(errno));
+        return;
+    }
+
+    pid_t client = region->client_pid;
+    region->server_pid = getpid();
+    atomic_store(&region->attached, 1);
+    shm_futex_wake(&region->attached);
+
+    LOG("session %s started", path);
+
+    for (;;) {
+        if (shm_ring_wait(&region->requests_ring, client) != 0) {
+            break; // the client went away
+        }
+
+        unsigned int tail = atomic_load(&region->requests_ring.tail);
+        unsigned int head = atomic_load(&region->replies_ring.head);
+        tfs_request_t *shared = &region->requests[tail % TFS_SHM_RING_SIZE];
+        tfs_reply_t *reply = &region->replies[head % TFS_SHM_RING_SIZE];
+
+        // The client could change the request while it is handled, so the
+        // fields checked by handle_request are copied (but not the payload)
+        tfs_request_t request;
+        memcpy(&request, shared, offsetof(tfs_request_t, data));
+
+        reply->result =
+            handle_request(session, &request, shared->data, reply->data);
+        shm_ring_release(&region->requests_ring);
+        shm_ring_publish(&region->replies_ring);
+
+        if (request.op_code == TFS_OP_CODE_UNMOUNT) {
+            break;
+        }
+    }
+
+    LOG("session %s ended", path);
+
+    munmap(region, sizeof(tfs_shm_region_t));
+}
+
+static void *worker_loop(void *arg) {
+    pc_queue_t *sessions = arg;
+
+    for (;;) {
+        session_t *session = pcq_dequeue(sessions);
+        if (session == NULL) {
+            return NULL; // shutting down
+        }
+
+        for (int i = 0; i < SESSION_MAX_OPEN_FILES; i++) {
+            session->handles[i] = -1;
+        }
+
+        if (session->shm) {
+            serve_shm_session(session);
+        } else {
+            serve_pipe_session(session);
+        }
+
+        session_close_all(session);
+        free(session);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <pipe_path> <max_sessions>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char const *pipe_path = argv[1];
+    char *end;
+    unsigned long max_sessions = strtoul(argv[2], &end, 10);
+    if (*end != '\0' || max_sessions == 0 || max_sessions > 1024) {
+        fprintf(stderr, "invalid max_sessions: %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    // Clients that go away must not kill the server
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        PANIC("failed to ignore SIGPIPE");
+    }
+
+    if (tfs_init(NULL) != 0) {
+        PANIC("failed to initialize TécnicoFS");
+    }
+
+    if (unlink(pipe_path) != 0 && errno != ENOENT) {
+        PANIC("failed to remove %s: %s", pipe_path, strerror(errno));
+    }
+    if (mkfifo(pipe_path, 0640) != 0) {
+        PANIC("failed to create %s: %s", pipe_path, strerror(errno));
+    }
+
+    pc_queue_t sessions;
+    if (pcq_create(&sessions, max_sessions) != 0) {
+        PANIC("failed to create the session queue");
+    }
+
+    pthread_t *workers = malloc(max_sessions * sizeof(pthread_t));
+    if (workers == NULL) {
+        PANIC("failed to allocate the worker threads");
+    }
+    for (size_t i = 0; i < max_sessions; i++) {
+        if (pthread_create(&workers[i], NULL, worker_loop, &sessions) != 0) {
+            PANIC("failed to create a worker thread");
+        }
+    }
+
+    // Keeping a writer open means reads never see end of file between clients
+    int server_fd = open(pipe_path, O_RDONLY);
+    int dummy_fd = open(pipe_path, O_WRONLY);
+    if (server_fd == -1 || dummy_fd == -1) {
+        PANIC("failed to open %s: %s", pipe_path, strerror(errno));
+    }
+
+    LOG("serving on %s with %lu workers", pipe_path, max_sessions);
+
+    tfs_request_t request;
+    while (pipe_read_all(server_fd, &request, sizeof(request)) == 1) {
+        if (request.op_code == TFS_OP_CODE_SHUTDOWN) {
+            break;
+        }
+        if (request.op_code != TFS_OP_CODE_MOUNT &&
+            request.op_code != TFS_OP_CODE_MOUNT_SHM) {
+            WARN("unexpected request %d on the server pipe", request.op_code);
+            continue;
+        }
+
+        session_t *session = malloc(sizeof(session_t));
+        if (session == NULL) {
+            WARN("failed to allocate a session");
+            continue;
+        }
+        memcpy(session->pipe_path, request.name, TFS_PATH_SIZE);
+        session->pipe_path[TFS_PATH_SIZE - 1] = '\0';
+        session->shm = request.op_code == TFS_OP_CODE_MOUNT_SHM;
+
+        if (pcq_enqueue(&sessions, session) != 0) {
+            PANIC("failed to queue a session");
+        }
+    }
+
+    // Sessions already queued are still served before the workers stop
+    for (size_t i = 0; i < max_sessions; i++) {
+        if (pcq_enqueue(&sessions, NULL) != 0) {
+            PANIC("failed to queue a session");
+        }
+    }
+    for (size_t i = 0; i < max_sessions; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    pcq_destroy(&sessions);
+    close(dummy_fd);
+    close(server_fd);
+    unlink(pipe_path);
+
+    if (tfs_destroy() != 0) {
+        PANIC("failed to destroy TécnicoFS");
+    }
+
+    LOG("shut down");
+    return EXIT_SUCCESS;
+}
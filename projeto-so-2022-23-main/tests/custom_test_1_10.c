@@ -0,0 +1,112 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEXT_FILES 8
+#define MAX_FILES 20
+#define FILE_LEN 1000
+
+// This test keeps the data blocks compressed in a pool much smaller than the
+// data written to it, with room for only a few of them uncompressed, and
+// checks that contents survive eviction and that writes fail cleanly once
+// the pool is full
+
+void text_contents(int i, char *buffer) {
+    int len = 0;
+    for (int line = 0; len < FILE_LEN; line++) {
+        len += snprintf(buffer + len, (size_t)(FILE_LEN + 1 - len),
+                        "file %d, line %d of compressible text\n", i, line);
+    }
+}
+
+void random_contents(char *buffer) {
+    for (int i = 0; i < FILE_LEN; i++) {
+        buffer[i] = (char)rand();
+    }
+}
+
+void check_file(char const *path, char const *contents) {
+    char buffer[FILE_LEN];
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, FILE_LEN) == FILE_LEN);
+    assert(memcmp(buffer, contents, FILE_LEN) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 64;
+    params.compressed_pool_size = 8 * 1024;
+    params.block_cache_count = 4;
+    assert(tfs_init(&params) != -1);
+
+    char path[16];
+    char contents[FILE_LEN + 1];
+
+    for (int i = 0; i < TEXT_FILES; i++) {
+        snprintf(path, sizeof(path), "/t%d", i);
+        text_contents(i, contents);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, contents, FILE_LEN) == FILE_LEN);
+        assert(tfs_close(f) != -1);
+    }
+
+    for (int i = 0; i < TEXT_FILES; i++) {
+        snprintf(path, sizeof(path), "/t%d", i);
+        text_contents(i, contents);
+        check_file(path, contents);
+    }
+
+    // Incompressible data fills the pool long before the blocks run out
+    srand(1);
+    int written = 0;
+    for (; written < MAX_FILES; written++) {
+        snprintf(path, sizeof(path), "/r%d", written);
+        random_contents(contents);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        ssize_t res = tfs_write(f, contents, FILE_LEN);
+        assert(tfs_close(f) != -1);
+        if (res == -1) {
+            break;
+        }
+        assert(res == FILE_LEN);
+    }
+    assert(written > 0 && written < MAX_FILES);
+
+    srand(1);
+    for (int i = 0; i < written; i++) {
+        snprintf(path, sizeof(path), "/r%d", i);
+        random_contents(contents);
+        check_file(path, contents);
+    }
+
+    for (int i = 0; i < TEXT_FILES; i++) {
+        snprintf(path, sizeof(path), "/t%d", i);
+        text_contents(i, contents);
+        check_file(path, contents);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    // Only one backing store can be chosen
+    params.block_image_path = "tests/custom_test_1_10.img";
+    assert(tfs_init(&params) == -1);
+
+    // Without a single block for the root directory, the init fails (rather
+    // than hang while deleting the root inode)
+    params = tfs_default_params();
+    params.max_block_count = 0;
+    assert(tfs_init(&params) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_NUM 20
+#define BLOCK_COUNT 8
+
+// This test shares identical blocks between files, so that many more files
+// than there are data blocks can hold the same contents, and checks that
+// modifying one of them doesn't affect the others
+
+char const template[] = "Template record, identical in every file.";
+char const changed[] = "Record of f0, changed after being shared.";
+
+void check_file(char const *path, char const *contents, size_t len) {
+    char buffer[64];
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)len);
+    assert(memcmp(buffer, contents, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_block_count = BLOCK_COUNT;
+    params.dedup_blocks = true;
+    assert(tfs_init(&params) != -1);
+
+    char path[16];
+
+    // Without sharing, the root directory plus 20 files wouldn't fit
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, template, sizeof(template)) == sizeof(template));
+        assert(tfs_close(f) != -1);
+    }
+
+    // Copy-on-write of the shared block
+    int f = tfs_open("/f0", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, changed, sizeof(changed)) == sizeof(changed));
+    assert(tfs_close(f) != -1);
+
+    check_file("/f0", changed, sizeof(changed));
+    for (int i = 1; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        check_file(path, template, sizeof(template));
+    }
+
+    // Appending in pieces ends up sharing the block again
+    f = tfs_open("/f0", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, template, 10) == 10);
+    assert(tfs_write(f, template + 10, sizeof(template) - 10) ==
+           sizeof(template) - 10);
+    assert(tfs_close(f) != -1);
+    check_file("/f0", template, sizeof(template));
+
+    // Distinct contents still need a block each
+    int written = 0;
+    for (; written < FILE_NUM; written++) {
+        snprintf(path, sizeof(path), "/f%d", written);
+        f = tfs_open(path, TFS_O_APPEND);
+        assert(f != -1);
+        char c = (char)('a' + written);
+        ssize_t res = tfs_write(f, &c, 1);
+        assert(tfs_close(f) != -1);
+        if (res == -1) {
+            break;
+        }
+    }
+    assert(written == BLOCK_COUNT - 2);
+
+    for (int i = written; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        check_file(path, template, sizeof(template));
+    }
+
+    // Unlinking the files frees their blocks
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        assert(tfs_unlink(path) != -1);
+    }
+    f = tfs_open("/g", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, changed, sizeof(changed)) == sizeof(changed));
+    assert(tfs_close(f) != -1);
+    check_file("/g", changed, sizeof(changed));
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
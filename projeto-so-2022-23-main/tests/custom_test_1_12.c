@@ -0,0 +1,107 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_NUM 20
+
+// This test keeps tiny files inside their inodes, so that more of them than
+// there are data blocks can be created, and checks that a file moves to a
+// data block when it grows past the inline size
+
+char const tiny[] = "BBB!";
+char big[INODE_INLINE_SIZE + 16];
+
+void check_file(char const *path, char const *contents, size_t len) {
+    char buffer[sizeof(big)];
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == (ssize_t)len);
+    assert(memcmp(buffer, contents, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    // A single data block besides the root directory's
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 2;
+    params.inline_small_files = true;
+    assert(tfs_init(&params) != -1);
+
+    char path[16];
+    memset(big, 'x', sizeof(big));
+
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, tiny, sizeof(tiny)) == sizeof(tiny));
+        assert(tfs_close(f) != -1);
+    }
+
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        check_file(path, tiny, sizeof(tiny));
+    }
+
+    // A file of exactly the inline size still has no block
+    char full[INODE_INLINE_SIZE];
+    memset(full, 'y', sizeof(full));
+    int f = tfs_open("/full", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, full, sizeof(full)) == sizeof(full));
+    assert(tfs_close(f) != -1);
+    tfs_stat_t st;
+    assert(tfs_stat("/full", &st) != -1);
+    assert(st.size == INODE_INLINE_SIZE && st.blocks == 0);
+    check_file("/full", full, sizeof(full));
+    assert(tfs_unlink("/full") != -1);
+
+    // Growing past the inline size takes the last data block
+    f = tfs_open("/f0", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, big, sizeof(big)) == sizeof(big));
+    assert(tfs_close(f) != -1);
+
+    char expected[sizeof(tiny) + sizeof(big)];
+    memcpy(expected, tiny, sizeof(tiny));
+    memcpy(expected + sizeof(tiny), big, sizeof(big));
+
+    char buffer[sizeof(expected)];
+    f = tfs_open("/f0", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, expected, sizeof(expected)) == 0);
+    assert(tfs_close(f) != -1);
+
+    // No block left for another one, whose contents are left untouched
+    f = tfs_open("/f1", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, big, sizeof(big)) == -1);
+    assert(tfs_close(f) != -1);
+    check_file("/f1", tiny, sizeof(tiny));
+
+    // Truncating the big file gives its block back
+    f = tfs_open("/f0", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/f1", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, big, sizeof(big)) == sizeof(big));
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/f1", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, expected, sizeof(expected)) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
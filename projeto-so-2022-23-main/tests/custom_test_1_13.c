@@ -0,0 +1,66 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// This test follows chains of symbolic links, which need no data blocks, and
+// checks that a loop of links fails to open instead of recursing forever, and
+// that a link that does not fit in the directory takes no inode
+
+char const file_contents[] = "CCC!";
+
+int main() {
+    // A single data block, taken by the root directory
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 1;
+    params.inline_small_files = true;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+
+    // /l0 -> /f, /l1 -> /l0, ...
+    char path[16];
+    char target[16] = "/f";
+    for (int i = 0; i < 10; i++) {
+        snprintf(path, sizeof(path), "/l%d", i);
+        assert(tfs_sym_link(target, path) != -1);
+        strcpy(target, path);
+    }
+
+    char buffer[sizeof(file_contents)];
+    f = tfs_open("/l9", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, file_contents, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+
+    // Replacing the file with a link to the end of the chain closes a loop
+    assert(tfs_unlink("/f") != -1);
+    assert(tfs_sym_link("/l9", "/f") != -1);
+
+    assert(tfs_open("/l0", 0) == -1);
+    assert(tfs_open("/l9", TFS_O_CREAT) == -1);
+
+    // Fills the directory (which holds fewer entries than there are inodes)
+    int i = 10;
+    do {
+        snprintf(path, sizeof(path), "/m%d", i++);
+    } while (tfs_sym_link("/f", path) != -1);
+    tfs_stats_t stats;
+    assert(tfs_get_stats(&stats) == 0);
+    size_t free_inodes = stats.free_inodes;
+    assert(free_inodes > 0);
+    assert(tfs_sym_link("/f", "/full") == -1);
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.free_inodes == free_inodes);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
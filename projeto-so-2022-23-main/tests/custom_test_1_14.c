@@ -0,0 +1,67 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREAD_NUM 4
+#define FILES_PER_THREAD 4
+#define FILE_LEN 512
+
+// This test backs the data blocks and the inode table with huge pages and
+// has several threads fill and read back their own files
+
+void file_contents(int i, char *buffer) {
+    memset(buffer, 'a' + i % 26, FILE_LEN);
+}
+
+void *worker(void *arg) {
+    int first = *(int *)arg;
+    char path[16];
+    char contents[FILE_LEN];
+    char buffer[FILE_LEN];
+
+    for (int i = first; i < first + FILES_PER_THREAD; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        file_contents(i, contents);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, contents, FILE_LEN) == FILE_LEN);
+        assert(tfs_close(f) != -1);
+
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, FILE_LEN) == FILE_LEN);
+        assert(memcmp(buffer, contents, FILE_LEN) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.huge_pages = true;
+
+    // Twice, to check the regions are given back and mapped again
+    for (int round = 0; round < 2; round++) {
+        assert(tfs_init(&params) != -1);
+
+        pthread_t tid[THREAD_NUM];
+        int first[THREAD_NUM];
+        for (int i = 0; i < THREAD_NUM; i++) {
+            first[i] = i * FILES_PER_THREAD;
+            assert(pthread_create(&tid[i], NULL, worker, &first[i]) == 0);
+        }
+        for (int i = 0; i < THREAD_NUM; i++) {
+            assert(pthread_join(tid[i], NULL) == 0);
+        }
+
+        assert(tfs_destroy() != -1);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define INSTANCE_NUM 2
+#define FILE_NUM 8
+#define FILE_LEN 256
+
+// This test has one thread per independent instance, all working on the same
+// path names, and checks each instance only sees its own files
+
+typedef struct {
+    tfs_t *fs;
+    char fill;
+} instance_arg_t;
+
+void *worker(void *arg) {
+    instance_arg_t *instance = arg;
+    char path[16];
+    char contents[FILE_LEN];
+    char buffer[FILE_LEN];
+
+    memset(contents, instance->fill, FILE_LEN);
+
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+
+        int f = tfs_open_r(instance->fs, path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write_r(instance->fs, f, contents, FILE_LEN) == FILE_LEN);
+        assert(tfs_close_r(instance->fs, f) != -1);
+    }
+
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+
+        int f = tfs_open_r(instance->fs, path, 0);
+        assert(f != -1);
+        assert(tfs_read_r(instance->fs, f, buffer, FILE_LEN) == FILE_LEN);
+        assert(memcmp(buffer, contents, FILE_LEN) == 0);
+        assert(tfs_close_r(instance->fs, f) != -1);
+    }
+
+    assert(tfs_unlink_r(instance->fs, "/f0") != -1);
+    assert(tfs_open_r(instance->fs, "/f0", 0) == -1);
+
+    return NULL;
+}
+
+int main() {
+    pthread_t tid[INSTANCE_NUM];
+    instance_arg_t instances[INSTANCE_NUM];
+
+    for (int i = 0; i < INSTANCE_NUM; i++) {
+        instances[i].fs = tfs_create(NULL);
+        assert(instances[i].fs != NULL);
+        instances[i].fill = (char)('a' + i);
+    }
+
+    // The default instance is independent as well
+    assert(tfs_open("/f1", 0) == -1);
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_init(NULL) == -1);
+    assert(tfs_open("/f1", 0) == -1);
+
+    for (int i = 0; i < INSTANCE_NUM; i++) {
+        assert(pthread_create(&tid[i], NULL, worker, &instances[i]) == 0);
+    }
+    for (int i = 0; i < INSTANCE_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    assert(tfs_open("/f1", 0) == -1);
+    assert(tfs_destroy() != -1);
+
+    for (int i = 0; i < INSTANCE_NUM; i++) {
+        assert(tfs_release(instances[i].fs) != -1);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SHARD_NUM 4
+#define THREAD_NUM 4
+#define FILES_PER_THREAD 8
+#define LINK_NUM 8
+#define FILE_LEN 256
+
+// This test spreads the files of several threads across shards, keeping them
+// all open at once, and follows symbolic links that may point to other shards
+
+void *worker(void *arg) {
+    int first = *(int *)arg;
+    char path[16];
+    char contents[FILE_LEN];
+    char buffer[FILE_LEN];
+    int f[FILES_PER_THREAD];
+
+    for (int i = 0; i < FILES_PER_THREAD; i++) {
+        snprintf(path, sizeof(path), "/f%d", first + i);
+        memset(contents, 'a' + (first + i) % 26, FILE_LEN);
+
+        f[i] = tfs_open(path, TFS_O_CREAT);
+        assert(f[i] != -1);
+        for (int j = 0; j < i; j++) {
+            assert(f[j] != f[i]);
+        }
+        assert(tfs_write(f[i], contents, FILE_LEN) == FILE_LEN);
+    }
+
+    for (int i = 0; i < FILES_PER_THREAD; i++) {
+        assert(tfs_close(f[i]) != -1);
+    }
+
+    for (int i = 0; i < FILES_PER_THREAD; i++) {
+        snprintf(path, sizeof(path), "/f%d", first + i);
+        memset(contents, 'a' + (first + i) % 26, FILE_LEN);
+
+        int fd = tfs_open(path, 0);
+        assert(fd != -1);
+        assert(tfs_read(fd, buffer, FILE_LEN) == FILE_LEN);
+        assert(memcmp(buffer, contents, FILE_LEN) == 0);
+        assert(tfs_close(fd) != -1);
+    }
+
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.shard_count = SHARD_NUM;
+    assert(tfs_init(&params) != -1);
+
+    pthread_t tid[THREAD_NUM];
+    int first[THREAD_NUM];
+    for (int i = 0; i < THREAD_NUM; i++) {
+        first[i] = i * FILES_PER_THREAD;
+        assert(pthread_create(&tid[i], NULL, worker, &first[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    char const target[] = "/target";
+    char const contents[] = "contents";
+    char buffer[sizeof(contents)];
+    char path[16];
+
+    int f = tfs_open(target, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(f) != -1);
+
+    // Chain of links, each pointing to the previous one
+    for (int i = 0; i < LINK_NUM; i++) {
+        snprintf(path, sizeof(path), "/l%d", i);
+        char prev[16];
+        snprintf(prev, sizeof(prev), "/l%d", i - 1);
+        assert(tfs_sym_link(i == 0 ? target : prev, path) != -1);
+    }
+
+    for (int i = 0; i < LINK_NUM; i++) {
+        snprintf(path, sizeof(path), "/l%d", i);
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_unlink("/f0") != -1);
+    assert(tfs_open("/f0", 0) == -1);
+    assert(tfs_close(f) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "client/tfs_client.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVER_PIPE "/tmp/tfs_test_1_17"
+#define CLIENT_NUM 3
+#define FILE_LEN 1024
+
+// This test starts a server and has several client processes (more than its
+// workers) share its file system, with reads and writes split in pipelined
+// requests
+
+static void wait_for_server() {
+    struct timespec delay = {0, 10 * 1000 * 1000};
+    for (int i = 0; i < 500 && access(SERVER_PIPE, F_OK) != 0; i++) {
+        nanosleep(&delay, NULL);
+    }
+    assert(access(SERVER_PIPE, F_OK) == 0);
+}
+
+static void client(int id) {
+    char pipe_path[32];
+    char path[16];
+    char contents[FILE_LEN];
+    char buffer[FILE_LEN];
+
+    snprintf(pipe_path, sizeof(pipe_path), "/tmp/tfs_test_1_17_c%d", id);
+    snprintf(path, sizeof(path), "/f%d", id);
+    for (int i = 0; i < FILE_LEN; i++) {
+        contents[i] = (char)('a' + (i + id) % 26);
+    }
+
+    assert(tfs_mount(pipe_path, SERVER_PIPE) == 0);
+
+    int f = tfs_remote_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_remote_write(f, contents, FILE_LEN) == FILE_LEN);
+    assert(tfs_remote_close(f) != -1);
+
+    f = tfs_remote_open(path, 0);
+    assert(f != -1);
+    assert(tfs_remote_read(f, buffer, FILE_LEN) == FILE_LEN);
+    assert(memcmp(buffer, contents, FILE_LEN) == 0);
+    assert(tfs_remote_read(f, buffer, FILE_LEN) == 0);
+    assert(tfs_remote_close(f) != -1);
+    assert(tfs_remote_close(f) == -1);
+
+    assert(tfs_unmount() == 0);
+}
+
+int main() {
+    unlink(SERVER_PIPE);
+
+    pid_t server = fork();
+    assert(server != -1);
+    if (server == 0) {
+        execl("server/tfs_server", "tfs_server", SERVER_PIPE, "2", NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+
+    wait_for_server();
+
+    pid_t clients[CLIENT_NUM];
+    for (int i = 0; i < CLIENT_NUM; i++) {
+        clients[i] = fork();
+        assert(clients[i] != -1);
+        if (clients[i] == 0) {
+            client(i);
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    int status;
+    for (int i = 0; i < CLIENT_NUM; i++) {
+        assert(waitpid(clients[i], &status, 0) == clients[i]);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    }
+
+    // The files written by the other clients are all there
+    assert(tfs_mount("/tmp/tfs_test_1_17_main", SERVER_PIPE) == 0);
+    for (int i = 0; i < CLIENT_NUM; i++) {
+        char path[16];
+        char buffer[FILE_LEN];
+        snprintf(path, sizeof(path), "/f%d", i);
+
+        int f = tfs_remote_open(path, 0);
+        assert(f != -1);
+        assert(tfs_remote_read(f, buffer, FILE_LEN) == FILE_LEN);
+        assert(buffer[0] == 'a' + i);
+        assert(tfs_remote_close(f) != -1);
+    }
+    assert(tfs_remote_shutdown() == 0);
+    assert(tfs_unmount() == 0);
+
+    assert(waitpid(server, &status, 0) == server);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "fs/operations.h"
+#include "fs/trace.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_PATH "/tmp/tfs_test_1_19.trace"
+#define THREAD_NUM 3
+#define FILE_LEN 100
+#define BATCH 4
+
+// This test traces the calls of several threads and reads the trace back:
+// every call is there, with its thread, arguments, sizes and result
+
+void *worker(void *arg) {
+    int id = *(int *)arg;
+    char path[16];
+    char link_path[16];
+    char new_link_path[16];
+    char buffer[FILE_LEN];
+    snprintf(path, sizeof(path), "/f%d", id);
+    snprintf(link_path, sizeof(link_path), "/l%d", id);
+    snprintf(new_link_path, sizeof(new_link_path), "/m%d", id);
+    memset(buffer, 'a' + id, FILE_LEN);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, FILE_LEN) == FILE_LEN);
+    assert(tfs_close(f) != -1);
+    assert(tfs_link(path, link_path) != -1);
+    assert(tfs_unlink("/missing") == -1);
+
+    // At least its own file and link are listed
+    tfs_dir_t dir;
+    tfs_dirent_t entries[BATCH];
+    assert(tfs_opendir("/", &dir) == 0);
+    assert(tfs_readdir_batch(&dir, entries, BATCH) >= 2);
+
+    tfs_stat_t st[3];
+    char const *paths[] = {path, link_path, "/missing"};
+    assert(tfs_stat(path, &st[0]) == 0);
+    assert(tfs_stat_many(paths, 3, st) == 2);
+
+    assert(tfs_rename(link_path, new_link_path) == 0);
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_trace_start(TRACE_PATH) == 0);
+    assert(tfs_trace_start(TRACE_PATH) == -1);
+
+    pthread_t tid[THREAD_NUM];
+    int ids[THREAD_NUM];
+    for (int i = 0; i < THREAD_NUM; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, worker, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    assert(tfs_trace_stop() == 0);
+    // Not traced
+    assert(tfs_unlink("/f0") != -1);
+    assert(tfs_destroy() != -1);
+
+    FILE *f = fopen(TRACE_PATH, "rb");
+    assert(f != NULL);
+    tfs_trace_header_t header;
+    assert(fread(&header, sizeof(header), 1, f) == 1);
+    assert(memcmp(header.magic, TFS_TRACE_MAGIC, sizeof(header.magic)) == 0);
+    assert(header.max_inode_count == tfs_default_params().max_inode_count);
+
+    tfs_trace_record_t record;
+    char name[256];
+    char name2[256];
+    int count[TFS_OP_COUNT] = {0};
+    int calls_of_thread[THREAD_NUM + 1] = {0};
+    int res;
+    while ((res = trace_read_record(f, &record, name, name2)) == 1) {
+        count[record.op]++;
+        assert(record.thread >= 1 && record.thread <= THREAD_NUM);
+        calls_of_thread[record.thread]++;
+
+        switch ((tfs_op_t)record.op) {
+        case TFS_OP_OPEN:
+            assert(record.arg == TFS_O_CREAT && record.result >= 0);
+            assert(name[0] == '/' && name[1] == 'f' && name2[0] == '\0');
+            break;
+        case TFS_OP_WRITE:
+            assert(record.len == FILE_LEN && record.result == FILE_LEN);
+            break;
+        case TFS_OP_LINK:
+            assert(name[1] == 'f' && name2[1] == 'l' && name[2] == name2[2]);
+            break;
+        case TFS_OP_UNLINK:
+            assert(strcmp(name, "/missing") == 0 && record.result == -1);
+            break;
+        case TFS_OP_CLOSE:
+            break;
+        case TFS_OP_OPENDIR:
+            assert(strcmp(name, "/") == 0 && record.result == 0);
+            break;
+        case TFS_OP_READDIR:
+            assert(record.len == BATCH && record.result >= 2);
+            assert(record.result <= BATCH && name[0] == '\0');
+            break;
+        case TFS_OP_STAT:
+            assert(name[1] == 'f' && record.result == 0);
+            break;
+        case TFS_OP_STAT_MANY:
+            // Only the first two path names are kept
+            assert(record.len == 3 && record.result == 2);
+            assert(name[1] == 'f' && name2[1] == 'l' && name[2] == name2[2]);
+            break;
+        case TFS_OP_RENAME:
+            assert(name[1] == 'l' && name2[1] == 'm' && name[2] == name2[2]);
+            assert(record.result == 0);
+            break;
+        case TFS_OP_SYM_LINK:
+        case TFS_OP_FLUSH:
+        case TFS_OP_READ:
+        case TFS_OP_COPY_FROM_EXTERNAL:
+        case TFS_OP_COUNT:
+        default:
+            assert(false);
+        }
+    }
+    assert(res == 0);
+    fclose(f);
+    unlink(TRACE_PATH);
+
+    assert(count[TFS_OP_OPEN] == THREAD_NUM);
+    assert(count[TFS_OP_WRITE] == THREAD_NUM);
+    assert(count[TFS_OP_CLOSE] == THREAD_NUM);
+    assert(count[TFS_OP_LINK] == THREAD_NUM);
+    assert(count[TFS_OP_UNLINK] == THREAD_NUM);
+    assert(count[TFS_OP_OPENDIR] == THREAD_NUM);
+    assert(count[TFS_OP_READDIR] == THREAD_NUM);
+    assert(count[TFS_OP_STAT] == THREAD_NUM);
+    assert(count[TFS_OP_STAT_MANY] == THREAD_NUM);
+    assert(count[TFS_OP_RENAME] == THREAD_NUM);
+    for (int i = 1; i <= THREAD_NUM; i++) {
+        assert(calls_of_thread[i] == 10);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREAD_NUM 4
+#define FILE_NUM 5
+#define FILE_LEN 200
+
+// This test checks the metrics after several threads (in two shards) create,
+// write, read and remove files, including with calls that fail
+
+void *worker(void *arg) {
+    int id = *(int *)arg;
+    char path[16];
+    char buffer[FILE_LEN];
+    memset(buffer, 'a' + id, FILE_LEN);
+
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d_%d", id, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, FILE_LEN) == FILE_LEN);
+        assert(tfs_close(f) != -1);
+
+        f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, FILE_LEN) == FILE_LEN);
+        assert(tfs_read(f, buffer, FILE_LEN) == 0);
+        assert(tfs_close(f) != -1);
+        assert(tfs_close(f) == -1);
+    }
+
+    // Leave one file behind, and one open
+    for (int i = 1; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d_%d", id, i);
+        assert(tfs_unlink(path) != -1);
+    }
+    snprintf(path, sizeof(path), "/f%d_0", id);
+    assert(tfs_open(path, 0) != -1);
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.shard_count = 2;
+    assert(tfs_get_stats(NULL) == -1);
+    assert(tfs_init(&params) != -1);
+
+    pthread_t tid[THREAD_NUM];
+    int ids[THREAD_NUM];
+    for (int i = 0; i < THREAD_NUM; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, worker, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    tfs_stats_t stats;
+    assert(tfs_get_stats(&stats) == 0);
+
+    tfs_op_stats_t const *open = &stats.ops[TFS_OP_OPEN];
+    assert(open->calls == THREAD_NUM * (2 * FILE_NUM + 1) && open->errors == 0);
+    tfs_op_stats_t const *close = &stats.ops[TFS_OP_CLOSE];
+    assert(close->calls == THREAD_NUM * 3 * FILE_NUM);
+    assert(close->errors == THREAD_NUM * FILE_NUM);
+    tfs_op_stats_t const *write = &stats.ops[TFS_OP_WRITE];
+    assert(write->calls == THREAD_NUM * FILE_NUM);
+    assert(write->bytes == THREAD_NUM * FILE_NUM * FILE_LEN);
+    tfs_op_stats_t const *read = &stats.ops[TFS_OP_READ];
+    assert(read->calls == THREAD_NUM * 2 * FILE_NUM);
+    assert(read->bytes == THREAD_NUM * FILE_NUM * FILE_LEN);
+    assert(stats.ops[TFS_OP_UNLINK].calls == THREAD_NUM * (FILE_NUM - 1));
+    assert(stats.ops[TFS_OP_LINK].calls == 0);
+
+    uint64_t timed = 0;
+    for (int i = 0; i < TFS_LATENCY_BUCKETS; i++) {
+        timed += open->latency[i];
+    }
+    assert(timed == open->calls);
+
+    // Both shards have their own root directory
+    assert(stats.inodes == 2 * params.max_inode_count);
+    assert(stats.free_inodes == stats.inodes - 2 - THREAD_NUM);
+    assert(stats.blocks == 2 * params.max_block_count);
+    assert(stats.free_blocks == stats.blocks - 2 - THREAD_NUM);
+    assert(stats.handles == 2 * params.max_open_files_count);
+    assert(stats.free_handles == stats.handles - THREAD_NUM);
+    assert(stats.cache.hits == 0 && stats.cache.misses == 0);
+
+    assert(tfs_destroy() != -1);
+
+    // Counters start over
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.ops[TFS_OP_OPEN].calls == 0);
+    assert(stats.free_inodes == stats.inodes - 1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_NUM 20
+#define BATCH 4
+#define LISTINGS 50
+
+// This test lists the root directory (in three shards) in small batches while
+// another thread keeps creating and deleting files: every file that exists for
+// the whole listing is listed exactly once, with its type, size and inumber
+// (unique across shards)
+
+static atomic_bool done = false;
+static int inumbers[FILE_NUM]; // as listed
+
+void *churn(void *arg) {
+    (void)arg;
+    char path[16];
+    for (int i = 0; !atomic_load(&done); i = (i + 1) % 2) {
+        snprintf(path, sizeof(path), "/tmp%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+        assert(tfs_unlink(path) != -1);
+    }
+    return NULL;
+}
+
+// Lists the directory, counting how many times each stable file is listed
+static void list(int seen[FILE_NUM], int *links_seen) {
+    tfs_dir_t dir;
+    assert(tfs_opendir("/", &dir) == 0);
+    memset(seen, 0, FILE_NUM * sizeof(int));
+    *links_seen = 0;
+
+    tfs_dirent_t entries[BATCH];
+    ssize_t count;
+    while ((count = tfs_readdir_batch(&dir, entries, BATCH)) > 0) {
+        assert(count <= BATCH);
+        for (ssize_t i = 0; i < count; i++) {
+            int n;
+            if (strcmp(entries[i].name, "ln") == 0) {
+                assert(entries[i].type == TFS_T_SYMLINK);
+                assert(entries[i].size == strlen("/f3"));
+                (*links_seen)++;
+            } else if (sscanf(entries[i].name, "f%d", &n) == 1) {
+                assert(n >= 0 && n < FILE_NUM);
+                assert(entries[i].type == TFS_T_FILE);
+                assert(entries[i].size == (size_t)n);
+                inumbers[n] = entries[i].inumber;
+                seen[n]++;
+            } else {
+                assert(strncmp(entries[i].name, "tmp", 3) == 0);
+            }
+        }
+    }
+    assert(count == 0);
+    // The end stays the end
+    assert(tfs_readdir_batch(&dir, entries, BATCH) == 0);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.shard_count = 3;
+    assert(tfs_init(&params) != -1);
+
+    tfs_dir_t dir;
+    assert(tfs_opendir("/f0", &dir) == -1);
+    assert(tfs_opendir("/", &dir) == 0);
+    tfs_dirent_t entries[BATCH];
+    assert(tfs_readdir_batch(&dir, entries, BATCH) == 0);
+
+    char path[16];
+    char buffer[FILE_NUM] = {0};
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, (size_t)i) == i);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_sym_link("/f3", "/ln") != -1);
+
+    int seen[FILE_NUM];
+    int links_seen;
+    list(seen, &links_seen);
+    for (int i = 0; i < FILE_NUM; i++) {
+        assert(seen[i] == 1);
+    }
+    assert(links_seen == 1);
+
+    // Inumbers are those of tfs_stat, unique across shards
+    for (int i = 0; i < FILE_NUM; i++) {
+        tfs_stat_t st;
+        snprintf(path, sizeof(path), "/f%d", i);
+        assert(tfs_stat(path, &st) == 0 && st.inumber == inumbers[i]);
+        for (int j = 0; j < i; j++) {
+            assert(inumbers[i] != inumbers[j]);
+        }
+    }
+
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, churn, NULL) == 0);
+    for (int l = 0; l < LISTINGS; l++) {
+        list(seen, &links_seen);
+        for (int i = 0; i < FILE_NUM; i++) {
+            assert(seen[i] == 1);
+        }
+        assert(links_seen == 1);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(tid, NULL) == 0);
+
+    // A saved cursor resumes where it was, even after deletions
+    assert(tfs_opendir("/", &dir) == 0);
+    assert(tfs_readdir_batch(&dir, entries, BATCH) == BATCH);
+    tfs_dir_t saved = dir;
+    assert(tfs_unlink("/f0") != -1);
+    size_t rest = 0;
+    ssize_t count;
+    while ((count = tfs_readdir_batch(&saved, entries, BATCH)) > 0) {
+        rest += (size_t)count;
+    }
+    assert(count == 0);
+    assert(rest == FILE_NUM + 1 - BATCH || rest == FILE_NUM - BATCH);
+
+    assert(tfs_destroy() != -1);
+    assert(tfs_readdir_batch(&dir, entries, BATCH) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
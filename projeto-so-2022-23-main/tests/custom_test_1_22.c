@@ -0,0 +1,112 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_NUM 10
+#define FILE_LEN 100
+
+// This test checks the metadata returned by tfs_stat and tfs_stat_many (in
+// two shards), for files, hard and symbolic links, and missing or invalid
+// path names, and that hard links cannot cross shards
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.shard_count = 2;
+    tfs_stat_t st;
+    assert(tfs_stat("/f0", &st) == -1);
+    assert(tfs_init(&params) != -1);
+
+    char paths[FILE_NUM][16];
+    char buffer[FILE_LEN] = {0};
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/f%d", i);
+        int f = tfs_open(paths[i], TFS_O_CREAT);
+        assert(f != -1);
+        // Even files are left empty
+        size_t len = i % 2 == 0 ? 0 : FILE_LEN;
+        assert(tfs_write(f, buffer, len) == (ssize_t)len);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_sym_link("/f1", "/sym") != -1);
+
+    assert(tfs_stat("/f1", &st) == 0);
+    assert(st.inumber >= 0 && st.type == TFS_T_FILE);
+    assert(st.size == FILE_LEN && st.links == 1 && st.blocks == 1);
+
+    assert(tfs_stat("/f0", &st) == 0);
+    assert(st.type == TFS_T_FILE && st.size == 0 && st.blocks == 0);
+
+    // Links are not followed
+    assert(tfs_stat("/sym", &st) == 0);
+    assert(st.type == TFS_T_SYMLINK && st.size == strlen("/f1"));
+
+    assert(tfs_stat("/missing", &st) == -1);
+    assert(tfs_stat("nope", &st) == -1);
+
+    char const *many[FILE_NUM + 3];
+    for (int i = 0; i < FILE_NUM; i++) {
+        many[i] = paths[i];
+    }
+    many[FILE_NUM] = "/missing";
+    many[FILE_NUM + 1] = NULL;
+    many[FILE_NUM + 2] = "/sym";
+    tfs_stat_t out[FILE_NUM + 3];
+    assert(tfs_stat_many(many, FILE_NUM + 3, out) == FILE_NUM + 1);
+    for (int i = 0; i < FILE_NUM; i++) {
+        assert(tfs_stat(paths[i], &st) == 0);
+        assert(memcmp(&st, &out[i], sizeof(st)) == 0);
+        assert(out[i].size == (i % 2 == 0 ? 0 : FILE_LEN));
+    }
+    assert(out[FILE_NUM].inumber == -1);
+    assert(out[FILE_NUM + 1].inumber == -1);
+    assert(out[FILE_NUM + 2].type == TFS_T_SYMLINK);
+
+    // Inumbers are unique across shards
+    for (int i = 0; i < FILE_NUM; i++) {
+        for (int j = 0; j < i; j++) {
+            assert(out[i].inumber != out[j].inumber);
+        }
+    }
+
+    // Hard links share the inode if both names fall in the same shard, and
+    // fail with TFS_EXDEV otherwise (both happen among a few names)
+    bool linked = false;
+    bool crossed = false;
+    char link_path[16];
+    for (int i = 0; i < FILE_NUM && !(linked && crossed); i++) {
+        snprintf(link_path, sizeof(link_path), "/l%d", i);
+        int res = tfs_link("/f3", link_path);
+        if (res == TFS_EXDEV) {
+            crossed = true;
+            assert(tfs_stat(link_path, &st) == -1);
+        } else if (!linked) {
+            assert(res == 0);
+            linked = true;
+            tfs_stat_t link_st;
+            assert(tfs_stat("/f3", &st) == 0 && st.links == 2);
+            assert(tfs_stat(link_path, &link_st) == 0);
+            assert(memcmp(&st, &link_st, sizeof(st)) == 0);
+            assert(tfs_unlink(link_path) != -1);
+        } else {
+            assert(res == 0 && tfs_unlink(link_path) != -1);
+        }
+    }
+    assert(linked && crossed);
+
+    // Deleted files are not found
+    assert(tfs_unlink("/f9") != -1);
+    assert(tfs_stat("/f9", &st) == -1);
+    assert(tfs_stat_many(many, FILE_NUM, out) == FILE_NUM - 1);
+    assert(out[9].inumber == -1);
+
+    assert(tfs_stat_many(many, 0, out) == 0);
+
+    assert(tfs_destroy() != -1);
+    assert(tfs_stat_many(many, FILE_NUM, out) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define COMMITS 200
+#define RACES 300
+
+// This test renames files: to new names, over existing files (whose inode is
+// freed), to their own names, and symbolic links; then one thread keeps
+// replacing a file by writing a temporary one and renaming it over it, while
+// another checks that the file never goes missing nor is seen partially
+// written; then threads keep unlinking a name while others create it and
+// rename files onto it, and no inode is freed twice or left behind; last, that
+// renames fail with TFS_EXDEV across shards
+
+static atomic_bool done = false;
+
+static void write_file(char const *path, char const *contents) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    size_t len = strlen(contents);
+    assert(tfs_write(f, contents, len) == (ssize_t)len);
+    assert(tfs_close(f) != -1);
+}
+
+void *unlinker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < RACES; i++) {
+        tfs_unlink("/x"); // may find it or not
+    }
+    return NULL;
+}
+
+void *renamer(void *arg) {
+    char path[16];
+    snprintf(path, sizeof(path), "/r%d", *(int *)arg);
+    for (int i = 0; i < RACES; i++) {
+        write_file(path, "r");
+        assert(tfs_rename(path, "/x") == 0);
+    }
+    return NULL;
+}
+
+void *creator(void *arg) {
+    (void)arg;
+    for (int i = 0; i < RACES; i++) {
+        int f = tfs_open("/x", TFS_O_CREAT);
+        if (f != -1) { // unless unlinked meanwhile
+            assert(tfs_close(f) != -1);
+        }
+    }
+    return NULL;
+}
+
+static void check_file(char const *path, char const *contents) {
+    char buffer[32] = {0};
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    ssize_t len = tfs_read(f, buffer, sizeof(buffer) - 1);
+    assert(len == (ssize_t)strlen(contents));
+    assert(strcmp(buffer, contents) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void *checker(void *arg) {
+    (void)arg;
+    tfs_stat_t st;
+    while (!atomic_load(&done)) {
+        assert(tfs_stat("/current", &st) == 0);
+        assert(st.size == strlen("version"));
+    }
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+    tfs_stats_t stats;
+    tfs_stat_t st;
+
+    // To a new name; open handles follow the file
+    write_file("/a", "aaa");
+    int f = tfs_open("/a", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_rename("/a", "/b") == 0);
+    assert(tfs_stat("/a", &st) == -1);
+    assert(tfs_write(f, "a", 1) == 1);
+    assert(tfs_close(f) != -1);
+    check_file("/b", "aaaa");
+
+    // Over an existing file, which is deleted
+    write_file("/c", "ccc");
+    assert(tfs_get_stats(&stats) == 0);
+    size_t free_inodes = stats.free_inodes;
+    assert(tfs_rename("/b", "/c") == 0);
+    assert(tfs_stat("/b", &st) == -1);
+    check_file("/c", "aaaa");
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.free_inodes == free_inodes + 1);
+
+    // Over a hard link of the same file: nothing changes
+    assert(tfs_link("/c", "/c2") != -1);
+    assert(tfs_rename("/c", "/c2") == 0);
+    assert(tfs_stat("/c", &st) == 0 && st.links == 2);
+
+    // To its own name: nothing changes, even with the directory full
+    char path[16];
+    int fill = 0;
+    for (;; fill++) {
+        snprintf(path, sizeof(path), "/fill%d", fill);
+        f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            break;
+        }
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_rename("/c", "/c") == 0);
+    assert(tfs_stat("/c", &st) == 0 && st.links == 2);
+    check_file("/c", "aaaa");
+    assert(tfs_rename("/missing", "/missing") == -1);
+    while (fill-- > 0) {
+        snprintf(path, sizeof(path), "/fill%d", fill);
+        assert(tfs_unlink(path) != -1);
+    }
+
+    // Symbolic links are renamed, not followed
+    assert(tfs_sym_link("/c", "/s") != -1);
+    assert(tfs_rename("/s", "/t") == 0);
+    assert(tfs_stat("/t", &st) == 0 && st.type == TFS_T_SYMLINK);
+    check_file("/t", "aaaa");
+
+    // Errors
+    assert(tfs_rename("/missing", "/d") == -1);
+    assert(tfs_stat("/d", &st) == -1);
+    assert(tfs_rename("/c", "nope") == -1);
+
+    // Commits by renaming over the current version
+    write_file("/current", "version");
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, checker, NULL) == 0);
+    for (int i = 0; i < COMMITS; i++) {
+        write_file("/tmp", "version");
+        assert(tfs_rename("/tmp", "/current") == 0);
+    }
+    atomic_store(&done, true);
+    assert(pthread_join(tid, NULL) == 0);
+    check_file("/current", "version");
+
+    // No inode left behind by the replaced versions (only the symbolic link
+    // and the current version were added since the rename over /c)
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.free_inodes == free_inodes + 1 - 2);
+
+    // Unlinks racing renames and creations of the same name
+    int ids[2] = {0, 1};
+    pthread_t tids[5];
+    assert(pthread_create(&tids[0], NULL, unlinker, NULL) == 0);
+    assert(pthread_create(&tids[1], NULL, unlinker, NULL) == 0);
+    assert(pthread_create(&tids[2], NULL, renamer, &ids[0]) == 0);
+    assert(pthread_create(&tids[3], NULL, renamer, &ids[1]) == 0);
+    assert(pthread_create(&tids[4], NULL, creator, NULL) == 0);
+    for (int i = 0; i < 5; i++) {
+        assert(pthread_join(tids[i], NULL) == 0);
+    }
+    tfs_unlink("/x");
+    assert(tfs_stat("/r0", &st) == -1 && tfs_stat("/r1", &st) == -1);
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.free_inodes == free_inodes + 1 - 2);
+
+    assert(tfs_destroy() != -1);
+    assert(tfs_rename("/c", "/d") == -1);
+
+    // With two shards, renames work within one and fail across them, leaving
+    // both names alone (both happen among a few names)
+    tfs_params params = tfs_default_params();
+    params.shard_count = 2;
+    assert(tfs_init(&params) != -1);
+    write_file("/x", "xxx");
+    bool renamed = false;
+    bool crossed = false;
+    for (int i = 0; i < 16 && !(renamed && crossed); i++) {
+        snprintf(path, sizeof(path), "/y%d", i);
+        int res = tfs_rename("/x", path);
+        if (res == TFS_EXDEV) {
+            crossed = true;
+            check_file("/x", "xxx");
+            assert(tfs_stat(path, &st) == -1);
+        } else {
+            assert(res == 0);
+            renamed = true;
+            check_file(path, "xxx");
+            assert(tfs_rename(path, "/x") == 0);
+        }
+    }
+    assert(renamed && crossed);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define READERS 3
+#define WRITES 2000
+#define PATH "/f"
+
+// This test rewrites a file (truncating it, then writing a length whose bytes
+// all hold a value of their own) while other threads keep reading it without
+// locks: a read returns either nothing or exactly one of the writes, never a
+// size paired with another write's data block (once with tiny files kept in
+// the inode, so that the data block also comes and goes)
+
+static size_t const lengths[] = {10, 40, 300, 700};
+#define LENGTH_COUNT (sizeof(lengths) / sizeof(lengths[0]))
+
+static atomic_bool done = false;
+
+void *reader(void *arg) {
+    (void)arg;
+    char buffer[1024];
+    while (!atomic_load(&done)) {
+        int f = tfs_open(PATH, 0);
+        assert(f != -1);
+        ssize_t n = tfs_read(f, buffer, sizeof(buffer));
+        assert(tfs_close(f) != -1);
+
+        if (n == 0) {
+            continue; // read between the truncation and the write
+        }
+        size_t i = 0;
+        while (i < LENGTH_COUNT && lengths[i] != (size_t)n) {
+            i++;
+        }
+        assert(i < LENGTH_COUNT);
+        for (size_t j = 0; j < (size_t)n; j++) {
+            assert(buffer[j] == (char)('a' + i));
+        }
+    }
+    return NULL;
+}
+
+static void run(tfs_params const *params) {
+    assert(tfs_init(params) != -1);
+
+    int f = tfs_open(PATH, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    atomic_store(&done, false);
+    pthread_t tids[READERS];
+    for (int i = 0; i < READERS; i++) {
+        assert(pthread_create(&tids[i], NULL, reader, NULL) == 0);
+    }
+
+    char contents[1024];
+    for (int w = 0; w < WRITES; w++) {
+        size_t i = (size_t)w % LENGTH_COUNT;
+        memset(contents, 'a' + (int)i, lengths[i]);
+        f = tfs_open(PATH, TFS_O_TRUNC);
+        assert(f != -1);
+        assert(tfs_write(f, contents, lengths[i]) == (ssize_t)lengths[i]);
+        assert(tfs_close(f) != -1);
+    }
+
+    atomic_store(&done, true);
+    for (int i = 0; i < READERS; i++) {
+        assert(pthread_join(tids[i], NULL) == 0);
+    }
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    run(&params);
+
+    params.inline_small_files = true;
+    run(&params);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 4
+#define WRITES 100 // RECORD_LEN * WRITES fits in a block
+#define RECORD_LEN 8
+
+// This test checks the layout of the inode table (no two inodes share a cache
+// line, and the fields written on every write share their inode's first one),
+// then has threads keep writing files with neighbouring inodes at once and
+// checks that each file ends up with exactly its own writes
+
+static tfs_t *fs;
+
+void *append_records(void *arg) {
+    int t = *(int *)arg;
+    char path[16];
+    snprintf(path, sizeof(path), "/f%d", t);
+
+    char record[RECORD_LEN];
+    memset(record, 'a' + t, RECORD_LEN);
+    for (int i = 0; i < WRITES; i++) {
+        int f = tfs_open_r(fs, path, TFS_O_APPEND);
+        assert(f != -1);
+        assert(tfs_write_r(fs, f, record, RECORD_LEN) == RECORD_LEN);
+        assert(tfs_close_r(fs, f) != -1);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    fs = tfs_create(&params);
+    assert(fs != NULL);
+
+    for (int i = 0; i < (int)params.max_inode_count; i++) {
+        inode_t *inode = inode_get(fs, i);
+        assert((uintptr_t)inode % CACHE_LINE_SIZE == 0);
+        if (i > 0) {
+            assert((char *)inode - (char *)inode_get(fs, i - 1) >=
+                   CACHE_LINE_SIZE);
+        }
+        assert((char *)&inode->i_data_block + sizeof(int) -
+                   (char *)&inode->i_size <=
+               CACHE_LINE_SIZE);
+    }
+
+    int ids[THREADS];
+    pthread_t tids[THREADS];
+    char path[16];
+    for (int t = 0; t < THREADS; t++) {
+        ids[t] = t;
+        snprintf(path, sizeof(path), "/f%d", t);
+        int f = tfs_open_r(fs, path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close_r(fs, f) != -1);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        assert(pthread_create(&tids[t], NULL, append_records, &ids[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+
+    char buffer[WRITES * RECORD_LEN];
+    for (int t = 0; t < THREADS; t++) {
+        snprintf(path, sizeof(path), "/f%d", t);
+        int f = tfs_open_r(fs, path, 0);
+        assert(f != -1);
+        assert(tfs_read_r(fs, f, buffer, sizeof(buffer)) == sizeof(buffer));
+        for (size_t i = 0; i < sizeof(buffer); i++) {
+            assert(buffer[i] == 'a' + t);
+        }
+        assert(tfs_close_r(fs, f) != -1);
+    }
+
+    assert(tfs_release(fs) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
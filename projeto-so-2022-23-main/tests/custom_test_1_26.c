@@ -0,0 +1,224 @@
+#include "fs/events.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EVENTS_PATH "/tmp/tfs_test_1_26.events"
+#define JSON_PATH "/tmp/tfs_test_1_26.json"
+#define THREADS 2
+
+// This test converts events files (see fs/events.h) with bench/tfs_events: a
+// handmade one, broken copies of it, and (in make EVENTS=yes builds) one
+// dumped at exit by a process whose threads are still recording events
+
+/**
+ * Run bench/tfs_events on an events file, with its output in JSON_PATH.
+ *
+ * Returns its exit status.
+ */
+static int convert(char const *path) {
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        int out = open(JSON_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out == -1 || dup2(out, STDOUT_FILENO) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        execl("bench/tfs_events", "tfs_events", path, NULL);
+        perror("execl");
+        _exit(EXIT_FAILURE);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * Count the occurrences of a string in the output of the last conversion.
+ */
+static size_t json_count(char const *needle) {
+    FILE *f = fopen(JSON_PATH, "r");
+    assert(f != NULL);
+    assert(fseek(f, 0, SEEK_END) == 0);
+    long len = ftell(f);
+    assert(len >= 0 && fseek(f, 0, SEEK_SET) == 0);
+    char *json = malloc((size_t)len + 1);
+    assert(json != NULL);
+    assert(fread(json, 1, (size_t)len, f) == (size_t)len);
+    json[len] = '\0';
+    assert(fclose(f) == 0);
+
+    size_t count = 0;
+    for (char *p = strstr(json, needle); p != NULL;
+         p = strstr(p + 1, needle)) {
+        count++;
+    }
+    free(json);
+    return count;
+}
+
+static void write_events(tfs_events_header_t const *header,
+                         tfs_event_t const *events, size_t count) {
+    FILE *f = fopen(EVENTS_PATH, "wb");
+    assert(f != NULL);
+    assert(fwrite(header, sizeof(*header), 1, f) == 1);
+    assert(fwrite(events, sizeof(*events), count, f) == count);
+    assert(fclose(f) == 0);
+}
+
+static void test_handmade(void) {
+    // 1000 ticks per microsecond
+    tfs_events_header_t header = {
+        .tsc_begin = 1000,
+        .ns_begin = 0,
+        .tsc_end = 2000,
+        .ns_end = 1000,
+        .event_count = 3,
+    };
+    memcpy(header.magic, TFS_EVENTS_MAGIC, sizeof(header.magic));
+    tfs_event_t events[] = {
+        {.tsc = 1500, .duration = 1000, .thread = 1, .type = EVENT_DELAY},
+        {.tsc = 1000, .duration = 2000, .thread = 1, .type = EVENT_LOOKUP,
+         .arg = 5},
+        {.tsc = 3000, .duration = 0, .thread = 2, .type = EVENT_BLOCK_ALLOC,
+         .arg = -1},
+    };
+
+    write_events(&header, events, 3);
+    assert(convert(EVENTS_PATH) == 0);
+    assert(json_count("\"traceEvents\"") == 1);
+    assert(json_count("\"thread_name\"") == 2);
+    assert(json_count("\"ph\":\"X\"") == 3);
+    assert(json_count("{\"name\":\"insert_delay\",\"ph\":\"X\",\"pid\":1,"
+                      "\"tid\":1,\"ts\":0.500,\"dur\":1.000,"
+                      "\"args\":{\"arg\":0}}") == 1);
+    assert(json_count("{\"name\":\"lookup\",\"ph\":\"X\",\"pid\":1,"
+                      "\"tid\":1,\"ts\":0.000,\"dur\":2.000,"
+                      "\"args\":{\"arg\":5}}") == 1);
+    assert(json_count("{\"name\":\"block_alloc\",\"ph\":\"X\",\"pid\":1,"
+                      "\"tid\":2,\"ts\":2.000,\"dur\":0.000,"
+                      "\"args\":{\"arg\":-1}}") == 1);
+
+    // Truncated
+    write_events(&header, events, 2);
+    assert(convert(EVENTS_PATH) != 0);
+
+    // Unknown event type
+    events[2].type = EVENT_TYPE_COUNT;
+    write_events(&header, events, 3);
+    assert(convert(EVENTS_PATH) != 0);
+
+    // Not an events file
+    header.magic[0] = 'X';
+    write_events(&header, events, 0);
+    assert(convert(EVENTS_PATH) != 0);
+
+    assert(convert("/tmp/tfs_test_1_26.missing") != 0);
+}
+
+#ifdef TFS_EVENTS
+
+void *lookups(void *arg) {
+    char const *path = arg;
+    for (;;) {
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+/**
+ * Record events in a child process, which exits (dumping them) while its
+ * threads keep recording more.
+ */
+static void record(void) {
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        assert(setenv("TFS_EVENTS", EVENTS_PATH, 1) == 0);
+        tfs_params params = tfs_default_params();
+        assert(tfs_init(&params) != -1);
+        int f = tfs_open("/f", TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+
+        for (int i = 0; i < THREADS; i++) {
+            pthread_t tid;
+            assert(pthread_create(&tid, NULL, lookups, "/f") == 0);
+            assert(pthread_detach(tid) == 0);
+        }
+        struct timespec delay = {0, 20 * 1000 * 1000};
+        nanosleep(&delay, NULL);
+        exit(EXIT_SUCCESS);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+static void test_recorded(void) {
+    record();
+
+    FILE *f = fopen(EVENTS_PATH, "rb");
+    assert(f != NULL);
+    tfs_events_header_t header;
+    assert(fread(&header, sizeof(header), 1, f) == 1);
+    assert(memcmp(header.magic, TFS_EVENTS_MAGIC, sizeof(header.magic)) == 0);
+    assert(header.tsc_end >= header.tsc_begin);
+    assert(header.ns_end >= header.ns_begin);
+
+    // Events are whole (as recorded) and grouped by thread
+    uint64_t count = 0;
+    uint64_t lookups_seen = 0;
+    unsigned threads_done[THREADS + 2] = {0};
+    size_t thread_count = 0;
+    tfs_event_t event;
+    while (fread(&event, sizeof(event), 1, f) == 1) {
+        assert(event.type < EVENT_TYPE_COUNT);
+        assert(event.thread != 0);
+        if (thread_count == 0 ||
+            threads_done[thread_count - 1] != event.thread) {
+            for (size_t i = 0; i < thread_count; i++) {
+                assert(threads_done[i] != event.thread);
+            }
+            assert(thread_count < THREADS + 2);
+            threads_done[thread_count++] = event.thread;
+        }
+        if (event.type == EVENT_LOOKUP) {
+            assert(event.arg >= -1);
+            lookups_seen++;
+        }
+        count++;
+    }
+    assert(fclose(f) == 0);
+    assert(count == header.event_count);
+    assert(lookups_seen > 0);
+
+    assert(convert(EVENTS_PATH) == 0);
+    assert(json_count("\"ph\":\"X\"") == count);
+    assert(json_count("\"name\":\"lookup\"") == lookups_seen);
+}
+
+#endif // TFS_EVENTS
+
+int main() {
+    test_handmade();
+#ifdef TFS_EVENTS
+    test_recorded();
+#endif
+
+    unlink(EVENTS_PATH);
+    unlink(JSON_PATH);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "utils/logging.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define OUTPUT_PATH "/tmp/tfs_test_1_27.log"
+#define THREADS 4
+#define MESSAGES 2000 // per thread: together, more than the queue holds
+#define LONG_LEN 1500
+#define PANIC_MESSAGES 100
+
+// This test logs from child processes, checking what they write to stderr:
+// messages from many threads at once are each written whole, once and in
+// order, or counted as dropped; a message logged at exit (after the writer
+// has stopped) is still written, last; and a PANIC is written after every
+// message queued before it
+
+static char output[1 << 20];
+
+/**
+ * Run a function in a child process, with its stderr in output.
+ *
+ * Returns the exit status of the child.
+ */
+static int run(void (*body)(void)) {
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        int err = open(OUTPUT_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (err == -1 || dup2(err, STDERR_FILENO) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        body();
+        exit(EXIT_SUCCESS);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+
+    FILE *f = fopen(OUTPUT_PATH, "r");
+    assert(f != NULL);
+    size_t len = fread(output, 1, sizeof(output) - 1, f);
+    assert(len < sizeof(output) - 1 && ferror(f) == 0);
+    output[len] = '\0';
+    assert(fclose(f) == 0);
+    assert(unlink(OUTPUT_PATH) == 0);
+
+    assert(len > 0 && output[len - 1] == '\n');
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * The message of a line (after its tag, file, line number and function).
+ */
+static char const *message_of(char const *line) {
+    char const *func = strstr(line, " :: ");
+    assert(func != NULL);
+    char const *message = strstr(func + 4, " :: ");
+    assert(message != NULL);
+    return message + 4;
+}
+
+void *log_messages(void *arg) {
+    int t = *(int *)arg;
+    for (int i = 0; i < MESSAGES; i++) {
+        LOG("t%d m%d", t, i);
+    }
+    return NULL;
+}
+
+static void log_at_exit(void) { INFO("late"); }
+
+static void log_many(void) {
+    set_log_level(LOG_NORMAL);
+    // Registered before the first message, so that it runs after the writer
+    // stops at exit
+    assert(atexit(log_at_exit) == 0);
+
+    char long_message[LONG_LEN + 1];
+    memset(long_message, 'x', LONG_LEN);
+    long_message[LONG_LEN] = '\0';
+    INFO("%s", long_message);
+
+    int ids[THREADS];
+    pthread_t tids[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        ids[t] = t;
+        assert(pthread_create(&tids[t], NULL, log_messages, &ids[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+}
+
+static void test_queue(void) {
+    assert(run(log_many) == EXIT_SUCCESS);
+
+    int next[THREADS] = {0};
+    unsigned long written = 0;
+    unsigned long dropped = 0;
+    bool long_seen = false;
+    char const *last = NULL;
+    char *save;
+    for (char *line = strtok_r(output, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save)) {
+        last = line;
+        unsigned long lost;
+        if (sscanf(line, "[WARN]:  %lu log messages dropped", &lost) == 1) {
+            dropped += lost;
+            continue;
+        }
+
+        char const *message = message_of(line);
+        int t;
+        int i;
+        if (sscanf(message, "t%d m%d", &t, &i) == 2) {
+            assert(strncmp(line, "[LOG]:   ", 9) == 0);
+            // Each thread's messages are written in order (some may be
+            // dropped)
+            assert(t >= 0 && t < THREADS && i >= next[t] && i < MESSAGES);
+            next[t] = i + 1;
+            written++;
+        } else if (message[0] == 'x') {
+            // Not truncated
+            assert(!long_seen && strspn(message, "x") == LONG_LEN);
+            assert(message[LONG_LEN] == '\0');
+            long_seen = true;
+        } else {
+            assert(strcmp(message, "late") == 0);
+        }
+    }
+    assert(long_seen);
+    assert(written + dropped == THREADS * MESSAGES);
+    assert(last != NULL && strcmp(message_of(last), "late") == 0);
+}
+
+static void log_then_panic(void) {
+    set_log_level(LOG_NORMAL);
+    for (int i = 0; i < PANIC_MESSAGES; i++) {
+        LOG("m%d", i);
+    }
+    PANIC("bye");
+}
+
+static void test_panic(void) {
+    assert(run(log_then_panic) == EXIT_FAILURE);
+
+    int next = 0;
+    char *save;
+    for (char *line = strtok_r(output, "\n", &save); line != NULL;
+         line = strtok_r(NULL, "\n", &save)) {
+        char const *message = message_of(line);
+        if (next < PANIC_MESSAGES) {
+            int i;
+            assert(sscanf(message, "m%d", &i) == 1 && i == next);
+            next++;
+        } else {
+            // The PANIC comes last
+            assert(strncmp(line, "[PANIC]: ", 9) == 0);
+            assert(strcmp(message, "bye") == 0);
+            assert(strtok_r(NULL, "\n", &save) == NULL);
+            next++;
+        }
+    }
+    assert(next == PANIC_MESSAGES + 1);
+}
+
+int main() {
+    test_queue();
+    test_panic();
+
+    printf("Successful test.\n");
+
+    return 0;
+}
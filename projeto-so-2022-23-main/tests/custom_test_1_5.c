@@ -0,0 +1,66 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREAD_NUM 8
+#define SHARED_FILE "/shared"
+
+void *open_files(void *arg);
+
+// This test opens and creates files from several threads at once, both with
+// distinct names and with the same name, and checks that concurrent creates of
+// the same name end up sharing a single file
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    pthread_t tid[THREAD_NUM];
+    int ids[THREAD_NUM];
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, open_files, &ids[i]) == 0);
+    }
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    // A single entry exists for the shared name
+    assert(tfs_unlink(SHARED_FILE) != -1);
+    assert(tfs_open(SHARED_FILE, 0) == -1);
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/own%d", i);
+
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void *open_files(void *arg) {
+    int id = *(int *)arg;
+
+    char path[16];
+    snprintf(path, sizeof(path), "/own%d", id);
+
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open(SHARED_FILE, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    return NULL;
+}
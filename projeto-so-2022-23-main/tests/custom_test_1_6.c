@@ -0,0 +1,66 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ROUNDS 5
+#define FILES_PER_ROUND 20
+#define STABLE_FILE "/stable"
+
+void *lookup_stable(void *arg);
+
+static int done = 0;
+
+// This test repeatedly fills the root directory and empties it again, so that
+// deleted entries have to be reclaimed and reused, while another thread keeps
+// looking up a file that is never removed
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open(STABLE_FILE, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, lookup_stable, NULL) == 0);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        char path[16];
+
+        for (int i = 0; i < FILES_PER_ROUND; i++) {
+            snprintf(path, sizeof(path), "/r%df%d", round, i);
+            f = tfs_open(path, TFS_O_CREAT);
+            assert(f != -1);
+            assert(tfs_close(f) != -1);
+        }
+
+        for (int i = 0; i < FILES_PER_ROUND; i++) {
+            snprintf(path, sizeof(path), "/r%df%d", round, i);
+            assert(tfs_unlink(path) != -1);
+            assert(tfs_open(path, 0) == -1);
+        }
+    }
+
+    __atomic_store_n(&done, 1, __ATOMIC_SEQ_CST);
+    assert(pthread_join(tid, NULL) == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
+
+void *lookup_stable(void *arg) {
+    (void)arg; // ignore parameter
+
+    while (!__atomic_load_n(&done, __ATOMIC_SEQ_CST)) {
+        int f = tfs_open(STABLE_FILE, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,56 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_LEN 1000
+#define CHUNK_LEN 10
+#define TFS_FILE "/stream"
+
+// This test reads a file in small sequential chunks (served from the
+// read-ahead window) and checks that a write through another handle in the
+// middle of the stream is seen by the reader
+
+int main() {
+    char contents[FILE_LEN];
+    for (int i = 0; i < FILE_LEN; i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+
+    assert(tfs_init(NULL) != -1);
+
+    int fw = tfs_open(TFS_FILE, TFS_O_CREAT);
+    assert(fw != -1);
+    assert(tfs_write(fw, contents, FILE_LEN) == FILE_LEN);
+    assert(tfs_close(fw) != -1);
+
+    int fr = tfs_open(TFS_FILE, 0);
+    assert(fr != -1);
+
+    char buffer[CHUNK_LEN];
+    for (int i = 0; i < FILE_LEN / 2; i += CHUNK_LEN) {
+        assert(tfs_read(fr, buffer, CHUNK_LEN) == CHUNK_LEN);
+        assert(memcmp(buffer, contents + i, CHUNK_LEN) == 0);
+    }
+
+    // Overwrite the whole file while the reader is halfway through
+    memset(contents, 'z', FILE_LEN);
+    fw = tfs_open(TFS_FILE, 0);
+    assert(fw != -1);
+    assert(tfs_write(fw, contents, FILE_LEN) == FILE_LEN);
+    assert(tfs_close(fw) != -1);
+
+    for (int i = FILE_LEN / 2; i < FILE_LEN; i += CHUNK_LEN) {
+        assert(tfs_read(fr, buffer, CHUNK_LEN) == CHUNK_LEN);
+        assert(memcmp(buffer, contents + i, CHUNK_LEN) == 0);
+    }
+
+    assert(tfs_read(fr, buffer, CHUNK_LEN) == 0);
+    assert(tfs_close(fr) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
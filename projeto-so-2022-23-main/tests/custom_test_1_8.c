@@ -0,0 +1,95 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RECORD_LEN 20
+#define RECORD_NUM 10
+#define BLOCK_LEN 1024
+#define TFS_FILE "/buffered"
+
+// This test writes small records through a buffered file handle and checks
+// that they only reach the file when the handle is flushed or closed, and
+// that a failed flush loses nothing
+
+void assert_file_len(char const *path, ssize_t len) {
+    char buffer[BLOCK_LEN];
+
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char record[RECORD_LEN];
+    memset(record, 'r', RECORD_LEN);
+
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open(TFS_FILE, TFS_O_CREAT | TFS_O_BUFFERED);
+    assert(f != -1);
+
+    for (int i = 0; i < RECORD_NUM; i++) {
+        assert(tfs_write(f, record, RECORD_LEN) == RECORD_LEN);
+    }
+
+    // Nothing was written to the file yet
+    assert_file_len(TFS_FILE, 0);
+
+    assert(tfs_flush(f) != -1);
+    assert_file_len(TFS_FILE, RECORD_LEN * RECORD_NUM);
+
+    for (int i = 0; i < RECORD_NUM; i++) {
+        assert(tfs_write(f, record, RECORD_LEN) == RECORD_LEN);
+    }
+
+    // Closing the handle flushes the remaining records
+    assert(tfs_close(f) != -1);
+    assert_file_len(TFS_FILE, RECORD_LEN * RECORD_NUM * 2);
+
+    // Reading through a buffered handle flushes its pending writes first
+    f = tfs_open(TFS_FILE, TFS_O_TRUNC | TFS_O_BUFFERED);
+    assert(f != -1);
+    assert(tfs_write(f, record, RECORD_LEN) == RECORD_LEN);
+    assert(tfs_read(f, record, RECORD_LEN) == 0);
+    assert_file_len(TFS_FILE, RECORD_LEN);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    // With no block left, filling the buffer fails without losing anything
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 2; // the root directory's and one more
+    assert(tfs_init(&params) != -1);
+
+    f = tfs_open("/other", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, record, 1) == 1);
+    assert(tfs_close(f) != -1);
+
+    char block[BLOCK_LEN];
+    memset(block, 'b', BLOCK_LEN);
+    f = tfs_open(TFS_FILE, TFS_O_CREAT | TFS_O_BUFFERED);
+    assert(f != -1);
+    assert(tfs_write(f, block, RECORD_LEN) == RECORD_LEN);
+    assert(tfs_write(f, block, BLOCK_LEN - RECORD_LEN) == -1);
+    assert(tfs_flush(f) == -1);
+
+    // The records buffered before the failed write are still pending
+    assert(tfs_unlink("/other") != -1);
+    assert(tfs_flush(f) != -1);
+    assert_file_len(TFS_FILE, RECORD_LEN);
+
+    // The failed write can be retried at the same offset
+    assert(tfs_write(f, block, BLOCK_LEN - RECORD_LEN) ==
+           BLOCK_LEN - RECORD_LEN);
+    assert_file_len(TFS_FILE, BLOCK_LEN);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include "fs/cache.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_NUM 20
+#define FILE_LEN 100
+#define THREADS 3
+#define THREAD_FILE_NUM 6
+#define IMAGE_PATH "tests/custom_test_1_9.img"
+#define STORE_BLOCKS 4
+#define STORE_BLOCK_SIZE 16
+
+// This test keeps the data blocks in an image file with room for only a few
+// of them in memory, and checks that the contents of more files than fit in
+// the cache survive eviction; then, with the default cache size, that threads
+// using blocks of different cache stripes at once see their own contents;
+// last, that a backing store failing to read or write makes the cache fail
+// the call, keeping dirty blocks until they can be written
+
+void file_contents(int i, char *buffer) {
+    memset(buffer, 'a' + i % 26, FILE_LEN);
+}
+
+void *write_and_check(void *arg) {
+    int t = *(int *)arg;
+    char path[16];
+    char contents[FILE_LEN];
+    char buffer[FILE_LEN];
+
+    for (int i = 0; i < THREAD_FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/t%df%d", t, i);
+        file_contents(t + i, contents);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, contents, FILE_LEN) == FILE_LEN);
+        assert(tfs_close(f) != -1);
+    }
+
+    for (int i = 0; i < THREAD_FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/t%df%d", t, i);
+        file_contents(t + i, contents);
+
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, FILE_LEN) == FILE_LEN);
+        assert(memcmp(buffer, contents, FILE_LEN) == 0);
+        assert(tfs_close(f) != -1);
+    }
+    return NULL;
+}
+
+static char store[STORE_BLOCKS][STORE_BLOCK_SIZE];
+static atomic_bool fail_reads = false;
+static atomic_bool fail_writes = false;
+
+static int store_read(void *unused, int block_number, void *buffer) {
+    (void)unused;
+    if (atomic_load(&fail_reads)) {
+        return -1;
+    }
+    memcpy(buffer, store[block_number], STORE_BLOCK_SIZE);
+    return 0;
+}
+
+static int store_write(void *unused, int block_number, void const *buffer) {
+    (void)unused;
+    if (atomic_load(&fail_writes)) {
+        return -1;
+    }
+    memcpy(store[block_number], buffer, STORE_BLOCK_SIZE);
+    return 0;
+}
+
+static cache_backend_t const failing_backend = {
+    .read = store_read,
+    .write = store_write,
+    .discard = NULL,
+    .write_through = false,
+};
+
+static void test_failing_store(void) {
+    // Room for 2 blocks
+    cache_t *cache = cache_init(&failing_backend, NULL, STORE_BLOCKS,
+                                STORE_BLOCK_SIZE, 2);
+    assert(cache != NULL);
+
+    // Block 0 is modified while writes fail, so it stays dirty
+    atomic_store(&fail_writes, true);
+    char *block = cache_block_get(cache, 0);
+    assert(block != NULL);
+    memset(block, 'x', STORE_BLOCK_SIZE);
+    assert(cache_block_put(cache, 0, true) == 0);
+    assert(cache_block_get(cache, 1) != NULL);
+    assert(cache_block_put(cache, 1, false) == 0);
+
+    // Making room for block 2 means writing block 0 first
+    assert(cache_block_get(cache, 2) == NULL);
+
+    // Block 0 gets written, but block 2 can't be read
+    atomic_store(&fail_writes, false);
+    atomic_store(&fail_reads, true);
+    assert(cache_block_get(cache, 2) == NULL);
+    assert(store[0][0] == 'x');
+
+    atomic_store(&fail_reads, false);
+    block = cache_block_get(cache, 0);
+    assert(block != NULL && block[0] == 'x');
+
+    // A dirty block that can't be written when the cache is destroyed
+    atomic_store(&fail_writes, true);
+    assert(cache_block_put(cache, 0, true) == 0);
+    assert(cache_destroy(cache) == -1);
+    atomic_store(&fail_writes, false);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_image_path = IMAGE_PATH;
+    params.block_cache_count = 4;
+    assert(tfs_init(&params) != -1);
+
+    char path[16];
+    char contents[FILE_LEN];
+    char buffer[FILE_LEN];
+
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        file_contents(i, contents);
+
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, contents, FILE_LEN) == FILE_LEN);
+        assert(tfs_close(f) != -1);
+    }
+
+    for (int i = 0; i < FILE_NUM; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        file_contents(i, contents);
+
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, FILE_LEN) == FILE_LEN);
+        assert(memcmp(buffer, contents, FILE_LEN) == 0);
+        assert(tfs_close(f) != -1);
+    }
+
+    tfs_cache_stats_t stats;
+    assert(tfs_cache_stats(&stats) != -1);
+    assert(stats.hits > 0);
+    assert(stats.misses > 0);
+    assert(stats.evictions > 0);
+
+    assert(tfs_destroy() != -1);
+    assert(unlink(IMAGE_PATH) == 0);
+
+    // A block cache count of 0 picks the default size
+    params.block_cache_count = 0;
+    assert(tfs_init(&params) != -1);
+
+    pthread_t tids[THREADS];
+    int ids[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        ids[t] = t;
+        assert(pthread_create(&tids[t], NULL, write_and_check, &ids[t]) == 0);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+
+    assert(tfs_cache_stats(&stats) != -1);
+    assert(stats.misses > 0);
+
+    assert(tfs_destroy() != -1);
+    assert(unlink(IMAGE_PATH) == 0);
+
+    // Without an image file there is no cache to report on
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_cache_stats(&stats) == -1);
+    assert(tfs_destroy() != -1);
+
+    test_failing_store();
+
+    printf("Successful test.\n");
+
+    return 0;
+}
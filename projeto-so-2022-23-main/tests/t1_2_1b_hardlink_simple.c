@@ -74,7 +74,10 @@ int main() {
     assert(tfs_link(target_path2, link_path2) != -1);
     assert_contents_ok(link_path2);
 
-    blocks_taken();
+    // The root directory and both files (the hard link takes no block)
+    tfs_stats_t stats;
+    assert(tfs_get_stats(&stats) == 0);
+    assert(stats.blocks - stats.free_blocks == 3);
 
     assert(tfs_destroy() != -1);
 
@@ -1,5 +1,265 @@
+#define _DEFAULT_SOURCE // for usleep
+
 #include "logging.h"
 
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// Queued messages (a power of two), each truncated to LOG_MESSAGE_SIZE bytes
+// (as when they were written straight to stderr)
+#define LOG_QUEUE_SIZE (1024)
+#define LOG_MESSAGE_SIZE (2048)
+// Longest the writer sleeps while the queue is empty
+#define LOG_IDLE_MAX_US (10000)
+
 log_level_t g_level = LOG_QUIET;
 
-void set_log_level(log_level_t level) { g_level = level; }
\ No newline at end of file
+void set_log_level(log_level_t level) { g_level = level; }
+
+static char const *const tags[] = {
+    [LOG_SEVERITY_DEBUG] = "[DEBUG]: ", [LOG_SEVERITY_LOG] = "[LOG]:   ",
+    [LOG_SEVERITY_WARN] = "[WARN]:  ",  [LOG_SEVERITY_INFO] = "[INFO]:  ",
+    [LOG_SEVERITY_PANIC] = "[PANIC]: ",
+};
+
+/*
+ * Bounded multi-producer queue: a slot is free for the message at position
+ * pos when its sequence number is pos, and holds that message once it is
+ * pos + 1; the writer then frees it for position pos + LOG_QUEUE_SIZE.
+ */
+typedef struct {
+    atomic_size_t seq;
+    size_t len;
+    char line[LOG_MESSAGE_SIZE];
+} log_slot_t;
+
+static log_slot_t slots[LOG_QUEUE_SIZE];
+static atomic_size_t enqueue_pos = 0;
+static size_t dequeue_pos = 0; // under drain_lock
+static atomic_ulong dropped = 0;
+// Held to drain the queue: by the writer, and once it stops, by whoever
+// writes a message
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_t writer;
+static atomic_bool stopping = false;
+
+static void stop(void);
+
+static void drain_lock_acquire(void) {
+    if (pthread_mutex_lock(&drain_lock) != 0) {
+        perror("logging: pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void drain_lock_release(void) {
+    if (pthread_mutex_unlock(&drain_lock) != 0) {
+        perror("logging: pthread_mutex_unlock");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Write the messages in the queue to stderr (with drain_lock held).
+ *
+ * Returns how many messages were written.
+ */
+static size_t drain(void) {
+    char batch[4 * LOG_MESSAGE_SIZE];
+    size_t batch_len = 0;
+    size_t count = 0;
+
+    for (;;) {
+        log_slot_t *slot = &slots[dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+        // Sequentially consistent, like the store in log_write
+        bool ready = atomic_load(&slot->seq) == dequeue_pos + 1;
+        if (batch_len > 0 &&
+            (!ready || batch_len + slot->len > sizeof(batch))) {
+            if (write(STDERR_FILENO, batch, batch_len) < 0) {
+                // Nowhere left to report it
+            }
+            batch_len = 0;
+        }
+        if (!ready) {
+            break;
+        }
+
+        memcpy(batch + batch_len, slot->line, slot->len);
+        batch_len += slot->len;
+        atomic_store_explicit(&slot->seq, dequeue_pos + LOG_QUEUE_SIZE,
+                              memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+
+    unsigned long lost = atomic_exchange(&dropped, 0);
+    if (lost > 0) {
+        fprintf(stderr, "[WARN]:  %lu log messages dropped (queue full)\n",
+                lost);
+    }
+    return count;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    useconds_t idle_us = 50;
+    while (!atomic_load(&stopping)) {
+        drain_lock_acquire();
+        size_t count = drain();
+        drain_lock_release();
+        if (count > 0) {
+            idle_us = 50;
+        } else {
+            usleep(idle_us);
+            if (idle_us < LOG_IDLE_MAX_US) {
+                idle_us *= 2;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void start(void) {
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        atomic_init(&slots[i].seq, i);
+    }
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+        perror("logging: pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    atexit(stop);
+}
+
+/**
+ * Write the messages still queued, then a line of its own (if len > 0),
+ * once the writer is stopping.
+ */
+static void write_late(char const *line, size_t len) {
+    drain_lock_acquire();
+    drain();
+    if (len > 0 && write(STDERR_FILENO, line, len) < 0) {
+        // Nowhere left to report it
+    }
+    drain_lock_release();
+}
+
+/**
+ * Stop the writer once it has written everything queued (at exit, or on a
+ * PANIC). Messages logged from then on are written directly.
+ */
+static void stop(void) {
+    if (atomic_exchange(&stopping, true)) {
+        return; // already stopped
+    }
+    if (pthread_join(writer, NULL) != 0) {
+        perror("logging: pthread_join");
+    }
+    // A message queued too late for this drain sees stopping set (see
+    // log_write), and is written by its own thread
+    write_late(NULL, 0);
+}
+
+/**
+ * Take a free slot, or return NULL if the queue is full.
+ */
+static log_slot_t *slot_take(size_t *pos_out) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        log_slot_t *slot = &slots[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &enqueue_pos, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed)) {
+                *pos_out = pos;
+                return slot;
+            }
+        } else if ((intptr_t)(seq - pos) < 0) {
+            return NULL; // the writer hasn't freed it yet
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Format a message into a line (truncated to size bytes, newline included).
+ *
+ * Returns the length of the line.
+ */
+static size_t format_line(char *line, size_t size, int severity,
+                          char const *file, int line_number, char const *func,
+                          char const *format, va_list args) {
+    int prefix = snprintf(line, size, "%s%s:%d :: %s :: ", tags[severity],
+                          file, line_number, func);
+    size_t len = prefix < 0 ? 0 : (size_t)prefix;
+    if (len < size - 1) {
+        int message = vsnprintf(line + len, size - 1 - len, format, args);
+        len += message < 0 ? 0 : (size_t)message;
+    }
+    if (len > size - 2) {
+        len = size - 2; // truncated
+    }
+    line[len++] = '\n';
+    return len;
+}
+
+void log_write(int severity, char const *file, int line, char const *func,
+               char const *format, ...) {
+    pthread_once(&start_once, start);
+
+    va_list args;
+    if (atomic_load(&stopping)) {
+        // No writer left to queue it for
+        char buf[LOG_MESSAGE_SIZE];
+        va_start(args, format);
+        size_t len = format_line(buf, sizeof(buf), severity, file, line, func,
+                                 format, args);
+        va_end(args);
+        write_late(buf, len);
+        return;
+    }
+
+    size_t pos;
+    log_slot_t *slot = slot_take(&pos);
+    if (slot == NULL) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    va_start(args, format);
+    slot->len = format_line(slot->line, sizeof(slot->line), severity, file,
+                            line, func, format, args);
+    va_end(args);
+    // Sequentially consistent, as is the load of stopping after it: either
+    // the last drain of stop sees this message, or this thread sees stopping
+    atomic_store(&slot->seq, pos + 1);
+
+    // The writer may have stopped after the check above
+    if (atomic_load(&stopping)) {
+        write_late(NULL, 0);
+    }
+}
+
+_Noreturn void log_panic(char const *file, int line, char const *func,
+                         char const *format, ...) {
+    char buf[LOG_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    size_t len = format_line(buf, sizeof(buf), LOG_SEVERITY_PANIC, file, line,
+                             func, format, args);
+    va_end(args);
+
+    // Written after the messages queued before it
+    pthread_once(&start_once, start);
+    stop();
+    write_late(buf, len);
+    exit(EXIT_FAILURE);
+}
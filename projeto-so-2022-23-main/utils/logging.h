@@ -13,51 +13,92 @@ typedef enum {
 void set_log_level(log_level_t level);
 extern log_level_t g_level;
 
-#define INFO(...)                                                              \
-    do {                                                                       \
-        char buf[2048];                                                        \
-        snprintf(buf, 2048, __VA_ARGS__);                                      \
-        fprintf(stderr, "[INFO]:  %s:%d :: %s :: %s\n", __FILE__, __LINE__,    \
-                __func__, buf);                                                \
-    } while (0);
+/*
+ * Severities of the macros below. Statements less severe than
+ * LOG_MIN_SEVERITY are compiled out, arguments included (e.g. make
+ * LOG_MIN_SEVERITY=WARN keeps WARN, INFO and PANIC); the others are then
+ * filtered by the level set with set_log_level: DEBUG needs LOG_VERBOSE, LOG
+ * and WARN need LOG_NORMAL, INFO and PANIC are always printed.
+ *
+ * Messages are formatted by the caller straight into a slot of a lock-free
+ * queue, and written to stderr by a background thread, so that logging never
+ * waits for stderr; if the queue is full, the message is dropped (and the
+ * drops are reported). A PANIC writes the messages queued before it, then
+ * its own, before exiting. Once the background thread has stopped (on a
+ * PANIC, or at exit), messages are written directly, after the queued ones.
+ */
+#define LOG_SEVERITY_DEBUG 0
+#define LOG_SEVERITY_LOG 1
+#define LOG_SEVERITY_WARN 2
+#define LOG_SEVERITY_INFO 3
+#define LOG_SEVERITY_PANIC 4
 
-#define PANIC(...)                                                             \
-    do {                                                                       \
-        char buf[2048];                                                        \
-        snprintf(buf, 2048, __VA_ARGS__);                                      \
-        fprintf(stderr, "[PANIC]: %s:%d :: %s :: %s\n", __FILE__, __LINE__,    \
-                __func__, buf);                                                \
-        exit(EXIT_FAILURE);                                                    \
-    } while (0);
+#ifndef LOG_MIN_SEVERITY
+#define LOG_MIN_SEVERITY LOG_SEVERITY_DEBUG
+#endif
 
-#define WARN(...)                                                              \
+/**
+ * Queue a message of a given severity (the format is that of printf).
+ */
+void log_write(int severity, char const *file, int line, char const *func,
+               char const *format, ...) __attribute__((format(printf, 5, 6)));
+
+/**
+ * Write a message and the ones queued before it, then exit with failure.
+ */
+_Noreturn void log_panic(char const *file, int line, char const *func,
+                         char const *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/**
+ * Does nothing, so that compiled out statements still type check.
+ */
+__attribute__((format(printf, 1, 2))) static inline void
+log_discard(char const *format, ...) {
+    (void)format;
+}
+
+#define LOG_STATEMENT(severity, enabled, ...)                                  \
     do {                                                                       \
-        if (g_level == LOG_NORMAL || g_level == LOG_VERBOSE) {                 \
-            char buf[2048];                                                    \
-            snprintf(buf, 2048, __VA_ARGS__);                                  \
-            fprintf(stderr, "[WARN]:  %s:%d :: %s :: %s\n", __FILE__,          \
-                    __LINE__, __func__, buf);                                  \
+        if (enabled) {                                                         \
+            log_write(severity, __FILE__, __LINE__, __func__, __VA_ARGS__);    \
         }                                                                      \
-    } while (0);
+    } while (0)
 
-#define LOG(...)                                                               \
+#define LOG_DISCARD(...)                                                       \
     do {                                                                       \
-        if (g_level == LOG_NORMAL || g_level == LOG_VERBOSE) {                 \
-            char buf[2048];                                                    \
-            snprintf(buf, 2048, __VA_ARGS__);                                  \
-            fprintf(stderr, "[LOG]:   %s:%d :: %s :: %s\n", __FILE__,          \
-                    __LINE__, __func__, buf);                                  \
+        if (0) {                                                               \
+            log_discard(__VA_ARGS__);                                          \
         }                                                                      \
-    } while (0);
+    } while (0)
+
+#if LOG_MIN_SEVERITY <= LOG_SEVERITY_INFO
+#define INFO(...) LOG_STATEMENT(LOG_SEVERITY_INFO, 1, __VA_ARGS__)
+#else
+#define INFO(...) LOG_DISCARD(__VA_ARGS__)
+#endif
 
+#define PANIC(...) log_panic(__FILE__, __LINE__, __func__, __VA_ARGS__)
+
+#if LOG_MIN_SEVERITY <= LOG_SEVERITY_WARN
+#define WARN(...)                                                              \
+    LOG_STATEMENT(LOG_SEVERITY_WARN, g_level >= LOG_NORMAL, __VA_ARGS__)
+#else
+#define WARN(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if LOG_MIN_SEVERITY <= LOG_SEVERITY_LOG
+#define LOG(...)                                                               \
+    LOG_STATEMENT(LOG_SEVERITY_LOG, g_level >= LOG_NORMAL, __VA_ARGS__)
+#else
+#define LOG(...) LOG_DISCARD(__VA_ARGS__)
+#endif
+
+#if LOG_MIN_SEVERITY <= LOG_SEVERITY_DEBUG
 #define DEBUG(...)                                                             \
-    do {                                                                       \
-        if (g_level == LOG_VERBOSE) {                                          \
-            char buf[2048];                                                    \
-            snprintf(buf, 2048, __VA_ARGS__);                                  \
-            fprintf(stderr, "[DEBUG]: %s:%d :: %s :: %s\n", __FILE__,          \
-                    __LINE__, __func__, buf);                                  \
-        }                                                                      \
-    } while (0);
+    LOG_STATEMENT(LOG_SEVERITY_DEBUG, g_level == LOG_VERBOSE, __VA_ARGS__)
+#else
+#define DEBUG(...) LOG_DISCARD(__VA_ARGS__)
+#endif
 
-#endif // __UTILS_LOGGING_H__
\ No newline at end of file
+#endif // __UTILS_LOGGING_H__
@@ -0,0 +1,86 @@
+#include "producer-consumer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int pcq_create(pc_queue_t *queue, size_t capacity) {
+    if (capacity == 0) {
+        return -1;
+    }
+
+    queue->pcq_buffer = malloc(capacity * sizeof(void *));
+    if (queue->pcq_buffer == NULL) {
+        return -1;
+    }
+
+    queue->pcq_capacity = capacity;
+    queue->pcq_current_size = 0;
+    queue->pcq_head = 0;
+    queue->pcq_tail = 0;
+
+    if (pthread_mutex_init(&queue->pcq_lock, NULL) != 0 ||
+        pthread_cond_init(&queue->pcq_pusher_condvar, NULL) != 0 ||
+        pthread_cond_init(&queue->pcq_popper_condvar, NULL) != 0) {
+        free(queue->pcq_buffer);
+        return -1;
+    }
+
+    return 0;
+}
+
+int pcq_destroy(pc_queue_t *queue) {
+    int res = 0;
+    if (pthread_mutex_destroy(&queue->pcq_lock) != 0 ||
+        pthread_cond_destroy(&queue->pcq_pusher_condvar) != 0 ||
+        pthread_cond_destroy(&queue->pcq_popper_condvar) != 0) {
+        res = -1;
+    }
+
+    free(queue->pcq_buffer);
+    queue->pcq_buffer = NULL;
+    return res;
+}
+
+int pcq_enqueue(pc_queue_t *queue, void *elem) {
+    if (pthread_mutex_lock(&queue->pcq_lock) != 0) {
+        return -1;
+    }
+
+    while (queue->pcq_current_size == queue->pcq_capacity) {
+        if (pthread_cond_wait(&queue->pcq_pusher_condvar, &queue->pcq_lock) !=
+            0) {
+            pthread_mutex_unlock(&queue->pcq_lock);
+            return -1;
+        }
+    }
+
+    queue->pcq_buffer[queue->pcq_tail] = elem;
+    queue->pcq_tail = (queue->pcq_tail + 1) % queue->pcq_capacity;
+    queue->pcq_current_size++;
+
+    pthread_cond_signal(&queue->pcq_popper_condvar);
+    pthread_mutex_unlock(&queue->pcq_lock);
+    return 0;
+}
+
+void *pcq_dequeue(pc_queue_t *queue) {
+    if (pthread_mutex_lock(&queue->pcq_lock) != 0) {
+        perror("pthread_mutex_lock");
+        exit(EXIT_FAILURE);
+    }
+
+    while (queue->pcq_current_size == 0) {
+        if (pthread_cond_wait(&queue->pcq_popper_condvar, &queue->pcq_lock) !=
+            0) {
+            perror("pthread_cond_wait");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    void *elem = queue->pcq_buffer[queue->pcq_head];
+    queue->pcq_head = (queue->pcq_head + 1) % queue->pcq_capacity;
+    queue->pcq_current_size--;
+
+    pthread_cond_signal(&queue->pcq_pusher_condvar);
+    pthread_mutex_unlock(&queue->pcq_lock);
+    return elem;
+}
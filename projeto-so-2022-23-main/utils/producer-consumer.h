@@ -0,0 +1,57 @@
+#ifndef __UTILS_PRODUCER_CONSUMER_H__
+#define __UTILS_PRODUCER_CONSUMER_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * Bounded, thread-safe FIFO queue of pointers: pcq_enqueue blocks while the
+ * queue is full and pcq_dequeue blocks while it is empty.
+ */
+typedef struct pc_queue_t {
+    void **pcq_buffer;
+    size_t pcq_capacity;
+
+    pthread_mutex_t pcq_lock; // protects all the fields below
+    size_t pcq_current_size;
+    size_t pcq_head;
+    size_t pcq_tail;
+
+    pthread_cond_t pcq_pusher_condvar; // signalled when an element is removed
+    pthread_cond_t pcq_popper_condvar; // signalled when an element is added
+} pc_queue_t;
+
+/**
+ * Create a queue, with a given (fixed) capacity.
+ *
+ * Input:
+ *   - queue: the queue to initialize
+ *   - capacity: maximum number of elements in the queue
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int pcq_create(pc_queue_t *queue, size_t capacity);
+
+/**
+ * Release the internal resources of a queue. The elements still in the queue
+ * are not freed.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int pcq_destroy(pc_queue_t *queue);
+
+/**
+ * Insert a new element at the back of the queue, waiting while it is full.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int pcq_enqueue(pc_queue_t *queue, void *elem);
+
+/**
+ * Remove the element at the front of the queue, waiting while it is empty.
+ *
+ * Returns the removed element.
+ */
+void *pcq_dequeue(pc_queue_t *queue);
+
+#endif // __UTILS_PRODUCER_CONSUMER_H__